@@ -34,8 +34,21 @@ struct weston_binding {
 	void *handler;
 	void *data;
 	struct wl_list link;
+	struct wl_list table_link;
 };
 
+/* Key, button and axis bindings are also kept in a table indexed by code
+ * and modifiers, so dispatch only looks at the bindings that can match.
+ * Bindings for the same code and modifiers share a bucket, where they
+ * stay in the order they were added. */
+static struct wl_list *
+binding_table_bucket(struct wl_list *table, uint32_t code, uint32_t modifier)
+{
+	uint32_t hash = code * 31 + modifier;
+
+	return &table[hash & (WESTON_BINDING_TABLE_SIZE - 1)];
+}
+
 static struct weston_binding *
 weston_compositor_add_binding(struct weston_compositor *compositor,
 			      uint32_t key, uint32_t button, uint32_t axis,
@@ -53,6 +66,7 @@ weston_compositor_add_binding(struct weston_compositor *compositor,
 	binding->modifier = modifier;
 	binding->handler = handler;
 	binding->data = data;
+	wl_list_init(&binding->table_link);
 
 	return binding;
 }
@@ -71,6 +85,9 @@ weston_compositor_add_key_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->key_binding_list.prev, &binding->link);
+	wl_list_insert(binding_table_bucket(compositor->key_binding_table,
+					    key, modifier)->prev,
+		       &binding->table_link);
 
 	return binding;
 }
@@ -107,6 +124,9 @@ weston_compositor_add_button_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->button_binding_list.prev, &binding->link);
+	wl_list_insert(binding_table_bucket(compositor->button_binding_table,
+					    button, modifier)->prev,
+		       &binding->table_link);
 
 	return binding;
 }
@@ -143,6 +163,9 @@ weston_compositor_add_axis_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->axis_binding_list.prev, &binding->link);
+	wl_list_insert(binding_table_bucket(compositor->axis_binding_table,
+					    axis, modifier)->prev,
+		       &binding->table_link);
 
 	return binding;
 }
@@ -167,6 +190,7 @@ WL_EXPORT void
 weston_binding_destroy(struct weston_binding *binding)
 {
 	wl_list_remove(&binding->link);
+	wl_list_remove(&binding->table_link);
 	free(binding);
 }
 
@@ -262,6 +286,7 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  enum wl_keyboard_key_state state)
 {
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
 		return;
@@ -270,7 +295,9 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = key;
 
-	wl_list_for_each(b, &compositor->key_binding_list, link) {
+	bucket = binding_table_bucket(compositor->key_binding_table,
+				      key, seat->modifier_state);
+	wl_list_for_each(b, bucket, table_link) {
 		if (b->key == key && b->modifier == seat->modifier_state) {
 			weston_key_binding_handler_t handler = b->handler;
 			handler(seat, time, key, b->data);
@@ -323,6 +350,7 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 				     enum wl_pointer_button_state state)
 {
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		return;
@@ -331,7 +359,9 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = button;
 
-	wl_list_for_each(b, &compositor->button_binding_list, link) {
+	bucket = binding_table_bucket(compositor->button_binding_table,
+				      button, seat->modifier_state);
+	wl_list_for_each(b, bucket, table_link) {
 		if (b->button == button && b->modifier == seat->modifier_state) {
 			weston_button_binding_handler_t handler = b->handler;
 			handler(seat, time, button, b->data);
@@ -364,12 +394,15 @@ weston_compositor_run_axis_binding(struct weston_compositor *compositor,
 				   wl_fixed_t value)
 {
 	struct weston_binding *b;
+	struct wl_list *bucket;
 
 	/* Invalidate all active modifier bindings. */
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = axis;
 
-	wl_list_for_each(b, &compositor->axis_binding_list, link) {
+	bucket = binding_table_bucket(compositor->axis_binding_table,
+				      axis, seat->modifier_state);
+	wl_list_for_each(b, bucket, table_link) {
 		if (b->axis == axis && b->modifier == seat->modifier_state) {
 			weston_axis_binding_handler_t handler = b->handler;
 			handler(seat, time, axis, value, b->data);
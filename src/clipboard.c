@@ -24,18 +24,30 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
+#include "../shared/os-compatibility.h"
 #include "compositor.h"
 
+/* Selections larger than this are moved out of the compositor's memory
+ * into an unlinked file, which they are then spliced into and served
+ * from without copying through user space. */
+#define CLIPBOARD_MEMORY_LIMIT	(1024 * 1024)
+#define CLIPBOARD_CHUNK_SIZE	(1024 * 1024)
+
 struct clipboard_source {
 	struct weston_data_source base;
 	struct wl_array contents;
+	int file_fd;
+	size_t size;
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
+	struct wl_list waiting_clients;
 	uint32_t serial;
 	int refcount;
 	int fd;
@@ -63,6 +75,8 @@ clipboard_source_unref(struct clipboard_source *source)
 		wl_event_source_remove(source->event_source);
 		close(source->fd);
 	}
+	if (source->file_fd >= 0)
+		close(source->file_fd);
 	wl_signal_emit(&source->base.destroy_signal,
 		       &source->base);
 	s = source->base.mime_types.data;
@@ -72,31 +86,114 @@ clipboard_source_unref(struct clipboard_source *source)
 	free(source);
 }
 
+/* Moves what has been read so far into a file and frees the memory. */
+static int
+clipboard_source_spill(struct clipboard_source *source)
+{
+	char *p = source->contents.data;
+	size_t offset = 0;
+	ssize_t len;
+	int fd;
+
+	fd = os_create_anonymous_file(source->contents.size);
+	if (fd < 0)
+		return -1;
+
+	while (offset < source->contents.size) {
+		len = write(fd, p + offset, source->contents.size - offset);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			close(fd);
+			return -1;
+		}
+		offset += len;
+	}
+
+	source->file_fd = fd;
+	wl_array_release(&source->contents);
+	wl_array_init(&source->contents);
+
+	return 0;
+}
+
+static ssize_t
+clipboard_source_read_file(struct clipboard_source *source, int fd)
+{
+	char buffer[16384];
+	loff_t offset = source->size;
+	ssize_t len;
+
+	len = splice(fd, NULL, source->file_fd, &offset, CLIPBOARD_CHUNK_SIZE,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len >= 0 || errno != EINVAL)
+		return len;
+
+	/* The file system can't splice, copy it over instead. */
+	len = read(fd, buffer, sizeof buffer);
+	if (len > 0 && pwrite(source->file_fd, buffer, len, source->size) != len)
+		return -1;
+
+	return len;
+}
+
+static ssize_t
+clipboard_source_read_memory(struct clipboard_source *source, int fd)
+{
+	ssize_t len;
+
+	if (source->contents.alloc - source->contents.size < 4096) {
+		if (wl_array_add(&source->contents, 4096) == NULL)
+			return -1;
+		source->contents.size -= 4096;
+	}
+
+	len = read(fd, (char *) source->contents.data + source->contents.size,
+		   source->contents.alloc - source->contents.size);
+	if (len > 0)
+		source->contents.size += len;
+
+	return len;
+}
+
+static void
+clipboard_source_wake_clients(struct clipboard_source *source);
+
 static int
 clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
+	ssize_t len;
+
+	if (source->file_fd < 0 &&
+	    source->contents.size >= CLIPBOARD_MEMORY_LIMIT &&
+	    clipboard_source_spill(source) < 0)
+		weston_log("clipboard: failed to move selection to a file, "
+			   "keeping it in memory\n");
+
+	if (source->file_fd >= 0)
+		len = clipboard_source_read_file(source, fd);
+	else
+		len = clipboard_source_read_memory(source, fd);
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
+	if (len > 0) {
+		source->size += len;
+		clipboard_source_wake_clients(source);
+		return 1;
 	}
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
-	if (len == 0) {
-		wl_event_source_remove(source->event_source);
-		close(fd);
-		source->event_source = NULL;
-	} else if (len < 0) {
+	wl_event_source_remove(source->event_source);
+	close(fd);
+	source->event_source = NULL;
+	clipboard_source_wake_clients(source);
+
+	if (len < 0) {
 		clipboard_source_unref(source);
 		clipboard->source = NULL;
-	} else {
-		source->contents.size += len;
 	}
 
 	return 1;
@@ -142,6 +239,9 @@ clipboard_source_create(struct clipboard *clipboard,
 		return NULL;
 
 	wl_array_init(&source->contents);
+	source->file_fd = -1;
+	source->size = 0;
+	wl_list_init(&source->waiting_clients);
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -151,6 +251,7 @@ clipboard_source_create(struct clipboard *clipboard,
 	source->refcount = 1;
 	source->clipboard = clipboard;
 	source->serial = serial;
+	source->fd = fd;
 
 	s = wl_array_add(&source->base.mime_types, sizeof *s);
 	if (s == NULL)
@@ -178,31 +279,81 @@ clipboard_source_create(struct clipboard *clipboard,
 
 struct clipboard_client {
 	struct wl_event_source *event_source;
+	struct wl_list link;
 	size_t offset;
 	struct clipboard_source *source;
 };
 
+static void
+clipboard_source_wake_clients(struct clipboard_source *source)
+{
+	struct clipboard_client *client, *next;
+
+	wl_list_for_each_safe(client, next, &source->waiting_clients, link) {
+		wl_list_remove(&client->link);
+		wl_list_init(&client->link);
+		wl_event_source_fd_update(client->event_source,
+					  WL_EVENT_WRITABLE);
+	}
+}
+
+static void
+clipboard_client_destroy(struct clipboard_client *client, int fd)
+{
+	close(fd);
+	wl_event_source_remove(client->event_source);
+	wl_list_remove(&client->link);
+	clipboard_source_unref(client->source);
+	free(client);
+}
+
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
+	struct clipboard_source *source = client->source;
 	char *p;
+	off_t offset;
 	size_t size;
-	int len;
+	ssize_t len = 0;
 
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
-	if (len > 0)
-		client->offset += len;
+	/* Reported even while waiting with an empty mask, when the
+	 * reader closes its end of the pipe. */
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		clipboard_client_destroy(client, fd);
+		return 0;
+	}
 
-	if (client->offset == size || len <= 0) {
-		close(fd);
-		wl_event_source_remove(client->event_source);
-		clipboard_source_unref(client->source);
-		free(client);
+	size = source->size;
+	if (client->offset < size) {
+		if (source->file_fd >= 0) {
+			offset = client->offset;
+			len = sendfile(fd, source->file_fd, &offset,
+				       size - client->offset);
+		} else {
+			p = source->contents.data;
+			len = write(fd, p + client->offset,
+				    size - client->offset);
+		}
+
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return 1;
+		if (len > 0)
+			client->offset += len;
+	}
+
+	/* Caught up with a selection that is still being read. */
+	if (client->offset == size && len >= 0 && source->event_source) {
+		wl_event_source_fd_update(client->event_source, 0);
+		if (wl_list_empty(&client->link))
+			wl_list_insert(&source->waiting_clients,
+				       &client->link);
+		return 1;
 	}
 
+	if (client->offset == size || len <= 0)
+		clipboard_client_destroy(client, fd);
+
 	return 1;
 }
 
@@ -213,15 +364,32 @@ clipboard_client_create(struct clipboard_source *source, int fd)
 	struct clipboard_client *client;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(seat->compositor->wl_display);
+	int flags;
 
 	client = malloc(sizeof *client);
+	if (client == NULL) {
+		close(fd);
+		return;
+	}
+
+	/* Never block the compositor on a reader that is slow to drain
+	 * the pipe. */
+	flags = fcntl(fd, F_GETFL);
+	if (flags != -1)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 
 	client->offset = 0;
 	client->source = source;
-	source->refcount++;
+	wl_list_init(&client->link);
 	client->event_source =
 		wl_event_loop_add_fd(loop, fd, WL_EVENT_WRITABLE,
 				     clipboard_client_data, client);
+	if (client->event_source == NULL) {
+		close(fd);
+		free(client);
+		return;
+	}
+	source->refcount++;
 }
 
 static void
@@ -1038,6 +1038,40 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+static int
+drm_output_move_cursor(struct weston_output *output_base,
+		       struct weston_view *ev, int32_t x, int32_t y)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+
+	if (ev->plane != &output->cursor_plane || c->cursors_are_broken)
+		return -1;
+	if (!c->base.session_active ||
+	    c->base.state == WESTON_COMPOSITOR_SLEEPING ||
+	    c->base.state == WESTON_COMPOSITOR_OFFSCREEN)
+		return -1;
+
+	/* Same computation as drm_output_set_cursor(), which then finds
+	 * the cursor already in place on the next repaint. */
+	x = (x - output->base.x) * output->base.current_scale;
+	y = (y - output->base.y) * output->base.current_scale;
+	if (output->cursor_plane.x == x && output->cursor_plane.y == y)
+		return 0;
+
+	if (drmModeMoveCursor(c->drm.fd, output->crtc_id, x, y)) {
+		weston_log("failed to move cursor: %m\n");
+		c->cursors_are_broken = 1;
+		return -1;
+	}
+
+	output->cursor_plane.x = x;
+	output->cursor_plane.y = y;
+
+	return 0;
+}
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
@@ -2087,6 +2121,7 @@ create_output_for_connector(struct drm_compositor *ec,
 	output->base.assign_planes = drm_assign_planes;
 	output->base.set_dpms = drm_set_dpms;
 	output->base.switch_mode = drm_output_switch_mode;
+	output->base.move_cursor = drm_output_move_cursor;
 
 	output->base.gamma_size = output->original_crtc->gamma_size;
 	output->base.set_gamma = drm_output_set_gamma;
@@ -2592,7 +2627,8 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 	}
 
 	ret = vaapi_recorder_frame(output->recorder, fd,
-				   output->current->stride);
+				   output->current->stride,
+				   output->base.frame_time);
 	if (ret < 0) {
 		weston_log("[libva recorder] aborted: %m\n");
 		recorder_destroy(output);
@@ -2603,8 +2639,29 @@ static void *
 create_recorder(struct drm_compositor *c, int width, int height,
 		const char *filename)
 {
-	int fd;
+	struct weston_config_section *section;
+	enum vaapi_recorder_policy policy;
+	int fd, queue_length;
 	drm_magic_t magic;
+	char *s;
+
+	section = weston_config_get_section(c->base.config,
+					    "recorder", NULL, NULL);
+	weston_config_section_get_int(section, "vaapi-queue-length",
+				      &queue_length, 3);
+	weston_config_section_get_string(section, "vaapi-queue-policy",
+					 &s, "drop-oldest");
+	if (s && strcmp(s, "block") == 0) {
+		policy = VAAPI_RECORDER_BLOCK;
+	} else if (s && strcmp(s, "drop-newest") == 0) {
+		policy = VAAPI_RECORDER_DROP_NEWEST;
+	} else {
+		if (s && strcmp(s, "drop-oldest") != 0)
+			weston_log("invalid vaapi-queue-policy %s, "
+				   "using drop-oldest\n", s);
+		policy = VAAPI_RECORDER_DROP_OLDEST;
+	}
+	free(s);
 
 	fd = open(c->drm.filename, O_RDWR | O_CLOEXEC);
 	if (fd < 0)
@@ -2613,7 +2670,8 @@ create_recorder(struct drm_compositor *c, int width, int height,
 	drmGetMagic(fd, &magic);
 	drmAuthMagic(c->drm.fd, magic);
 
-	return vaapi_recorder_create(fd, width, height, filename);
+	return vaapi_recorder_create(fd, width, height, filename,
+				     queue_length, policy);
 }
 
 static void
@@ -52,6 +52,7 @@ struct fbdev_compositor {
 	struct udev *udev;
 	struct udev_input input;
 	int use_pixman;
+	int native_composite;
 	struct wl_listener session_listener;
 };
 
@@ -93,6 +94,8 @@ struct fbdev_parameters {
 	int tty;
 	char *device;
 	int use_gl;
+	int native_composite;
+	uint32_t output_transform;
 };
 
 struct gl_renderer_interface *gl_renderer;
@@ -127,59 +130,35 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 {
 	struct fbdev_output *output = to_fbdev_output(base);
 	struct weston_compositor *ec = output->base.compositor;
-	pixman_box32_t *rects;
-	int nrects, i, src_x, src_y, x1, y1, x2, y2, width, height;
+	pixman_region32_t hw_damage;
 
 	/* Repaint the damaged region onto the back buffer. */
 	pixman_renderer_output_set_buffer(base, output->shadow_surface);
 	ec->renderer->repaint_output(base, damage);
 
-	/* Transform and composite onto the frame buffer. */
-	width = pixman_image_get_width(output->shadow_surface);
-	height = pixman_image_get_height(output->shadow_surface);
-	rects = pixman_region32_rectangles(damage, &nrects);
-
-	for (i = 0; i < nrects; i++) {
-		switch (base->transform) {
-		default:
-		case WL_OUTPUT_TRANSFORM_NORMAL:
-			x1 = rects[i].x1;
-			x2 = rects[i].x2;
-			y1 = rects[i].y1;
-			y2 = rects[i].y2;
-			break;
-		case WL_OUTPUT_TRANSFORM_180:
-			x1 = width - rects[i].x2;
-			x2 = width - rects[i].x1;
-			y1 = height - rects[i].y2;
-			y2 = height - rects[i].y1;
-			break;
-		case WL_OUTPUT_TRANSFORM_90:
-			x1 = height - rects[i].y2;
-			x2 = height - rects[i].y1;
-			y1 = rects[i].x1;
-			y2 = rects[i].x2;
-			break;
-		case WL_OUTPUT_TRANSFORM_270:
-			x1 = rects[i].y1;
-			x2 = rects[i].y2;
-			y1 = width - rects[i].x2;
-			y2 = width - rects[i].x1;
-			break;
-		}
-		src_x = x1;
-		src_y = y1;
-
-		pixman_image_composite32(PIXMAN_OP_SRC,
-			output->shadow_surface, /* src */
-			NULL /* mask */,
-			output->hw_surface, /* dest */
-			src_x, src_y, /* src_x, src_y */
-			0, 0, /* mask_x, mask_y */
-			x1, y1, /* dest_x, dest_y */
-			x2 - x1, /* width */
-			y2 - y1 /* height */);
-	}
+	/* The renderer has already applied the output transform, so the
+	 * back buffer is in frame buffer orientation and the damage only
+	 * needs converting to frame buffer coordinates. */
+	pixman_region32_init(&hw_damage);
+	pixman_region32_copy(&hw_damage, damage);
+	pixman_region32_translate(&hw_damage, -base->x, -base->y);
+	weston_transformed_region(base->width, base->height,
+				  base->transform, base->current_scale,
+				  &hw_damage, &hw_damage);
+
+	pixman_image_set_clip_region32(output->hw_surface, &hw_damage);
+	pixman_image_composite32(PIXMAN_OP_SRC,
+		output->shadow_surface, /* src */
+		NULL /* mask */,
+		output->hw_surface, /* dest */
+		0, 0, /* src_x, src_y */
+		0, 0, /* mask_x, mask_y */
+		0, 0, /* dest_x, dest_y */
+		pixman_image_get_width(output->hw_surface), /* width */
+		pixman_image_get_height(output->hw_surface) /* height */);
+	pixman_image_set_clip_region32(output->hw_surface, NULL);
+
+	pixman_region32_fini(&hw_damage);
 
 	/* Update the damage region. */
 	pixman_region32_subtract(&ec->primary_plane.damage,
@@ -498,12 +477,10 @@ static void fbdev_output_disable(struct weston_output *base);
 
 static int
 fbdev_output_create(struct fbdev_compositor *compositor,
-                    const char *device)
+                    const char *device, uint32_t transform)
 {
 	struct fbdev_output *output;
-	pixman_transform_t transform;
 	int fb_fd;
-	int shadow_width, shadow_height;
 	int width, height;
 	unsigned int bytes_per_pixel;
 	struct wl_event_loop *loop;
@@ -557,74 +534,32 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	weston_output_init(&output->base, &compositor->base,
 	                   0, 0, output->fb_info.width_mm,
 	                   output->fb_info.height_mm,
-	                   WL_OUTPUT_TRANSFORM_NORMAL,
+	                   transform,
 			   1);
 
 	width = output->fb_info.x_resolution;
 	height = output->fb_info.y_resolution;
 
-	pixman_transform_init_identity(&transform);
-	switch (output->base.transform) {
-	default:
-	case WL_OUTPUT_TRANSFORM_NORMAL:
-		shadow_width = width;
-		shadow_height = height;
-		pixman_transform_rotate(&transform,
-			NULL, 0, 0);
-		pixman_transform_translate(&transform, NULL,
-			0, 0);
-		break;
-	case WL_OUTPUT_TRANSFORM_180:
-		shadow_width = width;
-		shadow_height = height;
-		pixman_transform_rotate(&transform,
-			NULL, -pixman_fixed_1, 0);
-		pixman_transform_translate(NULL, &transform,
-			pixman_int_to_fixed(shadow_width),
-			pixman_int_to_fixed(shadow_height));
-		break;
-	case WL_OUTPUT_TRANSFORM_270:
-		shadow_width = height;
-		shadow_height = width;
-		pixman_transform_rotate(&transform,
-			NULL, 0, pixman_fixed_1);
-		pixman_transform_translate(&transform,
-			NULL,
-			pixman_int_to_fixed(shadow_width),
-			0);
-		break;
-	case WL_OUTPUT_TRANSFORM_90:
-		shadow_width = height;
-		shadow_height = width;
-		pixman_transform_rotate(&transform,
-			NULL, 0, -pixman_fixed_1);
-		pixman_transform_translate(&transform,
-			NULL,
-			0,
-			pixman_int_to_fixed(shadow_height));
-		break;
-	}
-
+	/* The pixman renderer applies the output transform itself, so the
+	 * shadow surface has the same orientation as the frame buffer. */
 	bytes_per_pixel = output->fb_info.bits_per_pixel / 8;
 
 	output->shadow_buf = malloc(width * height * bytes_per_pixel);
 	output->shadow_surface =
 		pixman_image_create_bits(output->fb_info.pixel_format,
-		                         shadow_width, shadow_height,
+		                         width, height,
 		                         output->shadow_buf,
-		                         shadow_width * bytes_per_pixel);
+		                         width * bytes_per_pixel);
 	if (output->shadow_buf == NULL || output->shadow_surface == NULL) {
 		weston_log("Failed to create surface for frame buffer.\n");
 		goto out_hw_surface;
 	}
 
-	/* No need in transform for normal output */
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		pixman_image_set_transform(output->shadow_surface, &transform);
-
 	if (compositor->use_pixman) {
 		if (pixman_renderer_output_create(&output->base) < 0)
 			goto out_shadow_surface;
+		pixman_renderer_output_set_native_composite(&output->base,
+						compositor->native_composite);
 	} else {
 		setenv("HYBRIS_EGLPLATFORM", "wayland", 1);
 		if (gl_renderer->output_create(&output->base,
@@ -724,6 +659,7 @@ fbdev_output_reenable(struct fbdev_compositor *compositor,
 	struct fbdev_screeninfo new_screen_info;
 	int fb_fd;
 	const char *device;
+	uint32_t transform;
 
 	weston_log("Re-enabling fbdev output.\n");
 
@@ -751,8 +687,9 @@ fbdev_output_reenable(struct fbdev_compositor *compositor,
 		 * the frame buffer X/Y resolution (such as the shadow buffer)
 		 * are re-initialised. */
 		device = output->device;
+		transform = base->transform;
 		fbdev_output_destroy(base);
-		fbdev_output_create(compositor, device);
+		fbdev_output_create(compositor, device, transform);
 
 		return 0;
 	}
@@ -906,6 +843,7 @@ fbdev_compositor_create(struct wl_display *display, int *argc, char *argv[],
 
 	compositor->prev_state = WESTON_COMPOSITOR_ACTIVE;
 	compositor->use_pixman = !param->use_gl;
+	compositor->native_composite = param->native_composite;
 
 	for (key = KEY_F1; key < KEY_F9; key++)
 		weston_compositor_add_key_binding(&compositor->base, key,
@@ -931,7 +869,8 @@ fbdev_compositor_create(struct wl_display *display, int *argc, char *argv[],
 		}
 	}
 
-	if (fbdev_output_create(compositor, param->device) < 0)
+	if (fbdev_output_create(compositor, param->device,
+				param->output_transform) < 0)
 		goto out_pixman;
 
 	udev_input_init(&compositor->input, &compositor->base, compositor->udev, seat_id);
@@ -956,25 +895,62 @@ out_free:
 	return NULL;
 }
 
+static const char *transform_names[] = {
+	[WL_OUTPUT_TRANSFORM_NORMAL] = "normal",
+	[WL_OUTPUT_TRANSFORM_90] = "90",
+	[WL_OUTPUT_TRANSFORM_180] = "180",
+	[WL_OUTPUT_TRANSFORM_270] = "270",
+	[WL_OUTPUT_TRANSFORM_FLIPPED] = "flipped",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_90] = "flipped-90",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_180] = "flipped-180",
+	[WL_OUTPUT_TRANSFORM_FLIPPED_270] = "flipped-270",
+};
+
+static int
+str2transform(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(transform_names); i++)
+		if (strcmp(name, transform_names[i]) == 0)
+			return i;
+
+	return -1;
+}
+
 WL_EXPORT struct weston_compositor *
 backend_init(struct wl_display *display, int *argc, char *argv[],
 	     struct weston_config *config)
 {
+	const char *transform = "normal";
+	int ret;
+
 	/* TODO: Ideally, available frame buffers should be enumerated using
 	 * udev, rather than passing a device node in as a parameter. */
 	struct fbdev_parameters param = {
 		.tty = 0, /* default to current tty */
 		.device = "/dev/fb0", /* default frame buffer */
 		.use_gl = 0,
+		.native_composite = 0,
+		.output_transform = WL_OUTPUT_TRANSFORM_NORMAL,
 	};
 
 	const struct weston_option fbdev_options[] = {
 		{ WESTON_OPTION_INTEGER, "tty", 0, &param.tty },
 		{ WESTON_OPTION_STRING, "device", 0, &param.device },
 		{ WESTON_OPTION_BOOLEAN, "use-gl", 0, &param.use_gl },
+		{ WESTON_OPTION_BOOLEAN, "native-composite", 0,
+		  &param.native_composite },
+		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 	};
 
 	parse_options(fbdev_options, ARRAY_LENGTH(fbdev_options), argc, argv);
 
+	ret = str2transform(transform);
+	if (ret < 0)
+		weston_log("invalid transform \"%s\"\n", transform);
+	else
+		param.output_transform = ret;
+
 	return fbdev_compositor_create(display, argc, argv, config, &param);
 }
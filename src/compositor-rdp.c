@@ -25,7 +25,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
 #include <linux/input.h>
+#include <linux/sockios.h>
 
 #if HAVE_FREERDP_VERSION_H
 #include <freerdp/version.h>
@@ -50,6 +55,16 @@
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 #define RDP_MODE_FREQ 60 * 1000
+#define RDP_MAX_ENCODER_BANDS 8
+#define RFX_TILE_SIZE 64
+
+#define RDP_MIN_FRAME_INTERVAL 16 /* ms */
+#define RDP_MAX_FRAME_INTERVAL 1000 /* ms */
+#define RDP_TARGET_LATENCY 100 /* ms of data allowed in the send queue */
+#define RDP_MIN_BACKLOG 65536
+#define RDP_SAMPLE_INTERVAL 100 /* ms */
+#define RDP_INITIAL_BANDWIDTH (10 * 1024 * 1024) /* bytes per second */
+#define RDP_MIN_BANDWIDTH 1024
 
 struct rdp_compositor_config {
 	int width;
@@ -61,6 +76,7 @@ struct rdp_compositor_config {
 	char *server_key;
 	int env_socket;
 	int no_clients_resize;
+	int encoder_threads;
 };
 
 struct rdp_output;
@@ -77,6 +93,7 @@ struct rdp_compositor {
 	char *rdp_key;
 	int tls_enabled;
 	int no_clients_resize;
+	int encoder_threads;
 };
 
 enum peer_item_flags {
@@ -97,18 +114,95 @@ struct rdp_output {
 	struct wl_event_source *finish_frame_timer;
 	pixman_image_t *shadow_surface;
 
+	int encoder_pipe[2];
+	struct wl_event_source *encoder_source;
+
 	struct wl_list peers;
 };
 
+/* A copy of the damaged part of the shadow surface, so that encoding can
+ * run while the next frame is being rendered.  Peers whose encoder is
+ * idle at repaint time all encode the same snapshot.  The reference
+ * count is only touched on the compositor thread. */
+struct rdp_snapshot {
+	int refcount;
+	int width, height; /* of the output when it was taken */
+	pixman_region32_t damage;
+	pixman_image_t *image; /* covers the extents of damage */
+};
+
+struct rdp_encoder;
+
+/* A horizontal band of RemoteFX tile rows.  Each band has its own codec
+ * context and is sent as its own surface bits command, so the bands of a
+ * frame can be compressed in parallel. */
+struct rdp_band {
+	struct rdp_encoder *encoder;
+	pthread_t thread;
+	int busy;
+
+	pixman_region32_t damage;
+	RFX_CONTEXT *rfx_context;
+	wStream *stream;
+	RFX_RECT *rects;
+};
+
+enum rdp_encoder_state {
+	RDP_ENCODER_IDLE,
+	RDP_ENCODER_QUEUED,
+	RDP_ENCODER_DONE,
+};
+
+/* Encodes frames for one peer on its own thread, band 0 on the encoder
+ * thread itself and the other bands on helper threads.  The encoded
+ * frame goes back to the compositor thread through the output's encoder
+ * pipe, which sends it, so FreeRDP is only ever called from one thread. */
+struct rdp_encoder {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_cond_t band_cond;
+	pthread_t thread;
+	int running;
+	int quit;
+	int reset;
+	int notify_fd;
+
+	enum rdp_encoder_state state;
+	struct rdp_snapshot *snapshot;
+	int use_rfx;
+
+	int nbands;
+	struct rdp_band bands[RDP_MAX_ENCODER_BANDS];
+	NSC_CONTEXT *nsc_context;
+	wStream *stream;
+};
+
+/* A peer only gets a new frame once the previous one is encoded, its
+ * frame interval has passed, and the socket send queue holds less than
+ * RDP_TARGET_LATENCY worth of data at the estimated bandwidth.  Until
+ * then damage is merged in pending, and the timer retries.  The frame
+ * interval is the time the last frame takes at the estimated bandwidth,
+ * so a slow link gets fewer, larger updates instead of a growing
+ * queue. */
+struct rdp_pacing {
+	pixman_region32_t pending;
+	struct wl_event_source *timer;
+	uint32_t last_frame;
+	uint32_t interval;
+
+	uint32_t bandwidth;
+	uint32_t sample_time;
+	uint32_t sample_bytes; /* sent since sample_time */
+	int sample_outq;
+};
+
 struct rdp_peer_context {
 	rdpContext _p;
 
 	struct rdp_compositor *rdpCompositor;
 	struct wl_event_source *events[MAX_FREERDP_FDS];
-	RFX_CONTEXT *rfx_context;
-	wStream *encode_stream;
-	RFX_RECT *rfx_rects;
-	NSC_CONTEXT *nsc_context;
+	struct rdp_encoder encoder;
+	struct rdp_pacing pacing;
 
 	struct rdp_peers_item item;
 };
@@ -125,95 +219,421 @@ rdp_compositor_config_init(struct rdp_compositor_config *config) {
 	config->server_key = NULL;
 	config->env_socket = 0;
 	config->no_clients_resize = 0;
+	config->encoder_threads = 0;
+}
+
+static struct rdp_snapshot *
+rdp_snapshot_create(struct rdp_output *output, pixman_region32_t *damage)
+{
+	struct rdp_snapshot *snapshot;
+	pixman_box32_t *extents, *rects;
+	int nrects, i;
+
+	snapshot = zalloc(sizeof *snapshot);
+	if (!snapshot)
+		return NULL;
+
+	snapshot->refcount = 1;
+	snapshot->width = output->base.current_mode->width;
+	snapshot->height = output->base.current_mode->height;
+	pixman_region32_init_rect(&snapshot->damage, 0, 0,
+				  snapshot->width, snapshot->height);
+	pixman_region32_intersect(&snapshot->damage, &snapshot->damage, damage);
+
+	extents = pixman_region32_extents(&snapshot->damage);
+	if (!pixman_region32_not_empty(&snapshot->damage))
+		goto err;
+
+	snapshot->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+			extents->x2 - extents->x1, extents->y2 - extents->y1,
+			NULL, (extents->x2 - extents->x1) * 4);
+	if (!snapshot->image)
+		goto err;
+
+	rects = pixman_region32_rectangles(&snapshot->damage, &nrects);
+	for (i = 0; i < nrects; i++)
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 output->shadow_surface, NULL,
+					 snapshot->image,
+					 rects[i].x1, rects[i].y1, 0, 0,
+					 rects[i].x1 - extents->x1,
+					 rects[i].y1 - extents->y1,
+					 rects[i].x2 - rects[i].x1,
+					 rects[i].y2 - rects[i].y1);
+
+	return snapshot;
+
+err:
+	pixman_region32_fini(&snapshot->damage);
+	free(snapshot);
+	return NULL;
 }
 
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_snapshot_unref(struct rdp_snapshot *snapshot)
 {
-	int width, height, nrects, i;
-	pixman_box32_t *region, *rects;
-	uint32_t *ptr;
-	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	if (--snapshot->refcount > 0)
+		return;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	pixman_image_unref(snapshot->image);
+	pixman_region32_fini(&snapshot->damage);
+	free(snapshot);
+}
 
-	width = (damage->extents.x2 - damage->extents.x1);
-	height = (damage->extents.y2 - damage->extents.y1);
+static BYTE *
+rdp_snapshot_data(struct rdp_snapshot *snapshot, pixman_box32_t *box)
+{
+	pixman_box32_t *extents = pixman_region32_extents(&snapshot->damage);
+	int stride = pixman_image_get_stride(snapshot->image);
 
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
-	cmd->bpp = 32;
-	cmd->codecID = peer->settings->RemoteFxCodecId;
-	cmd->width = width;
-	cmd->height = height;
+	return (BYTE *)pixman_image_get_data(snapshot->image) +
+		(box->y1 - extents->y1) * stride + (box->x1 - extents->x1) * 4;
+}
 
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+static void
+rdp_band_encode(struct rdp_band *band, struct rdp_snapshot *snapshot)
+{
+	pixman_box32_t *extents, *rects;
+	int nrects, i;
 
-	rects = pixman_region32_rectangles(damage, &nrects);
-	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
+	Stream_Clear(band->stream);
+	Stream_SetPosition(band->stream, 0);
+
+	extents = pixman_region32_extents(&band->damage);
+	rects = pixman_region32_rectangles(&band->damage, &nrects);
+	band->rects = realloc(band->rects, nrects * sizeof *band->rects);
 
 	for (i = 0; i < nrects; i++) {
-		region = &rects[i];
-		rfxRect = &context->rfx_rects[i];
+		band->rects[i].x = rects[i].x1 - extents->x1;
+		band->rects[i].y = rects[i].y1 - extents->y1;
+		band->rects[i].width = rects[i].x2 - rects[i].x1;
+		band->rects[i].height = rects[i].y2 - rects[i].y1;
+	}
+
+	rfx_compose_message(band->rfx_context, band->stream, band->rects, nrects,
+			rdp_snapshot_data(snapshot, extents),
+			extents->x2 - extents->x1, extents->y2 - extents->y1,
+			pixman_image_get_stride(snapshot->image));
+}
 
-		rfxRect->x = (region->x1 - damage->extents.x1);
-		rfxRect->y = (region->y1 - damage->extents.y1);
-		rfxRect->width = (region->x2 - region->x1);
-		rfxRect->height = (region->y2 - region->y1);
+static void
+rdp_encoder_encode_nsc(struct rdp_encoder *encoder)
+{
+	struct rdp_snapshot *snapshot = encoder->snapshot;
+	pixman_box32_t *extents = pixman_region32_extents(&snapshot->damage);
+
+	Stream_Clear(encoder->stream);
+	Stream_SetPosition(encoder->stream, 0);
+
+	nsc_compose_message(encoder->nsc_context, encoder->stream,
+			rdp_snapshot_data(snapshot, extents),
+			extents->x2 - extents->x1, extents->y2 - extents->y1,
+			pixman_image_get_stride(snapshot->image));
+}
+
+/* Splits the damage into bands of whole tile rows.  Called with the
+ * encoder mutex held. */
+static void
+rdp_encoder_split_bands(struct rdp_encoder *encoder)
+{
+	pixman_region32_t *damage = &encoder->snapshot->damage;
+	pixman_box32_t *extents = pixman_region32_extents(damage);
+	int rows, rows_per_band, band_height, y, i;
+
+	rows = (extents->y2 - extents->y1 + RFX_TILE_SIZE - 1) / RFX_TILE_SIZE;
+	rows_per_band = (rows + encoder->nbands - 1) / encoder->nbands;
+	band_height = rows_per_band * RFX_TILE_SIZE;
+
+	for (i = 0, y = extents->y1; i < encoder->nbands; i++, y += band_height) {
+		pixman_region32_fini(&encoder->bands[i].damage);
+		pixman_region32_init_rect(&encoder->bands[i].damage,
+					  extents->x1, y,
+					  extents->x2 - extents->x1,
+					  band_height);
+		pixman_region32_intersect(&encoder->bands[i].damage,
+					  &encoder->bands[i].damage, damage);
 	}
+}
 
-	rfx_compose_message(context->rfx_context, context->encode_stream, context->rfx_rects, nrects,
-			(BYTE *)ptr, width, height,
-			pixman_image_get_stride(image)
-	);
+static void *
+rdp_band_thread(void *data)
+{
+	struct rdp_band *band = data;
+	struct rdp_encoder *encoder = band->encoder;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (1) {
+		while (!band->busy && !encoder->quit)
+			pthread_cond_wait(&encoder->band_cond, &encoder->mutex);
+		if (encoder->quit)
+			break;
 
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+		pthread_mutex_unlock(&encoder->mutex);
+		rdp_band_encode(band, encoder->snapshot);
+		pthread_mutex_lock(&encoder->mutex);
 
-	update->SurfaceBits(update->context, cmd);
+		band->busy = 0;
+		pthread_cond_broadcast(&encoder->band_cond);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
 }
 
+static int
+rdp_encoder_bands_busy(struct rdp_encoder *encoder)
+{
+	int i;
+
+	for (i = 1; i < encoder->nbands; i++)
+		if (encoder->bands[i].busy)
+			return 1;
+
+	return 0;
+}
+
+static void *
+rdp_encoder_thread(void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_band *bands = encoder->bands;
+	char c = 0;
+	int i;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (1) {
+		while (encoder->state != RDP_ENCODER_QUEUED && !encoder->quit)
+			pthread_cond_wait(&encoder->cond, &encoder->mutex);
+		if (encoder->quit)
+			break;
+
+		if (encoder->reset) {
+			for (i = 0; i < encoder->nbands; i++)
+				rfx_context_reset(bands[i].rfx_context);
+			encoder->reset = 0;
+		}
+
+		if (encoder->use_rfx) {
+			rdp_encoder_split_bands(encoder);
+			for (i = 1; i < encoder->nbands; i++)
+				bands[i].busy =
+					pixman_region32_not_empty(&bands[i].damage);
+			pthread_cond_broadcast(&encoder->band_cond);
+			pthread_mutex_unlock(&encoder->mutex);
+
+			rdp_band_encode(&bands[0], encoder->snapshot);
+
+			pthread_mutex_lock(&encoder->mutex);
+			while (rdp_encoder_bands_busy(encoder) && !encoder->quit)
+				pthread_cond_wait(&encoder->band_cond,
+						  &encoder->mutex);
+		} else {
+			pthread_mutex_unlock(&encoder->mutex);
+			rdp_encoder_encode_nsc(encoder);
+			pthread_mutex_lock(&encoder->mutex);
+		}
+
+		encoder->state = RDP_ENCODER_DONE;
+		pthread_mutex_unlock(&encoder->mutex);
+
+		/* If the pipe is full a wakeup is already pending */
+		if (write(encoder->notify_fd, &c, 1) < 0 && errno != EAGAIN)
+			weston_log("failed to notify rdp encoder completion: %m\n");
+
+		pthread_mutex_lock(&encoder->mutex);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
+}
+
+static RFX_CONTEXT *
+rdp_rfx_context_new(freerdp_peer *client)
+{
+	RFX_CONTEXT *rfx_context;
+
+#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
+	rfx_context = rfx_context_new();
+#else
+	rfx_context = rfx_context_new(TRUE);
+#endif
+	rfx_context->mode = RLGR3;
+	rfx_context->width = client->settings->DesktopWidth;
+	rfx_context->height = client->settings->DesktopHeight;
+	rfx_context_set_pixel_format(rfx_context, RDP_PIXEL_FORMAT_B8G8R8A8);
+
+	return rfx_context;
+}
 
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_release(struct rdp_encoder *encoder)
 {
-	int width, height;
-	uint32_t *ptr;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_band *band;
+	int i;
+
+	if (encoder->running) {
+		pthread_mutex_lock(&encoder->mutex);
+		encoder->quit = 1;
+		pthread_cond_signal(&encoder->cond);
+		pthread_cond_broadcast(&encoder->band_cond);
+		pthread_mutex_unlock(&encoder->mutex);
+
+		pthread_join(encoder->thread, NULL);
+		for (i = 1; i < encoder->nbands; i++)
+			pthread_join(encoder->bands[i].thread, NULL);
+	}
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	if (encoder->snapshot)
+		rdp_snapshot_unref(encoder->snapshot);
 
-	width = (damage->extents.x2 - damage->extents.x1);
-	height = (damage->extents.y2 - damage->extents.y1);
+	for (i = 0; i < encoder->nbands; i++) {
+		band = &encoder->bands[i];
+		pixman_region32_fini(&band->damage);
+		rfx_context_free(band->rfx_context);
+		Stream_Free(band->stream, TRUE);
+		free(band->rects);
+	}
+
+	if (encoder->nsc_context)
+		nsc_context_free(encoder->nsc_context);
+	if (encoder->stream)
+		Stream_Free(encoder->stream, TRUE);
 
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
+	pthread_cond_destroy(&encoder->band_cond);
+	pthread_cond_destroy(&encoder->cond);
+	pthread_mutex_destroy(&encoder->mutex);
+}
+
+static int
+rdp_encoder_init(struct rdp_encoder *encoder, freerdp_peer *client,
+		 int nbands, int notify_fd)
+{
+	struct rdp_band *band;
+	int i;
+
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->cond, NULL);
+	pthread_cond_init(&encoder->band_cond, NULL);
+	encoder->notify_fd = notify_fd;
+	encoder->state = RDP_ENCODER_IDLE;
+
+	encoder->nsc_context = nsc_context_new();
+	nsc_context_set_pixel_format(encoder->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
+	encoder->stream = Stream_New(NULL, 65536);
+
+	encoder->nbands = nbands;
+	for (i = 0; i < nbands; i++) {
+		band = &encoder->bands[i];
+		band->encoder = encoder;
+		pixman_region32_init(&band->damage);
+		band->rfx_context = rdp_rfx_context_new(client);
+		band->stream = Stream_New(NULL, 65536);
+	}
+
+	for (i = 1; i < nbands; i++)
+		if (pthread_create(&encoder->bands[i].thread, NULL,
+				   rdp_band_thread, &encoder->bands[i]) != 0)
+			goto err;
+
+	if (pthread_create(&encoder->thread, NULL,
+			   rdp_encoder_thread, encoder) != 0)
+		goto err;
+
+	encoder->running = 1;
+
+	return 0;
+
+err:
+	weston_log("failed to start rdp encoder threads\n");
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->quit = 1;
+	pthread_cond_broadcast(&encoder->band_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+	while (--i > 0)
+		pthread_join(encoder->bands[i].thread, NULL);
+	rdp_encoder_release(encoder);
+	return -1;
+}
+
+static void
+rdp_encoder_queue(struct rdp_encoder *encoder, struct rdp_snapshot *snapshot,
+		  int use_rfx)
+{
+	snapshot->refcount++;
+
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->snapshot = snapshot;
+	encoder->use_rfx = use_rfx;
+	encoder->state = RDP_ENCODER_QUEUED;
+	pthread_cond_signal(&encoder->cond);
+	pthread_mutex_unlock(&encoder->mutex);
+}
+
+static void
+rdp_peer_surface_bits(freerdp_peer *peer, pixman_box32_t *extents,
+		      UINT32 codec_id, wStream *stream)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	rdpUpdate *update = peer->update;
+	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
+
+	cmd->destLeft = extents->x1;
+	cmd->destTop = extents->y1;
+	cmd->destRight = extents->x2;
+	cmd->destBottom = extents->y2;
 	cmd->bpp = 32;
-	cmd->codecID = peer->settings->NSCodecId;
-	cmd->width = width;
-	cmd->height = height;
-
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
-
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
-			cmd->width,	cmd->height,
-			pixman_image_get_stride(image));
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+	cmd->codecID = codec_id;
+	cmd->width = extents->x2 - extents->x1;
+	cmd->height = extents->y2 - extents->y1;
+	cmd->bitmapDataLength = Stream_GetPosition(stream);
+	cmd->bitmapData = Stream_Buffer(stream);
+
 	update->SurfaceBits(update->context, cmd);
+	context->pacing.sample_bytes += cmd->bitmapDataLength;
+
+	cmd->bitmapData = NULL;
+}
+
+static void
+rdp_peer_send_encoded(freerdp_peer *peer, struct rdp_encoder *encoder)
+{
+	rdpUpdate *update = peer->update;
+	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+	struct rdp_band *band;
+	int i, nbands;
+
+	if (!encoder->use_rfx) {
+		rdp_peer_surface_bits(peer,
+				pixman_region32_extents(&encoder->snapshot->damage),
+				peer->settings->NSCodecId, encoder->stream);
+		return;
+	}
+
+	for (i = 0, nbands = 0; i < encoder->nbands; i++)
+		if (pixman_region32_not_empty(&encoder->bands[i].damage))
+			nbands++;
+
+	/* Let the client present the bands of a frame together */
+	if (nbands > 1) {
+		marker->frameId++;
+		marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+		update->SurfaceFrameMarker(peer->context, marker);
+	}
+
+	for (i = 0; i < encoder->nbands; i++) {
+		band = &encoder->bands[i];
+		if (!pixman_region32_not_empty(&band->damage))
+			continue;
+
+		rdp_peer_surface_bits(peer,
+				pixman_region32_extents(&band->damage),
+				peer->settings->RemoteFxCodecId, band->stream);
+	}
+
+	if (nbands > 1) {
+		marker->frameAction = SURFACECMD_FRAMEACTION_END;
+		update->SurfaceFrameMarker(peer->context, marker);
+	}
 }
 
 static void
@@ -232,6 +652,7 @@ pixman_image_flipped_subrect(const pixman_box32_t *rect, pixman_image_t *img, BY
 static void
 rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_peer *peer)
 {
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
 	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
@@ -276,6 +697,7 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 
 			   /*weston_log("*  sending (%d,%d, %d,%d)\n", subrect.x1, subrect.y1, subrect.x2, subrect.y2); */
 			   update->SurfaceBits(peer->context, cmd);
+			   context->pacing.sample_bytes += cmd->bitmapDataLength;
 
 			   remainingHeight -= cmd->height;
 			   top += cmd->height;
@@ -286,19 +708,254 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	update->SurfaceFrameMarker(peer->context, marker);
 }
 
+static int
+rdp_peer_outq(freerdp_peer *peer)
+{
+	int outq;
+
+	if (ioctl(peer->sockfd, SIOCOUTQ, &outq) < 0)
+		return 0;
+
+	return outq;
+}
+
+/* Estimates the bandwidth from how fast the send queue drains.  While
+ * the queue is empty the link may be idle, so the rate measured then
+ * can only raise the estimate. */
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_pacing_sample(RdpPeerContext *context, uint32_t now)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_pacing *pacing = &context->pacing;
+	uint32_t elapsed = now - pacing->sample_time;
+	int64_t drained;
+	uint32_t rate;
+	int outq;
+
+	if (elapsed < RDP_SAMPLE_INTERVAL)
+		return;
+
+	outq = rdp_peer_outq(context->item.peer);
+	drained = (int64_t) pacing->sample_outq + pacing->sample_bytes - outq;
+	if (drained < 0)
+		drained = 0;
+	rate = drained * 1000 / elapsed;
+
+	if (outq > 0 || rate > pacing->bandwidth)
+		pacing->bandwidth = ((uint64_t) pacing->bandwidth * 3 + rate) / 4;
+	if (pacing->bandwidth < RDP_MIN_BANDWIDTH)
+		pacing->bandwidth = RDP_MIN_BANDWIDTH;
+
+	pacing->sample_time = now;
+	pacing->sample_bytes = 0;
+	pacing->sample_outq = outq;
+}
+
+/* Returns 0 if the peer can take a frame now, otherwise how many ms to
+ * wait before trying again. */
+static uint32_t
+rdp_pacing_delay(RdpPeerContext *context, uint32_t now)
+{
+	struct rdp_pacing *pacing = &context->pacing;
+	uint32_t since = now - pacing->last_frame;
+	uint64_t delay;
+	int outq, limit;
+
+	if (since < pacing->interval)
+		return pacing->interval - since;
+
+	rdp_pacing_sample(context, now);
+
+	limit = (uint64_t) pacing->bandwidth * RDP_TARGET_LATENCY / 1000;
+	if (limit < RDP_MIN_BACKLOG)
+		limit = RDP_MIN_BACKLOG;
+
+	outq = rdp_peer_outq(context->item.peer);
+	if (outq <= limit)
+		return 0;
+
+	delay = (uint64_t) (outq - limit) * 1000 / pacing->bandwidth;
+	if (delay < 1)
+		delay = 1;
+	if (delay > RDP_MAX_FRAME_INTERVAL)
+		delay = RDP_MAX_FRAME_INTERVAL;
+
+	return delay;
+}
+
+static void
+rdp_pacing_frame_sent(RdpPeerContext *context, uint32_t bytes)
+{
+	struct rdp_pacing *pacing = &context->pacing;
+	uint64_t interval;
+
+	interval = (uint64_t) bytes * 1000 / pacing->bandwidth;
+	if (interval < RDP_MIN_FRAME_INTERVAL)
+		interval = RDP_MIN_FRAME_INTERVAL;
+	if (interval > RDP_MAX_FRAME_INTERVAL)
+		interval = RDP_MAX_FRAME_INTERVAL;
+
+	pacing->interval = interval;
+}
+
+/* Raw updates are only copies and go out straight away.  Frames for
+ * RemoteFX and NSCodec are handed to the peer's encoder; *snapshot is
+ * taken on first use and shared by all peers sent the same region. */
+static void
+rdp_peer_send_region(RdpPeerContext *context, pixman_region32_t *region,
+		     struct rdp_snapshot **snapshot, uint32_t now)
+{
+	freerdp_peer *peer = context->item.peer;
 	struct rdp_output *output = context->rdpCompositor->output;
 	rdpSettings *settings = peer->settings;
+	uint32_t bytes;
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
-	else
+	context->pacing.last_frame = now;
+
+	if (!settings->RemoteFxCodec && !settings->NSCodec) {
+		bytes = context->pacing.sample_bytes;
 		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+		rdp_pacing_frame_sent(context,
+				      context->pacing.sample_bytes - bytes);
+		return;
+	}
+
+	if (!*snapshot)
+		*snapshot = rdp_snapshot_create(output, region);
+	if (*snapshot)
+		rdp_encoder_queue(&context->encoder, *snapshot,
+				  settings->RemoteFxCodec);
+}
+
+/* Sends the pending damage if the peer is ready for it. */
+static void
+rdp_peer_flush(RdpPeerContext *context)
+{
+	struct rdp_pacing *pacing = &context->pacing;
+	struct rdp_snapshot *snapshot = NULL;
+	uint32_t now, delay;
+
+	/* rdp_peer_collect() flushes again when the encoder is done */
+	if (context->encoder.snapshot)
+		return;
+
+	if (!(context->item.flags & RDP_PEER_ACTIVATED) ||
+	    !(context->item.flags & RDP_PEER_OUTPUT_ENABLED)) {
+		pixman_region32_fini(&pacing->pending);
+		pixman_region32_init(&pacing->pending);
+		return;
+	}
+
+	if (!pixman_region32_not_empty(&pacing->pending))
+		return;
+
+	now = weston_compositor_get_time();
+	delay = rdp_pacing_delay(context, now);
+	if (delay) {
+		wl_event_source_timer_update(pacing->timer, delay);
+		return;
+	}
+
+	rdp_peer_send_region(context, &pacing->pending, &snapshot, now);
+	if (snapshot)
+		rdp_snapshot_unref(snapshot);
+
+	pixman_region32_fini(&pacing->pending);
+	pixman_region32_init(&pacing->pending);
+}
+
+static int
+rdp_peer_pacing_timer(void *data)
+{
+	rdp_peer_flush(data);
+
+	return 0;
+}
+
+/* Sends region to the peer, or merges it into the pending damage if the
+ * peer is not ready for another frame.  *snapshot is shared between all
+ * peers refreshed with the same region, see rdp_peer_send_region(). */
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer,
+			struct rdp_snapshot **snapshot)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_pacing *pacing = &context->pacing;
+	uint32_t now, delay;
+
+	if (context->encoder.snapshot ||
+	    pixman_region32_not_empty(&pacing->pending)) {
+		pixman_region32_union(&pacing->pending,
+				      &pacing->pending, region);
+		rdp_peer_flush(context);
+		return;
+	}
+
+	now = weston_compositor_get_time();
+	delay = rdp_pacing_delay(context, now);
+	if (delay) {
+		pixman_region32_copy(&pacing->pending, region);
+		wl_event_source_timer_update(pacing->timer, delay);
+		return;
+	}
+
+	rdp_peer_send_region(context, region, snapshot, now);
+}
+
+static void
+rdp_peer_collect(freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_output *output = context->rdpCompositor->output;
+	struct rdp_encoder *encoder = &context->encoder;
+	struct rdp_snapshot *snapshot;
+	uint32_t bytes;
+	int done;
+
+	pthread_mutex_lock(&encoder->mutex);
+	done = encoder->state == RDP_ENCODER_DONE;
+	pthread_mutex_unlock(&encoder->mutex);
+	if (!done)
+		return;
+
+	snapshot = encoder->snapshot;
+	if (snapshot->width != output->base.current_mode->width ||
+	    snapshot->height != output->base.current_mode->height) {
+		/* The output was resized while encoding, start over */
+		pixman_region32_union_rect(&context->pacing.pending,
+					   &context->pacing.pending, 0, 0,
+					   output->base.current_mode->width,
+					   output->base.current_mode->height);
+	} else if ((context->item.flags & RDP_PEER_ACTIVATED) &&
+		   (context->item.flags & RDP_PEER_OUTPUT_ENABLED)) {
+		bytes = context->pacing.sample_bytes;
+		rdp_peer_send_encoded(peer, encoder);
+		rdp_pacing_frame_sent(context,
+				      context->pacing.sample_bytes - bytes);
+	}
+
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->snapshot = NULL;
+	encoder->state = RDP_ENCODER_IDLE;
+	pthread_mutex_unlock(&encoder->mutex);
+	rdp_snapshot_unref(snapshot);
+
+	rdp_peer_flush(context);
+}
+
+static int
+rdp_encoder_pipe_handler(int fd, uint32_t mask, void *data)
+{
+	struct rdp_output *output = data;
+	struct rdp_peers_item *item;
+	char buf[64];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	wl_list_for_each(item, &output->peers, link)
+		rdp_peer_collect(item->peer);
+
+	return 1;
 }
 
 static void
@@ -318,6 +975,7 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage)
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
 	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_peers_item *outputPeer;
+	struct rdp_snapshot *snapshot = NULL;
 
 	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
 	ec->renderer->repaint_output(&output->base, damage);
@@ -327,11 +985,15 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage)
 			if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
 					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
 			{
-				rdp_peer_refresh_region(damage, outputPeer->peer);
+				rdp_peer_refresh_region(damage, outputPeer->peer,
+							&snapshot);
 			}
 		}
 	}
 
+	if (snapshot)
+		rdp_snapshot_unref(snapshot);
+
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
@@ -345,6 +1007,9 @@ rdp_output_destroy(struct weston_output *output_base)
 	struct rdp_output *output = (struct rdp_output *)output_base;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	wl_event_source_remove(output->encoder_source);
+	close(output->encoder_pipe[0]);
+	close(output->encoder_pipe[1]);
 	free(output);
 }
 
@@ -473,7 +1138,18 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height)
 	if (pixman_renderer_output_create(&output->base) < 0)
 		goto out_shadow_surface;
 
+	if (pipe2(output->encoder_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+		weston_log("Failed to create encoder pipe: %m\n");
+		goto out_renderer;
+	}
+
 	loop = wl_display_get_event_loop(c->base.wl_display);
+	output->encoder_source = wl_event_loop_add_fd(loop,
+			output->encoder_pipe[0], WL_EVENT_READABLE,
+			rdp_encoder_pipe_handler, output);
+	if (!output->encoder_source)
+		goto out_pipe;
+
 	output->finish_frame_timer = wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
 	output->base.start_repaint_loop = rdp_output_start_repaint_loop;
@@ -488,6 +1164,11 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height)
 	wl_list_insert(c->base.output_list.prev, &output->base.link);
 	return 0;
 
+out_pipe:
+	close(output->encoder_pipe[0]);
+	close(output->encoder_pipe[1]);
+out_renderer:
+	pixman_renderer_output_destroy(&output->base);
 out_shadow_surface:
 	pixman_image_unref(output->shadow_surface);
 out_output:
@@ -554,21 +1235,6 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 {
 	context->item.peer = client;
 	context->item.flags = RDP_PEER_OUTPUT_ENABLED;
-
-#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
-	context->rfx_context = rfx_context_new();
-#else
-	context->rfx_context = rfx_context_new(TRUE);
-#endif
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = client->settings->DesktopWidth;
-	context->rfx_context->height = client->settings->DesktopHeight;
-	rfx_context_set_pixel_format(context->rfx_context, RDP_PIXEL_FORMAT_B8G8R8A8);
-
-	context->nsc_context = nsc_context_new();
-	nsc_context_set_pixel_format(context->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
-
-	context->encode_stream = Stream_New(NULL, 65536);
 }
 
 static void
@@ -589,10 +1255,12 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		weston_seat_release_pointer(&context->item.seat);
 		weston_seat_release(&context->item.seat);
 	}
-	Stream_Free(context->encode_stream, TRUE);
-	nsc_context_free(context->nsc_context);
-	rfx_context_free(context->rfx_context);
-	free(context->rfx_rects);
+	if (context->encoder.running)
+		rdp_encoder_release(&context->encoder);
+	if (context->pacing.timer) {
+		wl_event_source_remove(context->pacing.timer);
+		pixman_region32_fini(&context->pacing.pending);
+	}
 }
 
 
@@ -661,6 +1329,7 @@ xf_peer_post_connect(freerdp_peer* client)
 	int i;
 	pixman_box32_t box;
 	pixman_region32_t damage;
+	struct rdp_snapshot *snapshot = NULL;
 
 
 	peerCtx = (RdpPeerContext *)client->context;
@@ -745,7 +1414,9 @@ xf_peer_post_connect(freerdp_peer* client)
 	box.y2 = output->base.height;
 	pixman_region32_init_with_extents(&damage, &box);
 
-	rdp_peer_refresh_region(&damage, client);
+	rdp_peer_refresh_region(&damage, client, &snapshot);
+	if (snapshot)
+		rdp_snapshot_unref(snapshot);
 
 	pixman_region32_fini(&damage);
 
@@ -756,7 +1427,12 @@ static BOOL
 xf_peer_activate(freerdp_peer *client)
 {
 	RdpPeerContext *context = (RdpPeerContext *)client->context;
-	rfx_context_reset(context->rfx_context);
+	struct rdp_encoder *encoder = &context->encoder;
+
+	/* The codec contexts may be in use, reset them before the next frame */
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->reset = 1;
+	pthread_mutex_unlock(&encoder->mutex);
 	return TRUE;
 }
 
@@ -831,6 +1507,7 @@ xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 	struct rdp_output *output = peerCtx->rdpCompositor->output;
 	pixman_box32_t box;
 	pixman_region32_t damage;
+	struct rdp_snapshot *snapshot = NULL;
 
 	/* sends a full refresh */
 	box.x1 = 0;
@@ -839,7 +1516,9 @@ xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 	box.y2 = output->base.height;
 	pixman_region32_init_with_extents(&damage, &box);
 
-	rdp_peer_refresh_region(&damage, client);
+	rdp_peer_refresh_region(&damage, client, &snapshot);
+	if (snapshot)
+		rdp_snapshot_unref(snapshot);
 
 	pixman_region32_fini(&damage);
 }
@@ -902,10 +1581,30 @@ xf_input_unicode_keyboard_event(rdpInput *input, UINT16 flags, UINT16 code)
 static void
 xf_suppress_output(rdpContext *context, BYTE allow, RECTANGLE_16 *area) {
 	RdpPeerContext *peerContext = (RdpPeerContext *)context;
-	if (allow)
-		peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
-	else
+	struct rdp_output *output = peerContext->rdpCompositor->output;
+	pixman_region32_t *pending = &peerContext->pacing.pending;
+
+	if (!allow) {
 		peerContext->item.flags &= (~RDP_PEER_OUTPUT_ENABLED);
+		return;
+	}
+
+	if (peerContext->item.flags & RDP_PEER_OUTPUT_ENABLED)
+		return;
+
+	/* Nothing was sent while suppressed, bring the area up to date.
+	 * The rectangle is inclusive; a pixel too many does not hurt. */
+	peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
+	if (area)
+		pixman_region32_union_rect(pending, pending,
+					   area->left, area->top,
+					   area->right - area->left + 1,
+					   area->bottom - area->top + 1);
+	else
+		pixman_region32_union_rect(pending, pending, 0, 0,
+					   output->base.width,
+					   output->base.height);
+	rdp_peer_flush(peerContext);
 }
 
 static int
@@ -928,6 +1627,22 @@ rdp_peer_init(freerdp_peer *client, struct rdp_compositor *c)
 	peerCtx = (RdpPeerContext *) client->context;
 	peerCtx->rdpCompositor = c;
 
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	peerCtx->pacing.timer = wl_event_loop_add_timer(loop,
+			rdp_peer_pacing_timer, peerCtx);
+	if (!peerCtx->pacing.timer)
+		return -1;
+	pixman_region32_init(&peerCtx->pacing.pending);
+	peerCtx->pacing.interval = RDP_MIN_FRAME_INTERVAL;
+	peerCtx->pacing.bandwidth = RDP_INITIAL_BANDWIDTH;
+	peerCtx->pacing.sample_time = weston_compositor_get_time();
+	peerCtx->pacing.last_frame =
+		peerCtx->pacing.sample_time - RDP_MAX_FRAME_INTERVAL;
+
+	if (rdp_encoder_init(&peerCtx->encoder, client, c->encoder_threads,
+			     c->output->encoder_pipe[1]) < 0)
+		return -1;
+
 	settings = client->settings;
 	settings->RdpKeyFile = c->rdp_key;
 	if (c->tls_enabled) {
@@ -964,7 +1679,6 @@ rdp_peer_init(freerdp_peer *client, struct rdp_compositor *c)
 		return -1;
 	}
 
-	loop = wl_display_get_event_loop(c->base.wl_display);
 	for(i = 0; i < rcount; i++) {
 		fd = (int)(long)(rfds[i]);
 
@@ -1008,6 +1722,14 @@ rdp_compositor_create(struct wl_display *display,
 	c->rdp_key = config->rdp_key ? strdup(config->rdp_key) : NULL;
 	c->no_clients_resize = config->no_clients_resize;
 
+	c->encoder_threads = config->encoder_threads;
+	if (c->encoder_threads <= 0)
+		c->encoder_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (c->encoder_threads < 1)
+		c->encoder_threads = 1;
+	if (c->encoder_threads > RDP_MAX_ENCODER_BANDS)
+		c->encoder_threads = RDP_MAX_ENCODER_BANDS;
+
 	/* activate TLS only if certificate/key are available */
 	if (config->server_cert && config->server_key) {
 		weston_log("TLS support activated\n");
@@ -1089,6 +1811,7 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 		{ WESTON_OPTION_STRING,  "address", 0, &config.bind_address },
 		{ WESTON_OPTION_INTEGER, "port", 0, &config.port },
 		{ WESTON_OPTION_BOOLEAN, "no-clients-resize", 0, &config.no_clients_resize },
+		{ WESTON_OPTION_INTEGER, "encoder-threads", 0, &config.encoder_threads },
 		{ WESTON_OPTION_STRING,  "rdp4-key", 0, &config.rdp_key },
 		{ WESTON_OPTION_STRING,  "rdp-tls-cert", 0, &config.server_cert },
 		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key }
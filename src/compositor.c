@@ -1762,12 +1762,17 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
+	struct weston_seat *seat;
 	pixman_region32_t output_damage;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
+	/* Repaint with the cursor where the input read so far puts it. */
+	wl_list_for_each(seat, &ec->seat_list, link)
+		weston_seat_flush_input(seat);
+
 	/* Rebuild the surface list and update surface transforms up front. */
 	weston_compositor_build_view_list(ec);
 
@@ -3646,6 +3651,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	struct wl_event_loop *loop;
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
+	int i;
 
 	ec->config = config;
 	ec->wl_display = display;
@@ -3691,6 +3697,11 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_list_init(&ec->touch_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
+	for (i = 0; i < WESTON_BINDING_TABLE_SIZE; i++) {
+		wl_list_init(&ec->key_binding_table[i]);
+		wl_list_init(&ec->button_binding_table[i]);
+		wl_list_init(&ec->axis_binding_table[i]);
+	}
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
@@ -3699,6 +3710,10 @@ weston_compositor_init(struct weston_compositor *ec,
 	weston_config_section_get_bool(s, "color-managed",
 					 &ec->color_managed, 0);
 
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(s, "coalesce-motion",
+				       &ec->coalesce_motion, 0);
+
 	s = weston_config_get_section(ec->config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
 					 (char **) &xkb_names.rules, NULL);
@@ -4060,7 +4075,12 @@ usage(int error_code)
 	fprintf(stderr,
 		"Options for fbdev-backend.so:\n\n"
 		"  --tty=TTY\t\tThe tty to use\n"
-		"  --device=DEVICE\tThe framebuffer device to use\n\n");
+		"  --device=DEVICE\tThe framebuffer device to use\n"
+		"  --transform=TR\tThe output transformation, TR is one of:\n"
+		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
+		"  --native-composite\tComposite opaque areas directly in the "
+		"frame buffer format, dithering only blended areas\n"
+		"\n");
 
 	fprintf(stderr,
 		"Options for x11-backend.so:\n\n"
@@ -4103,6 +4123,7 @@ usage(int error_code)
        "  --address=ADDR\tThe address to bind\n"
        "  --port=PORT\tThe port to listen on\n"
        "  --no-clients-resize\tThe RDP peers will be forced to the size of the desktop\n"
+       "  --encoder-threads=N\tThreads encoding RemoteFX tiles for each peer\n"
        "  --rdp4-key=FILE\tThe file containing the key for RDP4 encryption\n"
        "  --rdp-tls-cert=FILE\tThe file containing the certificate for TLS encryption\n"
        "  --rdp-tls-key=FILE\tThe file containing the private key for TLS encryption\n"
@@ -220,6 +220,12 @@ struct weston_output {
 	void (*assign_planes)(struct weston_output *output);
 	int (*switch_mode)(struct weston_output *output, struct weston_mode *mode);
 
+	/* Moves a view that the last repaint put on a cursor plane to x, y
+	 * in global coordinates, without repainting.  Returns -1 if the
+	 * output needs a repaint for the move instead. */
+	int (*move_cursor)(struct weston_output *output,
+			   struct weston_view *view, int32_t x, int32_t y);
+
 	/* backlight values are on 0-255 range, where higher is brighter */
 	int32_t backlight_current;
 	void (*set_backlight)(struct weston_output *output, uint32_t value);
@@ -242,6 +248,13 @@ struct weston_pointer_grab_interface {
 	void (*button)(struct weston_pointer_grab *grab,
 		       uint32_t time, uint32_t button, uint32_t state);
 	void (*cancel)(struct weston_pointer_grab *grab);
+
+	/* Optional.  When set, these are called instead of motion and
+	 * button, with the event time in microseconds. */
+	void (*motion_usec)(struct weston_pointer_grab *grab, uint64_t time,
+			    wl_fixed_t x, wl_fixed_t y);
+	void (*button_usec)(struct weston_pointer_grab *grab,
+			    uint64_t time, uint32_t button, uint32_t state);
 };
 
 struct weston_pointer_grab {
@@ -257,6 +270,11 @@ struct weston_keyboard_grab_interface {
 			  uint32_t mods_depressed, uint32_t mods_latched,
 			  uint32_t mods_locked, uint32_t group);
 	void (*cancel)(struct weston_keyboard_grab *grab);
+
+	/* Optional.  When set, this is called instead of key, with the
+	 * event time in microseconds. */
+	void (*key_usec)(struct weston_keyboard_grab *grab, uint64_t time,
+			 uint32_t key, uint32_t state);
 };
 
 struct weston_keyboard_grab {
@@ -334,6 +352,15 @@ struct weston_pointer {
 	uint32_t button_count;
 
 	struct wl_listener output_destroy_listener;
+
+	/* Motion merged until the end of the input batch, see
+	 * weston_seat_flush_input(). */
+	struct {
+		int active;
+		uint64_t time; /* us */
+		wl_fixed_t x, y;
+	} pending_motion;
+	struct wl_event_source *motion_idle;
 };
 
 
@@ -539,11 +566,26 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+typedef void (*weston_read_pixels_done_func_t)(void *data, void *pixels,
+					       int stride);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+	/* Optional.  Queues a read like read_pixels() without waiting for
+	 * rendering to finish, and calls done() once the pixels are
+	 * available, usually at the start of the next repaint.  The pixels
+	 * are only valid during the callback and are NULL if the read
+	 * failed.  Returns -1, without calling done(), if the read could
+	 * not be queued. */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_done_func_t done,
+				 void *data);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -568,6 +610,8 @@ enum weston_capability {
 	WESTON_CAP_ARBITRARY_MODES		= 0x0008,
 };
 
+#define WESTON_BINDING_TABLE_SIZE 64 /* must be a power of two */
+
 struct weston_compositor {
 	struct wl_signal destroy_signal;
 
@@ -598,6 +642,7 @@ struct weston_compositor {
 
 	struct wl_signal session_signal;
 	int session_active;
+	int coalesce_motion;
 
 	struct weston_layer fade_layer;
 	struct weston_layer cursor_layer;
@@ -614,6 +659,12 @@ struct weston_compositor {
 	struct wl_list axis_binding_list;
 	struct wl_list debug_binding_list;
 
+	/* The key, button and axis bindings again, hashed by code and
+	 * modifiers for dispatch. */
+	struct wl_list key_binding_table[WESTON_BINDING_TABLE_SIZE];
+	struct wl_list button_binding_table[WESTON_BINDING_TABLE_SIZE];
+	struct wl_list axis_binding_table[WESTON_BINDING_TABLE_SIZE];
+
 	uint32_t state;
 	struct wl_event_source *idle_source;
 	uint32_t idle_inhibit;
@@ -985,12 +1036,21 @@ void
 notify_motion(struct weston_seat *seat, uint32_t time,
 	      wl_fixed_t dx, wl_fixed_t dy);
 void
+notify_motion_usec(struct weston_seat *seat, uint64_t time,
+		   wl_fixed_t dx, wl_fixed_t dy);
+void
 notify_motion_absolute(struct weston_seat *seat, uint32_t time,
 		       wl_fixed_t x, wl_fixed_t y);
 void
+notify_motion_absolute_usec(struct weston_seat *seat, uint64_t time,
+			    wl_fixed_t x, wl_fixed_t y);
+void
 notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 	      enum wl_pointer_button_state state);
 void
+notify_button_usec(struct weston_seat *seat, uint64_t time, int32_t button,
+		   enum wl_pointer_button_state state);
+void
 notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	    wl_fixed_t value);
 void
@@ -998,6 +1058,10 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	   enum wl_keyboard_key_state state,
 	   enum weston_key_state_update update_state);
 void
+notify_key_usec(struct weston_seat *seat, uint64_t time, uint32_t key,
+		enum wl_keyboard_key_state state,
+		enum weston_key_state_update update_state);
+void
 notify_modifiers(struct weston_seat *seat, uint32_t serial);
 
 void
@@ -1260,6 +1324,8 @@ weston_seat_release_touch(struct weston_seat *seat);
 void
 weston_seat_repick(struct weston_seat *seat);
 void
+weston_seat_flush_input(struct weston_seat *seat);
+void
 weston_seat_update_keymap(struct weston_seat *seat, struct xkb_keymap *keymap);
 
 void
@@ -1319,6 +1385,13 @@ typedef void (*weston_screenshooter_done_func_t)(void *data,
 int
 weston_screenshooter_shoot(struct weston_output *output, struct weston_buffer *buffer,
 			   weston_screenshooter_done_func_t done, void *data);
+int
+weston_screenshooter_shoot_region(struct weston_output *output,
+				  struct weston_buffer *buffer,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  weston_screenshooter_done_func_t done,
+				  void *data);
 
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "compositor.h"
+#include "damage-heatmap.h"
+
+#define REPORT_INTERVAL_MS 1000
+#define REPORT_SURFACES 5
+
+int
+damage_heatmap_init(struct damage_heatmap *heatmap,
+		    int x, int y, int width, int height)
+{
+	heatmap->x = x;
+	heatmap->y = y;
+	heatmap->width = (width + DAMAGE_HEATMAP_TILE_SIZE - 1) /
+			 DAMAGE_HEATMAP_TILE_SIZE;
+	heatmap->height = (height + DAMAGE_HEATMAP_TILE_SIZE - 1) /
+			  DAMAGE_HEATMAP_TILE_SIZE;
+	heatmap->history = calloc(heatmap->width * heatmap->height,
+				  sizeof *heatmap->history);
+
+	return heatmap->history ? 0 : -1;
+}
+
+void
+damage_heatmap_release(struct damage_heatmap *heatmap)
+{
+	free(heatmap->history);
+	heatmap->history = NULL;
+}
+
+void
+damage_heatmap_add_frame(struct damage_heatmap *heatmap,
+			 pixman_region32_t *damage)
+{
+	pixman_box32_t *rects;
+	int nrects, i, tx, ty, tx1, ty1, tx2, ty2;
+	int ntiles = heatmap->width * heatmap->height;
+
+	for (i = 0; i < ntiles; i++)
+		heatmap->history[i] <<= 1;
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	for (i = 0; i < nrects; i++) {
+		if (rects[i].x2 <= rects[i].x1 || rects[i].y2 <= rects[i].y1)
+			continue;
+
+		tx1 = (rects[i].x1 - heatmap->x) / DAMAGE_HEATMAP_TILE_SIZE;
+		ty1 = (rects[i].y1 - heatmap->y) / DAMAGE_HEATMAP_TILE_SIZE;
+		tx2 = (rects[i].x2 - 1 - heatmap->x) /
+		      DAMAGE_HEATMAP_TILE_SIZE;
+		ty2 = (rects[i].y2 - 1 - heatmap->y) /
+		      DAMAGE_HEATMAP_TILE_SIZE;
+
+		if (tx1 < 0)
+			tx1 = 0;
+		if (ty1 < 0)
+			ty1 = 0;
+		if (tx2 >= heatmap->width)
+			tx2 = heatmap->width - 1;
+		if (ty2 >= heatmap->height)
+			ty2 = heatmap->height - 1;
+
+		for (ty = ty1; ty <= ty2; ty++)
+			for (tx = tx1; tx <= tx2; tx++)
+				heatmap->history[ty * heatmap->width + tx] |= 1;
+	}
+}
+
+int
+damage_heatmap_tile(struct damage_heatmap *heatmap, int tx, int ty,
+		    pixman_box32_t *box, float color[4])
+{
+	static const float gradient[][3] = {
+		{ 0.0, 0.0, 1.0 }, /* blue, rarely damaged */
+		{ 0.0, 1.0, 1.0 },
+		{ 0.0, 1.0, 0.0 },
+		{ 1.0, 1.0, 0.0 },
+		{ 1.0, 0.0, 0.0 }, /* red, damaged every frame */
+	};
+	const float alpha = 0.5;
+	int count, i, segment;
+	float t, f;
+
+	count = __builtin_popcountll(heatmap->history[ty * heatmap->width + tx]);
+	if (count == 0)
+		return 0;
+
+	box->x1 = heatmap->x + tx * DAMAGE_HEATMAP_TILE_SIZE;
+	box->y1 = heatmap->y + ty * DAMAGE_HEATMAP_TILE_SIZE;
+	box->x2 = box->x1 + DAMAGE_HEATMAP_TILE_SIZE;
+	box->y2 = box->y1 + DAMAGE_HEATMAP_TILE_SIZE;
+
+	t = (float) (count - 1) / (DAMAGE_HEATMAP_WINDOW - 1) *
+	    (ARRAY_LENGTH(gradient) - 1);
+	segment = (int) t;
+	if (segment >= (int) ARRAY_LENGTH(gradient) - 1)
+		segment = ARRAY_LENGTH(gradient) - 2;
+	f = t - segment;
+
+	for (i = 0; i < 3; i++)
+		color[i] = alpha * (gradient[segment][i] * (1.0 - f) +
+				    gradient[segment + 1][i] * f);
+	color[3] = alpha;
+
+	return count;
+}
+
+void
+damage_heatmap_report_surfaces(uint32_t *report_time,
+			       struct weston_compositor *compositor,
+			       uint64_t (*take_area)(struct weston_surface *))
+{
+	struct {
+		struct weston_surface *surface;
+		uint64_t area;
+	} top[REPORT_SURFACES];
+	struct weston_view *view;
+	struct weston_surface *surface;
+	uint64_t area;
+	uint32_t now, elapsed;
+	pid_t pid;
+	int i, n = 0;
+
+	now = weston_compositor_get_time();
+	elapsed = now - *report_time;
+	if (elapsed < REPORT_INTERVAL_MS)
+		return;
+
+	*report_time = now;
+
+	/* Surfaces with several views are only counted once, as
+	 * take_area() resets their area. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		area = take_area(view->surface);
+		if (area == 0)
+			continue;
+
+		for (i = n; i > 0 && top[i - 1].area < area; i--)
+			if (i < REPORT_SURFACES)
+				top[i] = top[i - 1];
+
+		if (i < REPORT_SURFACES) {
+			top[i].surface = view->surface;
+			top[i].area = area;
+			if (n < REPORT_SURFACES)
+				n++;
+		}
+	}
+
+	if (n == 0)
+		return;
+
+	weston_log("top damaging surfaces over %u ms:\n", elapsed);
+	for (i = 0; i < n; i++) {
+		surface = top[i].surface;
+		pid = 0;
+		if (surface->resource)
+			wl_client_get_credentials(
+				wl_resource_get_client(surface->resource),
+				&pid, NULL, NULL);
+
+		weston_log_continue(STAMP_SPACE "pid %d surface %u "
+				    "(%dx%d): %" PRIu64 " px/s\n",
+				    pid,
+				    surface->resource ?
+				    wl_resource_get_id(surface->resource) : 0,
+				    surface->width, surface->height,
+				    top[i].area * 1000 / elapsed);
+	}
+}
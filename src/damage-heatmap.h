@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_DAMAGE_HEATMAP_H
+#define _WESTON_DAMAGE_HEATMAP_H
+
+#include <stdint.h>
+#include <pixman.h>
+
+struct weston_compositor;
+struct weston_surface;
+
+#define DAMAGE_HEATMAP_TILE_SIZE 32
+
+/* Number of frames the heat map remembers; one bit of history each. */
+#define DAMAGE_HEATMAP_WINDOW 64
+
+struct damage_heatmap {
+	int x, y; /* origin of the tile grid in global coordinates */
+	int width, height; /* in tiles */
+	uint64_t *history; /* per tile, the newest frame is bit 0 */
+};
+
+int
+damage_heatmap_init(struct damage_heatmap *heatmap,
+		    int x, int y, int width, int height);
+
+void
+damage_heatmap_release(struct damage_heatmap *heatmap);
+
+/* Records one frame of damage, in global coordinates. */
+void
+damage_heatmap_add_frame(struct damage_heatmap *heatmap,
+			 pixman_region32_t *damage);
+
+/* Returns in how many of the last DAMAGE_HEATMAP_WINDOW frames the tile
+ * was damaged, and fills in its bounds in global coordinates and its
+ * overlay colour as premultiplied RGBA. */
+int
+damage_heatmap_tile(struct damage_heatmap *heatmap, int tx, int ty,
+		    pixman_box32_t *box, float color[4]);
+
+/* Logs the surfaces that accumulated the most damage, at most once a
+ * second.  take_area returns the area a surface accumulated since the
+ * last call and resets it.  Surface damage is counted for the whole
+ * compositor, so report_time is shared by all outputs: whichever output
+ * repaints first once the second is up does the report. */
+void
+damage_heatmap_report_surfaces(uint32_t *report_time,
+			       struct weston_compositor *compositor,
+			       uint64_t (*take_area)(struct weston_surface *));
+
+#endif
@@ -0,0 +1,450 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Reads evdev devices on a thread of their own, so that events leave the
+ * kernel buffers and get their read time stamped while the compositor is
+ * busy repainting.  The events are handed to the compositor through a
+ * single producer, single consumer ring and dispatched from the input
+ * loop exactly like events read there directly. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "compositor.h"
+#include "evdev.h"
+
+#define QUEUE_SIZE 4096 /* events, must be a power of two */
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+
+enum queued_event_kind {
+	QUEUED_EVENT,
+	QUEUED_DEVICE_DIED,
+};
+
+struct queued_event {
+	enum queued_event_kind kind;
+	struct evdev_device *device;
+	struct input_event event;
+	uint64_t read_time; /* CLOCK_MONOTONIC, usecs */
+};
+
+struct evdev_input_thread {
+	struct weston_compositor *compositor;
+	pthread_t thread;
+	int epoll_fd;
+	int quit_pipe[2];
+	int wakeup_pipe[2];
+	struct wl_event_source *source;
+
+	/* The mutex is held by the thread while it reads devices, and by
+	 * the compositor while it changes the device list, so a device is
+	 * never read once it has been removed. */
+	pthread_mutex_t mutex;
+	pthread_cond_t space_cond;
+	struct wl_list device_list;
+	uint32_t next_id;
+	int quit;
+
+	/* The ring.  head is only written by the thread, tail only by the
+	 * compositor. */
+	uint32_t head;
+	uint32_t tail;
+	int wakeup_pending;
+	int producer_waiting;
+	struct queued_event queue[QUEUE_SIZE];
+
+	struct {
+		uint64_t events;
+		uint64_t total_delay;
+		uint64_t max_delay;
+		uint32_t stalls;
+	} stats;
+};
+
+static uint64_t
+monotonic_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t
+queue_space(struct evdev_input_thread *thread)
+{
+	uint32_t tail = __atomic_load_n(&thread->tail, __ATOMIC_SEQ_CST);
+
+	return QUEUE_SIZE - (thread->head - tail);
+}
+
+static void
+queue_push(struct evdev_input_thread *thread, enum queued_event_kind kind,
+	   struct evdev_device *device, struct input_event *ev,
+	   uint64_t read_time)
+{
+	struct queued_event *e = &thread->queue[thread->head & QUEUE_MASK];
+
+	e->kind = kind;
+	e->device = device;
+	if (ev)
+		e->event = *ev;
+	e->read_time = read_time;
+
+	__atomic_store_n(&thread->head, thread->head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+input_thread_wakeup(struct evdev_input_thread *thread)
+{
+	char c = 0;
+
+	if (__atomic_exchange_n(&thread->wakeup_pending, 1,
+				__ATOMIC_SEQ_CST) == 0)
+		write(thread->wakeup_pipe[1], &c, 1);
+}
+
+/* Called with the mutex held.  Waits for the compositor to make room in
+ * the ring, which drops the mutex, so the device may be gone after. */
+static void
+input_thread_wait_for_space(struct evdev_input_thread *thread)
+{
+	thread->stats.stalls++;
+	input_thread_wakeup(thread);
+
+	__atomic_store_n(&thread->producer_waiting, 1, __ATOMIC_SEQ_CST);
+	while (queue_space(thread) == 0 && !thread->quit)
+		pthread_cond_wait(&thread->space_cond, &thread->mutex);
+	__atomic_store_n(&thread->producer_waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+static struct evdev_device *
+input_thread_find_device(struct evdev_input_thread *thread, uint32_t id)
+{
+	struct evdev_device *device;
+
+	wl_list_for_each(device, &thread->device_list, input_thread_link)
+		if (device->input_thread_id == id)
+			return device;
+
+	return NULL;
+}
+
+static void
+input_thread_read_device(struct evdev_input_thread *thread, uint32_t id)
+{
+	struct evdev_device *device;
+	struct input_event ev[32];
+	uint64_t now;
+	int len, count, i;
+
+	while ((device = input_thread_find_device(thread, id))) {
+		count = queue_space(thread);
+		if (count == 0) {
+			input_thread_wait_for_space(thread);
+			if (thread->quit)
+				return;
+			continue;
+		}
+		if (count > (int) ARRAY_LENGTH(ev))
+			count = ARRAY_LENGTH(ev);
+
+		len = evdev_device_read(device, ev, count);
+		now = monotonic_usec();
+
+		if (len < 0 || len % sizeof ev[0] != 0) {
+			if (len < 0 && errno != EAGAIN && errno != EINTR) {
+				epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL,
+					  device->fd, NULL);
+				wl_list_remove(&device->input_thread_link);
+				wl_list_init(&device->input_thread_link);
+				queue_push(thread, QUEUED_DEVICE_DIED,
+					   device, NULL, now);
+			}
+
+			return;
+		}
+
+		for (i = 0; i < len / (int) sizeof ev[0]; i++)
+			queue_push(thread, QUEUED_EVENT, device, &ev[i], now);
+
+		if (len == 0)
+			return;
+	}
+}
+
+static void *
+input_thread_run(void *data)
+{
+	struct evdev_input_thread *thread = data;
+	struct epoll_event ep[16];
+	int i, n;
+
+	while (1) {
+		n = epoll_wait(thread->epoll_fd, ep, ARRAY_LENGTH(ep), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			weston_log("input thread: epoll_wait failed: %m\n");
+			break;
+		}
+
+		pthread_mutex_lock(&thread->mutex);
+		for (i = 0; i < n && !thread->quit; i++)
+			input_thread_read_device(thread, ep[i].data.u32);
+		if (thread->quit) {
+			pthread_mutex_unlock(&thread->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&thread->mutex);
+
+		input_thread_wakeup(thread);
+	}
+
+	return NULL;
+}
+
+static void
+input_thread_dispatch(struct evdev_input_thread *thread)
+{
+	struct weston_compositor *ec = thread->compositor;
+	struct queued_event *e;
+	uint32_t head, tail;
+	uint64_t now, delay;
+
+	tail = thread->tail;
+	head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+	if (tail == head)
+		return;
+
+	now = monotonic_usec();
+	for (; tail != head; tail++) {
+		e = &thread->queue[tail & QUEUE_MASK];
+
+		if (e->kind == QUEUED_DEVICE_DIED) {
+			weston_log("device %s died\n", e->device->devnode);
+			continue;
+		}
+
+		/* Like evdev_device_data(), but the events have been
+		 * taken off the device already, so drop them. */
+		if (!ec->session_active)
+			continue;
+
+		delay = now > e->read_time ? now - e->read_time : 0;
+		thread->stats.events++;
+		thread->stats.total_delay += delay;
+		if (delay > thread->stats.max_delay)
+			thread->stats.max_delay = delay;
+
+		evdev_process_events(e->device, &e->event, 1);
+	}
+
+	__atomic_store_n(&thread->tail, tail, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&thread->producer_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&thread->mutex);
+		pthread_cond_signal(&thread->space_cond);
+		pthread_mutex_unlock(&thread->mutex);
+	}
+}
+
+static int
+input_thread_handler(int fd, uint32_t mask, void *data)
+{
+	struct evdev_input_thread *thread = data;
+	char buf[64];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	/* Cleared before draining, so anything queued after this point
+	 * wakes us up again. */
+	__atomic_store_n(&thread->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+	input_thread_dispatch(thread);
+
+	return 1;
+}
+
+int
+evdev_input_thread_add_device(struct evdev_input_thread *thread,
+			      struct evdev_device *device)
+{
+	struct epoll_event ep;
+
+	pthread_mutex_lock(&thread->mutex);
+
+	device->input_thread_id = thread->next_id++;
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.u32 = device->input_thread_id;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, device->fd, &ep) < 0) {
+		pthread_mutex_unlock(&thread->mutex);
+		weston_log("input thread: failed to add %s: %m\n",
+			   device->devnode);
+		return -1;
+	}
+
+	wl_list_insert(&thread->device_list, &device->input_thread_link);
+	device->input_thread = thread;
+
+	pthread_mutex_unlock(&thread->mutex);
+
+	/* The thread reads the device from now on. */
+	if (device->source) {
+		wl_event_source_remove(device->source);
+		device->source = NULL;
+	}
+
+	return 0;
+}
+
+void
+evdev_input_thread_remove_device(struct evdev_device *device)
+{
+	struct evdev_input_thread *thread = device->input_thread;
+
+	pthread_mutex_lock(&thread->mutex);
+	epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+	wl_list_remove(&device->input_thread_link);
+	pthread_mutex_unlock(&thread->mutex);
+
+	/* Nothing is queued for the device after this, and the events
+	 * queued so far must not outlive it. */
+	input_thread_dispatch(thread);
+	device->input_thread = NULL;
+}
+
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor)
+{
+	struct evdev_input_thread *thread;
+	struct epoll_event ep;
+
+	thread = zalloc(sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+
+	thread->compositor = compositor;
+	thread->next_id = 1;
+	wl_list_init(&thread->device_list);
+	pthread_mutex_init(&thread->mutex, NULL);
+	pthread_cond_init(&thread->space_cond, NULL);
+
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epoll_fd < 0)
+		goto err_free;
+
+	if (pipe2(thread->quit_pipe, O_CLOEXEC) < 0)
+		goto err_epoll;
+
+	if (pipe2(thread->wakeup_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto err_quit_pipe;
+
+	/* Device ids start at 1, 0 is the quit pipe. */
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.u32 = 0;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD,
+		      thread->quit_pipe[0], &ep) < 0)
+		goto err_wakeup_pipe;
+
+	/* Dispatched from the input loop like the devices themselves, so
+	 * input is still processed once per frame while repainting. */
+	thread->source = wl_event_loop_add_fd(compositor->input_loop,
+					      thread->wakeup_pipe[0],
+					      WL_EVENT_READABLE,
+					      input_thread_handler, thread);
+	if (thread->source == NULL)
+		goto err_wakeup_pipe;
+
+	if (pthread_create(&thread->thread, NULL,
+			   input_thread_run, thread) != 0)
+		goto err_source;
+
+	weston_log("reading input devices on a separate thread\n");
+
+	return thread;
+
+err_source:
+	wl_event_source_remove(thread->source);
+err_wakeup_pipe:
+	close(thread->wakeup_pipe[0]);
+	close(thread->wakeup_pipe[1]);
+err_quit_pipe:
+	close(thread->quit_pipe[0]);
+	close(thread->quit_pipe[1]);
+err_epoll:
+	close(thread->epoll_fd);
+err_free:
+	weston_log("failed to start input thread\n");
+	pthread_cond_destroy(&thread->space_cond);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+	return NULL;
+}
+
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread)
+{
+	struct evdev_device *device, *next;
+	char c = 0;
+
+	wl_list_for_each_safe(device, next,
+			      &thread->device_list, input_thread_link)
+		evdev_input_thread_remove_device(device);
+
+	pthread_mutex_lock(&thread->mutex);
+	thread->quit = 1;
+	pthread_cond_signal(&thread->space_cond);
+	pthread_mutex_unlock(&thread->mutex);
+	write(thread->quit_pipe[1], &c, 1);
+	pthread_join(thread->thread, NULL);
+
+	if (thread->stats.events > 0)
+		weston_log("input thread: %llu events, dispatch delay "
+			   "avg %.2f ms, max %.2f ms, %u queue stalls\n",
+			   (unsigned long long) thread->stats.events,
+			   thread->stats.total_delay /
+			   (thread->stats.events * 1000.0),
+			   thread->stats.max_delay / 1000.0,
+			   thread->stats.stalls);
+
+	wl_event_source_remove(thread->source);
+	close(thread->wakeup_pipe[0]);
+	close(thread->wakeup_pipe[1]);
+	close(thread->quit_pipe[0]);
+	close(thread->quit_pipe[1]);
+	close(thread->epoll_fd);
+	pthread_cond_destroy(&thread->space_cond);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+}
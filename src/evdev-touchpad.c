@@ -201,7 +201,7 @@ static double
 touchpad_profile(struct weston_motion_filter *filter,
 		 void *data,
 		 double velocity,
-		 uint32_t time)
+		 uint64_t time)
 {
 	struct touchpad_dispatch *touchpad =
 		(struct touchpad_dispatch *) data;
@@ -263,7 +263,7 @@ touchpad_get_delta(struct touchpad_dispatch *touchpad, double *dx, double *dy)
 
 static void
 filter_motion(struct touchpad_dispatch *touchpad,
-	      double *dx, double *dy, uint32_t time)
+	      double *dx, double *dy, uint64_t time)
 {
 	struct weston_motion_params motion;
 
@@ -424,8 +424,9 @@ fsm_timout_handler(void *data)
 }
 
 static void
-touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
+touchpad_update_state(struct touchpad_dispatch *touchpad, uint64_t usec)
 {
+	uint32_t time = usec / 1000;
 	int motion_index;
 	int center_x, center_y;
 	double dx = 0.0, dy = 0.0;
@@ -487,12 +488,12 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 	if (touchpad->motion_count >= 4) {
 		touchpad_get_delta(touchpad, &dx, &dy);
 
-		filter_motion(touchpad, &dx, &dy, time);
+		filter_motion(touchpad, &dx, &dy, usec);
 
 		if (touchpad->finger_state == TOUCHPAD_FINGERS_ONE) {
-			notify_motion(touchpad->device->seat, time,
-				      wl_fixed_from_double(dx),
-				      wl_fixed_from_double(dy));
+			notify_motion_usec(touchpad->device->seat, usec,
+					   wl_fixed_from_double(dx),
+					   wl_fixed_from_double(dy));
 		} else if (touchpad->finger_state == TOUCHPAD_FINGERS_TWO) {
 			if (dx != 0.0)
 				notify_axis(touchpad->device->seat,
@@ -570,7 +571,7 @@ static inline void
 process_key(struct touchpad_dispatch *touchpad,
 	    struct evdev_device *device,
 	    struct input_event *e,
-	    uint32_t time)
+	    uint64_t time)
 {
 	uint32_t code;
 
@@ -596,9 +597,9 @@ process_key(struct touchpad_dispatch *touchpad,
 			code = BTN_RIGHT;
 		else
 			code = e->code;
-		notify_button(device->seat, time, code,
-			      e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-			                 WL_POINTER_BUTTON_STATE_RELEASED);
+		notify_button_usec(device->seat, time, code,
+				   e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+					      WL_POINTER_BUTTON_STATE_RELEASED);
 		break;
 	case BTN_TOOL_PEN:
 	case BTN_TOOL_RUBBER:
@@ -634,7 +635,7 @@ static void
 touchpad_process(struct evdev_dispatch *dispatch,
 		 struct evdev_device *device,
 		 struct input_event *e,
-		 uint32_t time)
+		 uint64_t time)
 {
 	struct touchpad_dispatch *touchpad =
 		(struct touchpad_dispatch *) dispatch;
@@ -748,8 +749,17 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	touchpad->hysteresis.center_x = 0;
 	touchpad->hysteresis.center_y = 0;
 
-	/* Configure acceleration profile */
-	accel = create_pointer_accelator_filter(touchpad_profile);
+	/* Configure acceleration profile.  The factor is clamped from the
+	 * velocity where it reaches max_accel_factor, so sampling up to
+	 * there covers the whole curve. */
+	accel = NULL;
+	if (touchpad->constant_accel_factor > 0.0)
+		accel = create_pointer_accelator_curve_filter(
+			touchpad_profile, touchpad,
+			touchpad->max_accel_factor /
+			touchpad->constant_accel_factor);
+	if (accel == NULL)
+		accel = create_pointer_accelator_filter(touchpad_profile);
 	if (accel == NULL)
 		return -1;
 	touchpad->filter = accel;
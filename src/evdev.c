@@ -33,6 +33,7 @@
 
 #include "compositor.h"
 #include "evdev.h"
+#include "input-record.h"
 
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 
@@ -84,51 +85,78 @@ transform_absolute(struct evdev_device *device, int32_t *x, int32_t *y)
        }
 }
 
+/* Multi-touch slots are sent together once the frame is complete, so a
+ * slot changing its position more than once in a frame is sent once. */
 static void
-evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
+evdev_flush_touch_slots(struct evdev_device *device, uint64_t time)
 {
 	struct weston_seat *master = device->seat;
 	wl_fixed_t x, y;
-	int32_t cx, cy;
 	int slot, seat_slot;
 
-	slot = device->mt.slot;
+	while (device->mt.pending_slots) {
+		slot = ffs(device->mt.pending_slots) - 1;
+		device->mt.pending_slots &= ~(1 << slot);
+
+		switch (device->mt.slots[slot].pending_event) {
+		case EVDEV_ABSOLUTE_MT_DOWN:
+			if (device->output == NULL)
+				break;
+			weston_output_transform_coordinate(device->output,
+							   wl_fixed_from_int(device->mt.slots[slot].x),
+							   wl_fixed_from_int(device->mt.slots[slot].y),
+							   &x, &y);
+			seat_slot = ffs(~master->slot_map) - 1;
+			device->mt.slots[slot].seat_slot = seat_slot;
+			master->slot_map |= 1 << seat_slot;
+
+			notify_touch(master, time / 1000, seat_slot, x, y,
+				     WL_TOUCH_DOWN);
+			device->touch_frame_pending = 1;
+			break;
+		case EVDEV_ABSOLUTE_MT_MOTION:
+			if (device->output == NULL)
+				break;
+			weston_output_transform_coordinate(device->output,
+							   wl_fixed_from_int(device->mt.slots[slot].x),
+							   wl_fixed_from_int(device->mt.slots[slot].y),
+							   &x, &y);
+			seat_slot = device->mt.slots[slot].seat_slot;
+			notify_touch(master, time / 1000, seat_slot, x, y,
+				     WL_TOUCH_MOTION);
+			device->touch_frame_pending = 1;
+			break;
+		case EVDEV_ABSOLUTE_MT_UP:
+			seat_slot = device->mt.slots[slot].seat_slot;
+			master->slot_map &= ~(1 << seat_slot);
+			notify_touch(master, time / 1000, seat_slot, 0, 0,
+				     WL_TOUCH_UP);
+			device->touch_frame_pending = 1;
+			break;
+		default:
+			break;
+		}
+
+		device->mt.slots[slot].pending_event = EVDEV_NONE;
+	}
+}
+
+static void
+evdev_flush_pending_event(struct evdev_device *device, uint64_t time)
+{
+	struct weston_seat *master = device->seat;
+	wl_fixed_t x, y;
+	int32_t cx, cy;
+	int seat_slot;
+
 	switch (device->pending_event) {
 	case EVDEV_NONE:
 		return;
 	case EVDEV_RELATIVE_MOTION:
-		notify_motion(master, time, device->rel.dx, device->rel.dy);
+		notify_motion_usec(master, time, device->rel.dx, device->rel.dy);
 		device->rel.dx = 0;
 		device->rel.dy = 0;
 		break;
-	case EVDEV_ABSOLUTE_MT_DOWN:
-		if (device->output == NULL)
-			break;
-		weston_output_transform_coordinate(device->output,
-						   wl_fixed_from_int(device->mt.slots[slot].x),
-						   wl_fixed_from_int(device->mt.slots[slot].y),
-						   &x, &y);
-		seat_slot = ffs(~master->slot_map) - 1;
-		device->mt.slots[slot].seat_slot = seat_slot;
-		master->slot_map |= 1 << seat_slot;
-
-		notify_touch(master, time, seat_slot, x, y, WL_TOUCH_DOWN);
-		break;
-	case EVDEV_ABSOLUTE_MT_MOTION:
-		if (device->output == NULL)
-			break;
-		weston_output_transform_coordinate(device->output,
-						   wl_fixed_from_int(device->mt.slots[slot].x),
-						   wl_fixed_from_int(device->mt.slots[slot].y),
-						   &x, &y);
-		seat_slot = device->mt.slots[slot].seat_slot;
-		notify_touch(master, time, seat_slot, x, y, WL_TOUCH_MOTION);
-		break;
-	case EVDEV_ABSOLUTE_MT_UP:
-		seat_slot = device->mt.slots[slot].seat_slot;
-		master->slot_map &= ~(1 << seat_slot);
-		notify_touch(master, time, seat_slot, 0, 0, WL_TOUCH_UP);
-		break;
 	case EVDEV_ABSOLUTE_TOUCH_DOWN:
 		if (device->output == NULL)
 			break;
@@ -140,7 +168,9 @@ evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
 		seat_slot = ffs(~master->slot_map) - 1;
 		device->abs.seat_slot = seat_slot;
 		master->slot_map |= 1 << seat_slot;
-		notify_touch(master, time, seat_slot, x, y, WL_TOUCH_DOWN);
+		notify_touch(master, time / 1000, seat_slot, x, y,
+			     WL_TOUCH_DOWN);
+		device->touch_frame_pending = 1;
 		break;
 	case EVDEV_ABSOLUTE_MOTION:
 		if (device->output == NULL)
@@ -151,16 +181,18 @@ evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
 						   wl_fixed_from_int(cy),
 						   &x, &y);
 
-		if (device->seat_caps & EVDEV_SEAT_TOUCH)
-			notify_touch(master, time, device->abs.seat_slot,
+		if (device->seat_caps & EVDEV_SEAT_TOUCH) {
+			notify_touch(master, time / 1000, device->abs.seat_slot,
 				     x, y, WL_TOUCH_MOTION);
-		else if (device->seat_caps & EVDEV_SEAT_POINTER)
-			notify_motion_absolute(master, time, x, y);
+			device->touch_frame_pending = 1;
+		} else if (device->seat_caps & EVDEV_SEAT_POINTER)
+			notify_motion_absolute_usec(master, time, x, y);
 		break;
 	case EVDEV_ABSOLUTE_TOUCH_UP:
 		seat_slot = device->abs.seat_slot;
 		master->slot_map &= ~(1 << seat_slot);
-		notify_touch(master, time, seat_slot, 0, 0, WL_TOUCH_UP);
+		notify_touch(master, time / 1000, seat_slot, 0, 0, WL_TOUCH_UP);
+		device->touch_frame_pending = 1;
 		break;
 	default:
 		assert(0 && "Unknown pending event type");
@@ -169,8 +201,22 @@ evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
 	device->pending_event = EVDEV_NONE;
 }
 
+/* Ends the frame with a single wl_touch.frame for all slots that
+ * changed in it. */
 static void
-evdev_process_touch_button(struct evdev_device *device, int time, int value)
+evdev_flush_touch_frame(struct evdev_device *device, uint64_t time)
+{
+	evdev_flush_touch_slots(device, time);
+
+	if (device->touch_frame_pending) {
+		notify_touch_frame(device->seat);
+		device->touch_frame_pending = 0;
+	}
+}
+
+static void
+evdev_process_touch_button(struct evdev_device *device, uint64_t time,
+			   int value)
 {
 	if (device->pending_event != EVDEV_NONE &&
 	    device->pending_event != EVDEV_ABSOLUTE_MOTION)
@@ -182,7 +228,8 @@ evdev_process_touch_button(struct evdev_device *device, int time, int value)
 }
 
 static inline void
-evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
+evdev_process_key(struct evdev_device *device, struct input_event *e,
+		  uint64_t time)
 {
 	/* ignore kernel key repeat */
 	if (e->value == 2)
@@ -205,18 +252,18 @@ evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
 	case BTN_FORWARD:
 	case BTN_BACK:
 	case BTN_TASK:
-		notify_button(device->seat,
-			      time, e->code,
-			      e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-					 WL_POINTER_BUTTON_STATE_RELEASED);
+		notify_button_usec(device->seat,
+				   time, e->code,
+				   e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+					      WL_POINTER_BUTTON_STATE_RELEASED);
 		break;
 
 	default:
-		notify_key(device->seat,
-			   time, e->code,
-			   e->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
-				      WL_KEYBOARD_KEY_STATE_RELEASED,
-			   STATE_UPDATE_AUTOMATIC);
+		notify_key_usec(device->seat,
+				time, e->code,
+				e->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
+					   WL_KEYBOARD_KEY_STATE_RELEASED,
+				STATE_UPDATE_AUTOMATIC);
 		break;
 	}
 }
@@ -224,43 +271,55 @@ evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
 static void
 evdev_process_touch(struct evdev_device *device,
 		    struct input_event *e,
-		    uint32_t time)
+		    uint64_t time)
 {
 	int screen_width, screen_height;
+	int slot = device->mt.slot;
+	enum evdev_event_type *pending;
 
 	if (device->output == NULL)
 		return;
 
+	if (e->code == ABS_MT_SLOT) {
+		device->mt.slot = e->value;
+		return;
+	}
+
+	if (slot < 0 || slot >= MAX_SLOTS)
+		return;
+
 	screen_width = device->output->current_mode->width;
 	screen_height = device->output->current_mode->height;
+	pending = &device->mt.slots[slot].pending_event;
 
 	switch (e->code) {
-	case ABS_MT_SLOT:
-		evdev_flush_pending_event(device, time);
-		device->mt.slot = e->value;
-		break;
 	case ABS_MT_TRACKING_ID:
-		if (device->pending_event != EVDEV_NONE &&
-		    device->pending_event != EVDEV_ABSOLUTE_MT_MOTION)
-			evdev_flush_pending_event(device, time);
+		/* A slot going up and down again within one frame needs
+		 * both sent, in order. */
+		if (*pending == EVDEV_ABSOLUTE_MT_DOWN ||
+		    *pending == EVDEV_ABSOLUTE_MT_UP)
+			evdev_flush_touch_slots(device, time);
 		if (e->value >= 0)
-			device->pending_event = EVDEV_ABSOLUTE_MT_DOWN;
+			*pending = EVDEV_ABSOLUTE_MT_DOWN;
 		else
-			device->pending_event = EVDEV_ABSOLUTE_MT_UP;
+			*pending = EVDEV_ABSOLUTE_MT_UP;
+		device->mt.pending_slots |= 1 << slot;
 		break;
 	case ABS_MT_POSITION_X:
-		device->mt.slots[device->mt.slot].x =
+		device->mt.slots[slot].x =
 			(e->value - device->abs.min_x) * screen_width /
 			(device->abs.max_x - device->abs.min_x);
-		if (device->pending_event == EVDEV_NONE)
-			device->pending_event = EVDEV_ABSOLUTE_MT_MOTION;
+		if (*pending == EVDEV_NONE)
+			*pending = EVDEV_ABSOLUTE_MT_MOTION;
+		device->mt.pending_slots |= 1 << slot;
 		break;
 	case ABS_MT_POSITION_Y:
-		device->mt.slots[device->mt.slot].y =
+		device->mt.slots[slot].y =
 			(e->value - device->abs.min_y) * screen_height /
 			(device->abs.max_y - device->abs.min_y);
-		if (device->pending_event == EVDEV_NONE)
-			device->pending_event = EVDEV_ABSOLUTE_MT_MOTION;
+		if (*pending == EVDEV_NONE)
+			*pending = EVDEV_ABSOLUTE_MT_MOTION;
+		device->mt.pending_slots |= 1 << slot;
 		break;
 	}
 }
@@ -297,7 +356,7 @@ evdev_process_absolute_motion(struct evdev_device *device,
 
 static inline void
 evdev_process_relative(struct evdev_device *device,
-		       struct input_event *e, uint32_t time)
+		       struct input_event *e, uint64_t time)
 {
 	switch (e->code) {
 	case REL_X:
@@ -320,7 +379,7 @@ evdev_process_relative(struct evdev_device *device,
 		case 1:
 			/* Scroll up */
 			notify_axis(device->seat,
-				    time,
+				    time / 1000,
 				    WL_POINTER_AXIS_VERTICAL_SCROLL,
 				    -1 * e->value * DEFAULT_AXIS_STEP_DISTANCE);
 			break;
@@ -336,7 +395,7 @@ evdev_process_relative(struct evdev_device *device,
 		case 1:
 			/* Scroll right */
 			notify_axis(device->seat,
-				    time,
+				    time / 1000,
 				    WL_POINTER_AXIS_HORIZONTAL_SCROLL,
 				    e->value * DEFAULT_AXIS_STEP_DISTANCE);
 			break;
@@ -350,7 +409,7 @@ evdev_process_relative(struct evdev_device *device,
 static inline void
 evdev_process_absolute(struct evdev_device *device,
 		       struct input_event *e,
-		       uint32_t time)
+		       uint64_t time)
 {
 	if (device->is_mt) {
 		evdev_process_touch(device, e, time);
@@ -363,7 +422,7 @@ static void
 fallback_process(struct evdev_dispatch *dispatch,
 		 struct evdev_device *device,
 		 struct input_event *event,
-		 uint32_t time)
+		 uint64_t time)
 {
 	switch (event->type) {
 	case EV_REL:
@@ -377,6 +436,7 @@ fallback_process(struct evdev_dispatch *dispatch,
 		break;
 	case EV_SYN:
 		evdev_flush_pending_event(device, time);
+		evdev_flush_touch_frame(device, time);
 		break;
 	}
 }
@@ -404,23 +464,96 @@ fallback_dispatch_create(void)
 	return dispatch;
 }
 
+int
+evdev_record_open(const char *filename)
+{
+	struct input_record_header header;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		weston_log("failed to open input recording %s: %m\n",
+			   filename);
+		return -1;
+	}
+
+	header.magic = INPUT_RECORD_MAGIC;
+	header.version = INPUT_RECORD_VERSION;
+	if (write(fd, &header, sizeof header) != sizeof header) {
+		weston_log("failed to write input recording: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	weston_log("recording input to %s\n", filename);
+
+	return fd;
+}
+
 static void
+evdev_record_events(struct evdev_device *device,
+		    struct input_event *ev, int count)
+{
+	struct input_record records[32];
+	int i, n;
+	ssize_t size;
+
+	while (count > 0) {
+		n = count < (int) ARRAY_LENGTH(records) ?
+			count : (int) ARRAY_LENGTH(records);
+		memset(records, 0, n * sizeof records[0]);
+		for (i = 0; i < n; i++) {
+			records[i].time = (uint64_t) ev[i].time.tv_sec *
+				1000000 + ev[i].time.tv_usec;
+			records[i].device = device->record_id;
+			records[i].type = ev[i].type;
+			records[i].code = ev[i].code;
+			records[i].value = ev[i].value;
+		}
+
+		size = n * sizeof records[0];
+		if (write(device->record_fd, records, size) != size) {
+			weston_log("failed to record input, stopping: %m\n");
+			device->record_fd = -1;
+			return;
+		}
+
+		ev += n;
+		count -= n;
+	}
+}
+
+void
 evdev_process_events(struct evdev_device *device,
 		     struct input_event *ev, int count)
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
 	struct input_event *e, *end;
-	uint32_t time = 0;
+	uint64_t time;
+
+	if (device->record_fd >= 0)
+		evdev_record_events(device, ev, count);
 
 	e = ev;
 	end = e + count;
 	for (e = ev; e < end; e++) {
-		time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		time = (uint64_t) e->time.tv_sec * 1000000 + e->time.tv_usec;
 
 		dispatch->interface->process(dispatch, device, e, time);
 	}
 }
 
+int
+evdev_device_read(struct evdev_device *device,
+		  struct input_event *ev, int count)
+{
+	if (device->mtdev)
+		return mtdev_get(device->mtdev, device->fd, ev, count) *
+			sizeof (struct input_event);
+	else
+		return read(device->fd, ev, count * sizeof *ev);
+}
+
 static int
 evdev_device_data(int fd, uint32_t mask, void *data)
 {
@@ -437,12 +570,7 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 	 * per frame and we have to process all the events available on the
 	 * fd, otherwise there will be input lag. */
 	do {
-		if (device->mtdev)
-			len = mtdev_get(device->mtdev, fd, ev,
-					ARRAY_LENGTH(ev)) *
-				sizeof (struct input_event);
-		else
-			len = read(fd, &ev, sizeof ev);
+		len = evdev_device_read(device, ev, ARRAY_LENGTH(ev));
 
 		if (len < 0 || len % sizeof ev[0] != 0) {
 			if (len < 0 && errno != EAGAIN && errno != EINTR) {
@@ -647,6 +775,7 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	device->rel.dy = 0;
 	device->dispatch = NULL;
 	device->fd = device_fd;
+	device->record_fd = -1;
 	device->pending_event = EVDEV_NONE;
 	wl_list_init(&device->link);
 
@@ -686,6 +815,10 @@ evdev_device_destroy(struct evdev_device *device)
 {
 	struct evdev_dispatch *dispatch;
 
+	/* Dispatches what the input thread already read from the device. */
+	if (device->input_thread)
+		evdev_input_thread_remove_device(device);
+
 	if (device->seat_caps & EVDEV_SEAT_POINTER)
 		weston_seat_release_pointer(device->seat);
 	if (device->seat_caps & EVDEV_SEAT_KEYBOARD)
@@ -72,7 +72,9 @@ struct evdev_device {
 		struct {
 			int32_t x, y;
 			uint32_t seat_slot;
+			enum evdev_event_type pending_event;
 		} slots[MAX_SLOTS];
+		uint32_t pending_slots;
 	} mt;
 	struct mtdev *mtdev;
 
@@ -83,7 +85,20 @@ struct evdev_device {
 	enum evdev_event_type pending_event;
 	enum evdev_device_seat_capability seat_caps;
 
+	/* Touch events were sent since the last SYN_REPORT. */
+	int touch_frame_pending;
+
 	int is_mt;
+
+	/* Set while the device is read by an evdev_input_thread rather
+	 * than from the compositor's input loop. */
+	struct evdev_input_thread *input_thread;
+	struct wl_list input_thread_link;
+	uint32_t input_thread_id;
+
+	/* Raw events are appended to record_fd when it is not -1. */
+	int record_fd;
+	uint32_t record_id;
 };
 
 /* copied from udev/extras/input_id/input_id.c */
@@ -101,11 +116,12 @@ struct evdev_device {
 struct evdev_dispatch;
 
 struct evdev_dispatch_interface {
-	/* Process an evdev input event. */
+	/* Process an evdev input event.  time is the kernel timestamp of
+	 * the event, in microseconds. */
 	void (*process)(struct evdev_dispatch *dispatch,
 			struct evdev_device *device,
 			struct input_event *event,
-			uint32_t time);
+			uint64_t time);
 
 	/* Destroy an event dispatch handler and free all its resources. */
 	void (*destroy)(struct evdev_dispatch *dispatch);
@@ -134,4 +150,28 @@ void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices);
 
+int
+evdev_device_read(struct evdev_device *device,
+		  struct input_event *ev, int count);
+
+void
+evdev_process_events(struct evdev_device *device,
+		     struct input_event *ev, int count);
+
+int
+evdev_record_open(const char *filename);
+
+struct evdev_input_thread *
+evdev_input_thread_create(struct weston_compositor *compositor);
+
+void
+evdev_input_thread_destroy(struct evdev_input_thread *thread);
+
+int
+evdev_input_thread_add_device(struct evdev_input_thread *thread,
+			      struct evdev_device *device);
+
+void
+evdev_input_thread_remove_device(struct evdev_device *device);
+
 #endif /* EVDEV_H */
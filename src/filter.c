@@ -35,7 +35,7 @@
 void
 weston_filter_dispatch(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
-		       void *data, uint32_t time)
+		       void *data, uint64_t time)
 {
 	filter->interface->filter(filter, motion, data, time);
 }
@@ -45,13 +45,13 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
  */
 
 #define MAX_VELOCITY_DIFF	1.0
-#define MOTION_TIMEOUT		300 /* (ms) */
+#define MOTION_TIMEOUT		300000 /* (us) */
 #define NUM_POINTER_TRACKERS	16
 
 struct pointer_tracker {
 	double dx;
 	double dy;
-	uint32_t time;
+	uint64_t time;
 	int dir;
 };
 
@@ -131,7 +131,7 @@ get_direction(int dx, int dy)
 static void
 feed_trackers(struct pointer_accelerator *accel,
 	      double dx, double dy,
-	      uint32_t time)
+	      uint64_t time)
 {
 	int i, current;
 	struct pointer_tracker *trackers = accel->trackers;
@@ -160,7 +160,7 @@ tracker_by_offset(struct pointer_accelerator *accel, unsigned int offset)
 }
 
 static double
-calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
+calculate_tracker_velocity(struct pointer_tracker *tracker, uint64_t time)
 {
 	int dx;
 	int dy;
@@ -169,11 +169,11 @@ calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
 	dx = tracker->dx;
 	dy = tracker->dy;
 	distance = sqrt(dx*dx + dy*dy);
-	return distance / (double)(time - tracker->time);
+	return distance * 1000.0 / (double)(time - tracker->time);
 }
 
 static double
-calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
+calculate_velocity(struct pointer_accelerator *accel, uint64_t time)
 {
 	struct pointer_tracker *tracker;
 	double velocity;
@@ -227,14 +227,14 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 
 static double
 acceleration_profile(struct pointer_accelerator *accel,
-		     void *data, double velocity, uint32_t time)
+		     void *data, double velocity, uint64_t time)
 {
 	return accel->profile(&accel->base, data, velocity, time);
 }
 
 static double
 calculate_acceleration(struct pointer_accelerator *accel,
-		       void *data, double velocity, uint32_t time)
+		       void *data, double velocity, uint64_t time)
 {
 	double factor;
 
@@ -276,7 +276,7 @@ apply_softening(struct pointer_accelerator *accel,
 static void
 accelerator_filter(struct weston_motion_filter *filter,
 		   struct weston_motion_params *motion,
-		   void *data, uint32_t time)
+		   void *data, uint64_t time)
 {
 	struct pointer_accelerator *accel =
 		(struct pointer_accelerator *) filter;
@@ -335,3 +335,157 @@ create_pointer_accelator_filter(accel_profile_func_t profile)
 
 	return &filter->base;
 }
+
+/*
+ * Curve acceleration filter
+ *
+ * Does the same as the pointer acceleration filter without walking the
+ * trackers and calling the profile for every event.  The profile is
+ * sampled once into a table which is interpolated, and the velocity is
+ * kept as running sums of distance and time, decayed so that older
+ * motion counts less.  Like the trackers, the sums start over when the
+ * direction or speed changes or the motion stops for a while.
+ */
+
+#define CURVE_POINTS		256
+#define VELOCITY_WINDOW		16000 /* (us) */
+
+struct curve_accelerator {
+	struct weston_motion_filter base;
+
+	double curve[CURVE_POINTS + 1];
+	double points_per_velocity;
+
+	double distance;
+	double duration;
+	uint64_t last_time;
+	int dir;
+
+	double last_velocity;
+	int last_dx;
+	int last_dy;
+};
+
+static double
+curve_lookup(struct curve_accelerator *accel, double velocity)
+{
+	double pos = velocity * accel->points_per_velocity;
+	int i;
+
+	if (pos >= CURVE_POINTS)
+		return accel->curve[CURVE_POINTS];
+
+	i = (int) pos;
+
+	return accel->curve[i] +
+		(accel->curve[i + 1] - accel->curve[i]) * (pos - i);
+}
+
+static double
+curve_update_velocity(struct curve_accelerator *accel,
+		      double dx, double dy, uint64_t time)
+{
+	double distance, decay, velocity;
+	uint64_t dt;
+	int dir;
+
+	distance = sqrt(dx*dx + dy*dy);
+	dir = get_direction(dx, dy);
+	dt = time > accel->last_time ? time - accel->last_time : 0;
+	accel->last_time = time;
+
+	/* Several events with one timestamp add up to one motion. */
+	if (dt == 0) {
+		accel->distance += distance;
+		accel->dir &= dir;
+		goto out;
+	}
+
+	if (dt > MOTION_TIMEOUT)
+		dt = MOTION_TIMEOUT;
+
+	velocity = distance * 1000.0 / dt;
+	if ((accel->dir & dir) == 0 || accel->duration == 0.0 ||
+	    dt == MOTION_TIMEOUT ||
+	    fabs(velocity - accel->distance * 1000.0 / accel->duration) >
+	    MAX_VELOCITY_DIFF) {
+		accel->distance = distance;
+		accel->duration = dt;
+		accel->dir = dir;
+	} else {
+		decay = (double) VELOCITY_WINDOW / (VELOCITY_WINDOW + dt);
+		accel->distance = accel->distance * decay + distance;
+		accel->duration = accel->duration * decay + dt;
+		accel->dir &= dir;
+	}
+
+out:
+	if (accel->duration == 0.0)
+		return 0.0;
+
+	return accel->distance * 1000.0 / accel->duration;
+}
+
+static void
+curve_accelerator_filter(struct weston_motion_filter *filter,
+			 struct weston_motion_params *motion,
+			 void *data, uint64_t time)
+{
+	struct curve_accelerator *accel =
+		(struct curve_accelerator *) filter;
+	double velocity;
+	double factor;
+
+	velocity = curve_update_velocity(accel, motion->dx, motion->dy, time);
+
+	/* Simpson's rule, as in calculate_acceleration(). */
+	factor = curve_lookup(accel, velocity);
+	factor += curve_lookup(accel, accel->last_velocity);
+	factor += 4.0 *
+		curve_lookup(accel, (accel->last_velocity + velocity) / 2);
+	factor = factor / 6.0;
+
+	motion->dx = soften_delta(accel->last_dx, factor * motion->dx);
+	motion->dy = soften_delta(accel->last_dy, factor * motion->dy);
+
+	accel->last_dx = motion->dx;
+	accel->last_dy = motion->dy;
+
+	accel->last_velocity = velocity;
+}
+
+static void
+curve_accelerator_destroy(struct weston_motion_filter *filter)
+{
+	free(filter);
+}
+
+struct weston_motion_filter_interface curve_accelerator_interface = {
+	curve_accelerator_filter,
+	curve_accelerator_destroy
+};
+
+struct weston_motion_filter *
+create_pointer_accelator_curve_filter(accel_profile_func_t profile,
+				      void *data, double max_velocity)
+{
+	struct curve_accelerator *filter;
+	int i;
+
+	if (!(max_velocity > 0.0))
+		return NULL;
+
+	filter = calloc(1, sizeof *filter);
+	if (filter == NULL)
+		return NULL;
+
+	filter->base.interface = &curve_accelerator_interface;
+
+	for (i = 0; i <= CURVE_POINTS; i++)
+		filter->curve[i] = profile(&filter->base, data,
+					   max_velocity * i / CURVE_POINTS,
+					   0);
+	filter->points_per_velocity = CURVE_POINTS / max_velocity;
+
+	return &filter->base;
+}
@@ -35,16 +35,19 @@ struct weston_motion_params {
 
 struct weston_motion_filter;
 
+/* Filter times are event timestamps in microseconds, velocities are in
+ * device units per millisecond. */
+
 WL_EXPORT void
 weston_filter_dispatch(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
-		       void *data, uint32_t time);
+		       void *data, uint64_t time);
 
 
 struct weston_motion_filter_interface {
 	void (*filter)(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
-		       void *data, uint32_t time);
+		       void *data, uint64_t time);
 	void (*destroy)(struct weston_motion_filter *filter);
 };
 
@@ -58,9 +61,16 @@ create_linear_acceleration_filter(double speed);
 typedef double (*accel_profile_func_t)(struct weston_motion_filter *filter,
 				       void *data,
 				       double velocity,
-				       uint32_t time);
+				       uint64_t time);
 
 WL_EXPORT struct weston_motion_filter *
 create_pointer_accelator_filter(accel_profile_func_t filter);
 
+/* Like the above, but the profile is sampled up to max_velocity when the
+ * filter is created and is constant beyond it, so it must only depend on
+ * the velocity and data. */
+WL_EXPORT struct weston_motion_filter *
+create_pointer_accelator_curve_filter(accel_profile_func_t profile,
+				      void *data, double max_velocity);
+
 #endif // _FILTER_H_
@@ -47,6 +47,7 @@
 #include <GLES2/gl2ext.h>
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
@@ -55,6 +56,7 @@
 
 #include "gl-renderer.h"
 #include "vertex-clipping.h"
+#include "damage-heatmap.h"
 
 #include <EGL/eglext.h>
 #include "weston-egl-ext.h"
@@ -119,8 +121,15 @@ struct gl_border_image {
 	void *data;
 };
 
+typedef void *(*gl_map_buffer_range_func_t)(GLenum target, GLintptr offset,
+					    GLsizeiptr length,
+					    GLbitfield access);
+typedef GLboolean (*gl_unmap_buffer_func_t)(GLenum target);
+
 struct gl_output_state {
 	EGLSurface egl_surface;
+	struct wl_list readback_list;
+	struct wl_event_source *readback_timer;
 	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
 	enum gl_border_status border_damage[BUFFER_DAMAGE_COUNT];
 	struct gl_border_image borders[4];
@@ -130,10 +139,19 @@ struct gl_output_state {
 	int indirect_drawing;
 	GLuint indirect_texture;
 	GLuint indirect_fbo;
+
+	struct damage_heatmap heatmap;
+
+	/* Counted while stats are enabled, logged about once per second. */
+	uint32_t stats_time;
+	uint32_t stats_frames;
+	uint32_t stats_fills;
+	uint32_t stats_composites;
 };
 
 enum buffer_type {
 	BUFFER_TYPE_NULL,
+	BUFFER_TYPE_SOLID, /* no buffer, just a colour */
 	BUFFER_TYPE_SHM,
 	BUFFER_TYPE_EGL
 };
@@ -169,6 +187,9 @@ struct gl_surface_state {
 
 	struct weston_surface *surface;
 
+	/* Damage accumulated for the heat map report, in pixels. */
+	uint64_t damage_area;
+
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
@@ -180,6 +201,15 @@ struct gl_renderer {
 	struct weston_binding *fragment_binding;
 	struct weston_binding *fan_binding;
 
+	int stats_debug;
+	struct weston_binding *stats_binding;
+	uint32_t frame_fills;
+	uint32_t frame_composites;
+
+	int heatmap_debug;
+	struct weston_binding *heatmap_binding;
+	uint32_t heatmap_report_time;
+
 	EGLDisplay egl_display;
 	EGLContext egl_context;
 	EGLConfig egl_config;
@@ -220,6 +250,17 @@ struct gl_renderer {
 
 	int has_image_srgb;
 
+	int has_pbo;
+	gl_map_buffer_range_func_t map_buffer_range;
+	gl_unmap_buffer_func_t unmap_buffer;
+
+#ifdef EGL_KHR_fence_sync
+	int has_fence_sync;
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+#endif
+
 	struct gl_shader *solid_shader;
 	struct gl_shader *current_shader;
 
@@ -59,6 +59,8 @@ gl_renderer_print_egl_error_state(void)
 		egl_error_string(code), (long)code);
 }
 
+#define STATS_INTERVAL_MS 1000
+
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 #define min(a, b) (((a) > (b)) ? (b) : (a))
 
@@ -323,6 +325,7 @@ repaint_view(struct weston_view *ev, pixman_region32_t *region,
 	 */
 	int nfans = texture_region(ev, region, surf_region);
 
+	get_renderer(ev->surface->compositor)->frame_composites++;
 	repaint_region(ev->surface->compositor, ev, nfans);
 }
 
@@ -459,12 +462,52 @@ repaint_views_finish(struct weston_output *output,
 	}
 }
 
+/* Opaque solid colour views are drawn by clearing the damaged
+ * rectangles, which skips the shaders and blending altogether. */
+static void
+clear_region(struct weston_view *ev, struct weston_output *output,
+	     pixman_region32_t *region) /* in global coordinates */
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	pixman_region32_t fb_region;
+	pixman_box32_t *rects;
+	int i, nrects, x, y;
+
+	pixman_region32_init(&fb_region);
+	pixman_region32_copy(&fb_region, region);
+	pixman_region32_translate(&fb_region, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				  output->transform, output->current_scale,
+				  &fb_region, &fb_region);
+
+	glClearColor(gs->color[0], gs->color[1], gs->color[2], 1.0);
+	glEnable(GL_SCISSOR_TEST);
+
+	rects = pixman_region32_rectangles(&fb_region, &nrects);
+	for (i = 0; i < nrects; i++) {
+		x = go->borders[GL_RENDERER_BORDER_LEFT].width + rects[i].x1;
+		y = go->borders[GL_RENDERER_BORDER_BOTTOM].height +
+		    output->current_mode->height - rects[i].y2;
+		glScissor(x, y, rects[i].x2 - rects[i].x1,
+			  rects[i].y2 - rects[i].y1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+
+	glDisable(GL_SCISSOR_TEST);
+	gr->frame_fills++;
+
+	pixman_region32_fini(&fb_region);
+}
+
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_output_state *go = get_output_state(output);
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct gl_shader *shader;
 	/* repaint bounding region in global coordinates: */
@@ -489,6 +532,19 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
+	/* The indirect buffer holds linear colour, so let the shaders
+	 * do the conversion there, and the debug tint too.  Scissored
+	 * clears only cover views that are still axis-aligned
+	 * rectangles. */
+	if (gs->buffer_type == BUFFER_TYPE_SOLID && gs->color[3] == 1.0 &&
+	    ev->alpha == 1.0 && !gr->fan_debug &&
+	    !gr->fragment_shader_debug && !go->indirect_drawing &&
+	    (!ev->transform.enabled ||
+	     ev->transform.matrix.type == WESTON_MATRIX_TRANSFORM_TRANSLATE)) {
+		clear_region(ev, output, &repaint);
+		goto out;
+	}
+
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
 	if (gr->fan_debug) {
@@ -821,6 +877,81 @@ output_rotate_damage(struct weston_output *output,
 	pixman_region32_copy(&go->buffer_damage[0], output_damage);
 }
 
+static void
+stats_report(struct weston_output *output, int force)
+{
+	struct gl_output_state *go = get_output_state(output);
+	uint32_t now, elapsed;
+
+	now = weston_compositor_get_time();
+	elapsed = now - go->stats_time;
+	if (!force && elapsed < STATS_INTERVAL_MS)
+		return;
+
+	if (go->stats_frames > 0)
+		weston_log("gl: output %s: %u frames in %u ms, "
+			   "%u fills, %u composites\n",
+			   output->name ? output->name : "unnamed",
+			   go->stats_frames, elapsed,
+			   go->stats_fills, go->stats_composites);
+
+	go->stats_time = now;
+	go->stats_frames = 0;
+	go->stats_fills = 0;
+	go->stats_composites = 0;
+}
+
+static void
+draw_heatmap(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	pixman_box32_t box;
+	GLfloat color[4], verts[8];
+	int tx, ty;
+
+	gl_use_shader(gr, gr->solid_shader);
+	gl_shader_set_matrix(gr->solid_shader, &output->matrix);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_BLEND);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glEnableVertexAttribArray(0);
+
+	for (ty = 0; ty < go->heatmap.height; ty++) {
+		for (tx = 0; tx < go->heatmap.width; tx++) {
+			if (!damage_heatmap_tile(&go->heatmap, tx, ty,
+						 &box, color))
+				continue;
+
+			verts[0] = box.x1; verts[1] = box.y1;
+			verts[2] = box.x2; verts[3] = box.y1;
+			verts[4] = box.x2; verts[5] = box.y2;
+			verts[6] = box.x1; verts[7] = box.y2;
+
+			glUniform4fv(gr->solid_shader->color_uniform, 1, color);
+			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		}
+	}
+
+	glDisableVertexAttribArray(0);
+}
+
+static uint64_t
+take_damage_area(struct weston_surface *surface)
+{
+	struct gl_surface_state *gs = get_surface_state(surface);
+	uint64_t area = gs->damage_area;
+
+	gs->damage_area = 0;
+
+	return area;
+}
+
+static void
+output_finish_readbacks(struct weston_output *output, int wait);
+
 static void
 gl_renderer_repaint_output(struct weston_output *output,
 			      pixman_region32_t *output_damage)
@@ -838,6 +969,22 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_t buffer_damage, total_damage;
 	enum gl_border_status border_damage = BORDER_STATUS_CLEAN;
 
+	gr->frame_fills = 0;
+	gr->frame_composites = 0;
+
+	if (gr->heatmap_debug && !go->heatmap.history)
+		damage_heatmap_init(&go->heatmap, output->x, output->y,
+				    output->width, output->height);
+
+	if (go->heatmap.history) {
+		damage_heatmap_add_frame(&go->heatmap, output_damage);
+
+		/* The overlay covers the whole output, so have it all
+		 * repainted and swapped. */
+		pixman_region32_union(output_damage, output_damage,
+				      &output->region);
+	}
+
 	/* Calculate the viewport */
 	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
 		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
@@ -847,6 +994,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
+	output_finish_readbacks(output, 0);
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -875,8 +1024,21 @@ gl_renderer_repaint_output(struct weston_output *output,
 	pixman_region32_fini(&total_damage);
 	pixman_region32_fini(&buffer_damage);
 
+	if (go->heatmap.history) {
+		draw_heatmap(output);
+		damage_heatmap_report_surfaces(&gr->heatmap_report_time,
+					       compositor, take_damage_area);
+	}
+
 	draw_output_borders(output, border_damage);
 
+	if (gr->stats_debug) {
+		go->stats_fills += gr->frame_fills;
+		go->stats_composites += gr->frame_composites;
+		go->stats_frames++;
+		stats_report(output, 0);
+	}
+
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
 
@@ -931,6 +1093,22 @@ gl_renderer_repaint_output(struct weston_output *output,
 	go->border_status = BORDER_STATUS_CLEAN;
 }
 
+static int
+read_format_to_gl(struct gl_renderer *gr, pixman_format_code_t format,
+		  GLenum *gl_format)
+{
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		*gl_format = gr->bgra_format;
+		return 0;
+	case PIXMAN_a8b8g8r8:
+		*gl_format = GL_RGBA;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
 static int
 gl_renderer_read_pixels(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
@@ -944,16 +1122,8 @@ gl_renderer_read_pixels(struct weston_output *output,
 	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
 	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
 
-	switch (format) {
-	case PIXMAN_a8r8g8b8:
-		gl_format = gr->bgra_format;
-		break;
-	case PIXMAN_a8b8g8r8:
-		gl_format = GL_RGBA;
-		break;
-	default:
+	if (read_format_to_gl(gr, format, &gl_format) < 0)
 		return -1;
-	}
 
 	if (use_output(output) < 0)
 		return -1;
@@ -965,6 +1135,163 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+struct gl_readback {
+	struct wl_list link;
+	GLuint pbo;
+#ifdef EGL_KHR_fence_sync
+	EGLSyncKHR sync;
+#endif
+	int stride, size;
+	weston_read_pixels_done_func_t done;
+	void *data;
+};
+
+/* How often reads that are still in flight get polled, in ms */
+#define READBACK_POLL_INTERVAL 4
+
+/* The read goes into a pixel buffer object, so glReadPixels() returns
+ * without waiting for the GPU.  The buffer is mapped and handed to the
+ * caller from a later repaint or poll, once the fence says it has
+ * landed. */
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_done_func_t done, void *data)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
+	GLenum gl_format;
+
+	if (!gr->has_pbo)
+		return -1;
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	if (read_format_to_gl(gr, format, &gl_format) < 0)
+		return -1;
+
+	if (use_output(output) < 0)
+		return -1;
+
+	rb = zalloc(sizeof *rb);
+	if (rb == NULL)
+		return -1;
+
+	rb->stride = width * 4;
+	rb->size = rb->stride * height;
+	rb->done = done;
+	rb->data = data;
+
+	glGenBuffers(1, &rb->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, rb->size, NULL, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+#ifdef EGL_KHR_fence_sync
+	rb->sync = EGL_NO_SYNC_KHR;
+	if (gr->has_fence_sync)
+		rb->sync = gr->create_sync(gr->egl_display,
+					   EGL_SYNC_FENCE_KHR, NULL);
+#endif
+	glFlush();
+
+	wl_list_insert(go->readback_list.prev, &rb->link);
+	wl_event_source_timer_update(go->readback_timer,
+				     READBACK_POLL_INTERVAL);
+
+	return 0;
+}
+
+static int
+readback_ready(struct gl_renderer *gr, struct gl_readback *rb)
+{
+#ifdef EGL_KHR_fence_sync
+	if (rb->sync != EGL_NO_SYNC_KHR)
+		return gr->client_wait_sync(gr->egl_display, rb->sync,
+					    0, 0) != EGL_TIMEOUT_EXPIRED_KHR;
+#endif
+
+	/* Without a fence, a repaint since the read was queued is the
+	 * best guess, and mapping the buffer waits for it anyway. */
+	return 1;
+}
+
+static void
+readback_finish(struct gl_renderer *gr, struct gl_readback *rb)
+{
+	void *pixels;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	pixels = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, rb->size,
+				      GL_MAP_READ_BIT);
+	rb->done(rb->data, pixels, rb->stride);
+	if (pixels)
+		gr->unmap_buffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteBuffers(1, &rb->pbo);
+
+#ifdef EGL_KHR_fence_sync
+	if (rb->sync != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, rb->sync);
+#endif
+
+	wl_list_remove(&rb->link);
+	free(rb);
+}
+
+/* Deliver finished reads in the order they were queued.  Reads that are
+ * still in flight get polled again from the readback timer, so an idle
+ * output does not have to keep repainting for them. */
+static void
+output_finish_readbacks(struct weston_output *output, int wait)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb, *next;
+
+	wl_list_for_each_safe(rb, next, &go->readback_list, link) {
+		if (!wait && !readback_ready(gr, rb))
+			break;
+		readback_finish(gr, rb);
+	}
+
+	wl_event_source_timer_update(go->readback_timer,
+				     wl_list_empty(&go->readback_list) ?
+				     0 : READBACK_POLL_INTERVAL);
+}
+
+static int
+readback_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	if (use_output(output) == 0)
+		output_finish_readbacks(output, 0);
+
+	return 0;
+}
+
+static uint32_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint32_t area = 0;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -983,6 +1310,9 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	pixman_region32_union(&gs->texture_damage,
 			      &gs->texture_damage, &surface->damage);
 
+	if (gr->heatmap_debug)
+		gs->damage_area += region_area(&surface->damage);
+
 	if (!buffer)
 		return;
 
@@ -1369,6 +1699,7 @@ gl_renderer_surface_set_color(struct weston_surface *surface,
 
 	gs->input = INPUT_SOLID;
 	gs->conversion = CONVERSION_NONE;
+	gs->buffer_type = BUFFER_TYPE_SOLID;
 }
 
 static void
@@ -1618,6 +1949,7 @@ gl_renderer_output_create(struct weston_output *output,
 	struct weston_compositor *ec = output->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_output_state *go;
+	struct wl_event_loop *loop;
 	EGLConfig egl_config;
 	int i;
 
@@ -1659,6 +1991,16 @@ gl_renderer_output_create(struct weston_output *output,
 	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
 		pixman_region32_init(&go->buffer_damage[i]);
 
+	wl_list_init(&go->readback_list);
+	loop = wl_display_get_event_loop(ec->wl_display);
+	go->readback_timer =
+		wl_event_loop_add_timer(loop, readback_timer_handler, output);
+	if (go->readback_timer == NULL) {
+		eglDestroySurface(gr->egl_display, go->egl_surface);
+		free(go);
+		return -1;
+	}
+
 	glGenFramebuffers(1, &go->indirect_fbo);
 
 	output->renderer_state = go;
@@ -1678,9 +2020,15 @@ gl_renderer_output_destroy(struct weston_output *output)
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	if (use_output(output) == 0)
+		output_finish_readbacks(output, 1);
+	wl_event_source_remove(go->readback_timer);
+
 	glDeleteTextures(1, &go->indirect_texture);
 	glDeleteFramebuffers(1, &go->indirect_fbo);
 
+	damage_heatmap_release(&go->heatmap);
+
 	eglDestroySurface(gr->egl_display, go->egl_surface);
 
 	free(go);
@@ -1719,6 +2067,10 @@ gl_renderer_destroy(struct weston_compositor *ec)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->stats_binding)
+		weston_binding_destroy(gr->stats_binding);
+	if (gr->heatmap_binding)
+		weston_binding_destroy(gr->heatmap_binding);
 
 	free(gr);
 	ec->renderer = NULL;
@@ -1775,6 +2127,18 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 		gr->has_configless_context = 1;
 #endif
 
+#ifdef EGL_KHR_fence_sync
+	if (strstr(extensions, "EGL_KHR_fence_sync")) {
+		gr->create_sync = (void *) eglGetProcAddress("eglCreateSyncKHR");
+		gr->destroy_sync =
+			(void *) eglGetProcAddress("eglDestroySyncKHR");
+		gr->client_wait_sync =
+			(void *) eglGetProcAddress("eglClientWaitSyncKHR");
+		gr->has_fence_sync = gr->create_sync && gr->destroy_sync &&
+			gr->client_wait_sync;
+	}
+#endif
+
 	return 0;
 }
 
@@ -1811,6 +2175,7 @@ gl_renderer_create(struct weston_compositor *ec, EGLNativeDisplayType display,
 		return -1;
 
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
@@ -1886,6 +2251,76 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+stats_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		    void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+	struct weston_output *output;
+
+	gr->stats_debug = !gr->stats_debug;
+
+	/* Turning stats off logs what was counted since the last report,
+	 * turning them on starts counting afresh. */
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (get_output_state(output))
+			stats_report(output, 1);
+	}
+}
+
+static void
+heatmap_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		      void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+	struct weston_output *output;
+	struct gl_output_state *go;
+
+	gr->heatmap_debug = !gr->heatmap_debug;
+
+	if (gr->heatmap_debug) {
+		gr->heatmap_report_time = weston_compositor_get_time();
+	} else {
+		wl_list_for_each(output, &compositor->output_list, link) {
+			go = get_output_state(output);
+			if (go)
+				damage_heatmap_release(&go->heatmap);
+		}
+	}
+
+	weston_compositor_damage_all(compositor);
+}
+
+/* Pixel buffer objects and glMapBufferRange() need OpenGL ES 3.0 or
+ * OpenGL 3.0, even though the context was only asked for ES 2.0. */
+static void
+setup_pbo(struct gl_renderer *gr)
+{
+	const char *version;
+	int major = 0;
+
+	version = (const char *) glGetString(GL_VERSION);
+	if (!version)
+		return;
+
+	if (sscanf(version, "OpenGL ES %d.", &major) != 1 &&
+	    sscanf(version, "%d.", &major) != 1)
+		return;
+	if (major < 3)
+		return;
+
+	gr->map_buffer_range =
+		(void *) eglGetProcAddress("glMapBufferRange");
+	gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBuffer");
+	gr->has_pbo = gr->map_buffer_range && gr->unmap_buffer;
+
+	if (gr->has_pbo)
+		weston_log("Using pixel buffer objects for asynchronous "
+			   "read back\n");
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -2003,6 +2438,8 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	setup_pbo(gr);
+
 	if (gl_init_shaders(gr) < 0)
 		return -1;
 
@@ -2014,6 +2451,14 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->stats_binding =
+		weston_compositor_add_debug_binding(ec, KEY_N,
+						    stats_debug_binding,
+						    ec);
+	gr->heatmap_binding =
+		weston_compositor_add_debug_binding(ec, KEY_H,
+						    heatmap_debug_binding,
+						    ec);
 
 	weston_log("GL renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _INPUT_RECORD_H_
+#define _INPUT_RECORD_H_
+
+#include <stdint.h>
+
+/* Input recordings, as written with the record-input option and read
+ * back by the test module's replay_input request.  A header is followed
+ * by one record per raw evdev event, in the order the compositor
+ * processed them, all in host byte order. */
+
+#define INPUT_RECORD_MAGIC	0x52495757 /* "WWIR" */
+#define INPUT_RECORD_VERSION	1
+
+struct input_record_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct input_record {
+	uint64_t time;		/* kernel timestamp, usecs */
+	uint32_t device;	/* in the order devices were added */
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+	uint32_t padding;
+};
+
+#endif /* _INPUT_RECORD_H_ */
@@ -495,6 +495,9 @@ weston_pointer_destroy(struct weston_pointer *pointer)
 
 	/* XXX: What about pointer->resource_list? */
 
+	if (pointer->motion_idle)
+		wl_event_source_remove(pointer->motion_idle);
+
 	wl_list_remove(&pointer->focus_resource_listener.link);
 	wl_list_remove(&pointer->focus_view_listener.link);
 	wl_list_remove(&pointer->output_destroy_listener.link);
@@ -868,6 +871,38 @@ weston_pointer_clamp(struct weston_pointer *pointer, wl_fixed_t *fx, wl_fixed_t
 		weston_pointer_clamp_for_output(pointer, prev, fx, fy);
 }
 
+/* Motion that only moves the sprite within the output it is shown on,
+ * while the backend shows it on a cursor plane, does not need a repaint.
+ * The sprite's transform is left dirty and brought up to date by the
+ * next repaint of the output, whatever triggers it. */
+static int
+weston_pointer_move_cursor_plane(struct weston_pointer *pointer)
+{
+	struct weston_view *sprite = pointer->sprite;
+	struct weston_output *output = sprite->output;
+	int32_t x, y;
+
+	if (output == NULL || output->move_cursor == NULL)
+		return -1;
+	if (sprite->output_mask != (1u << output->id))
+		return -1;
+	if (sprite->geometry.parent ||
+	    sprite->geometry.transformation_list.next !=
+	    &sprite->transform.position.link ||
+	    sprite->geometry.transformation_list.prev !=
+	    &sprite->transform.position.link)
+		return -1;
+
+	x = sprite->geometry.x;
+	y = sprite->geometry.y;
+	if (x < output->x || y < output->y ||
+	    x + sprite->surface->width > output->x + output->width ||
+	    y + sprite->surface->height > output->y + output->height)
+		return -1;
+
+	return output->move_cursor(output, sprite, x, y);
+}
+
 /* Takes absolute values */
 WL_EXPORT void
 weston_pointer_move(struct weston_pointer *pointer, wl_fixed_t x, wl_fixed_t y)
@@ -886,7 +921,8 @@ weston_pointer_move(struct weston_pointer *pointer, wl_fixed_t x, wl_fixed_t y)
 		weston_view_set_position(pointer->sprite,
 					 ix - pointer->hotspot_x,
 					 iy - pointer->hotspot_y);
-		weston_view_schedule_repaint(pointer->sprite);
+		if (weston_pointer_move_cursor_plane(pointer) < 0)
+			weston_view_schedule_repaint(pointer->sprite);
 	}
 
 	pointer->grab->interface->focus(pointer->grab);
@@ -937,15 +973,139 @@ weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data)
 	weston_pointer_move(pointer, fx, fy);
 }
 
+/* Grabs that want the full event time set the _usec variants of their
+ * handlers, everybody else gets milliseconds as sent to clients. */
+static void
+pointer_grab_motion(struct weston_pointer *pointer, uint64_t time,
+		    wl_fixed_t x, wl_fixed_t y)
+{
+	struct weston_pointer_grab *grab = pointer->grab;
+
+	if (grab->interface->motion_usec)
+		grab->interface->motion_usec(grab, time, x, y);
+	else
+		grab->interface->motion(grab, time / 1000, x, y);
+}
+
+static void
+pointer_grab_button(struct weston_pointer *pointer, uint64_t time,
+		    uint32_t button, uint32_t state)
+{
+	struct weston_pointer_grab *grab = pointer->grab;
+
+	if (grab->interface->button_usec)
+		grab->interface->button_usec(grab, time, button, state);
+	else
+		grab->interface->button(grab, time / 1000, button, state);
+}
+
+static void
+keyboard_grab_key(struct weston_keyboard_grab *grab, uint64_t time,
+		  uint32_t key, uint32_t state)
+{
+	if (grab->interface->key_usec)
+		grab->interface->key_usec(grab, time, key, state);
+	else
+		grab->interface->key(grab, time / 1000, key, state);
+}
+
+static void
+weston_pointer_flush_motion(struct weston_pointer *pointer)
+{
+	if (!pointer->pending_motion.active)
+		return;
+
+	pointer->pending_motion.active = 0;
+	pointer_grab_motion(pointer, pointer->pending_motion.time,
+			    pointer->pending_motion.x,
+			    pointer->pending_motion.y);
+}
+
+static void
+pointer_motion_idle(void *data)
+{
+	struct weston_pointer *pointer = data;
+
+	pointer->motion_idle = NULL;
+	weston_pointer_flush_motion(pointer);
+}
+
+/* With coalesce-motion set, motion is not passed to the grab right away
+ * but merged with the motion that follows it, up to the next event of
+ * another kind, the next repaint, or the end of the current batch of
+ * input, whichever comes first.  Grabs and clients then see one motion
+ * per batch, however high the device rate is. */
+static void
+weston_pointer_queue_motion(struct weston_pointer *pointer,
+			    uint64_t time, wl_fixed_t x, wl_fixed_t y)
+{
+	struct weston_compositor *ec = pointer->seat->compositor;
+	struct wl_event_loop *loop;
+
+	if (!ec->coalesce_motion) {
+		pointer_grab_motion(pointer, time, x, y);
+		return;
+	}
+
+	pointer->pending_motion.active = 1;
+	pointer->pending_motion.time = time;
+	pointer->pending_motion.x = x;
+	pointer->pending_motion.y = y;
+
+	if (pointer->motion_idle == NULL) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		pointer->motion_idle =
+			wl_event_loop_add_idle(loop, pointer_motion_idle,
+					       pointer);
+	}
+}
+
+/** Deliver input that is held back to be coalesced
+ *
+ * Called before any event that must not overtake pending motion, and
+ * before repainting.
+ */
 WL_EXPORT void
-notify_motion(struct weston_seat *seat,
-	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
+weston_seat_flush_input(struct weston_seat *seat)
+{
+	if (seat->pointer)
+		weston_pointer_flush_motion(seat->pointer);
+}
+
+/* The _usec variants of the notify functions take the event time in
+ * microseconds, for backends that have it, and pass it on to grabs that
+ * want it.  The others take milliseconds. */
+WL_EXPORT void
+notify_motion_usec(struct weston_seat *seat,
+		   uint64_t time, wl_fixed_t dx, wl_fixed_t dy)
 {
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
+	wl_fixed_t x, y;
 
 	weston_compositor_wake(ec);
-	pointer->grab->interface->motion(pointer->grab, time, pointer->x + dx, pointer->y + dy);
+
+	if (pointer->pending_motion.active) {
+		x = pointer->pending_motion.x + dx;
+		y = pointer->pending_motion.y + dy;
+	} else {
+		x = pointer->x + dx;
+		y = pointer->y + dy;
+	}
+
+	/* Clamped at each step, like the motion would be when passed
+	 * on one event at a time. */
+	if (ec->coalesce_motion)
+		weston_pointer_clamp(pointer, &x, &y);
+
+	weston_pointer_queue_motion(pointer, time, x, y);
+}
+
+WL_EXPORT void
+notify_motion(struct weston_seat *seat,
+	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
+{
+	notify_motion_usec(seat, (uint64_t) time * 1000, dx, dy);
 }
 
 static void
@@ -985,14 +1145,21 @@ run_modifier_bindings(struct weston_seat *seat, uint32_t old, uint32_t new)
 }
 
 WL_EXPORT void
-notify_motion_absolute(struct weston_seat *seat,
-		       uint32_t time, wl_fixed_t x, wl_fixed_t y)
+notify_motion_absolute_usec(struct weston_seat *seat,
+			    uint64_t time, wl_fixed_t x, wl_fixed_t y)
 {
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
 	weston_compositor_wake(ec);
-	pointer->grab->interface->motion(pointer->grab, time, x, y);
+	weston_pointer_queue_motion(pointer, time, x, y);
+}
+
+WL_EXPORT void
+notify_motion_absolute(struct weston_seat *seat,
+		       uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+	notify_motion_absolute_usec(seat, (uint64_t) time * 1000, x, y);
 }
 
 WL_EXPORT void
@@ -1010,17 +1177,19 @@ weston_surface_activate(struct weston_surface *surface,
 }
 
 WL_EXPORT void
-notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
-	      enum wl_pointer_button_state state)
+notify_button_usec(struct weston_seat *seat, uint64_t time, int32_t button,
+		   enum wl_pointer_button_state state)
 {
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	weston_seat_flush_input(seat);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
 			pointer->grab_button = button;
-			pointer->grab_time = time;
+			pointer->grab_time = time / 1000;
 			pointer->grab_x = pointer->x;
 			pointer->grab_y = pointer->y;
 		}
@@ -1030,16 +1199,23 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 		pointer->button_count--;
 	}
 
-	weston_compositor_run_button_binding(compositor, seat, time, button,
-					     state);
+	weston_compositor_run_button_binding(compositor, seat, time / 1000,
+					     button, state);
 
-	pointer->grab->interface->button(pointer->grab, time, button, state);
+	pointer_grab_button(pointer, time, button, state);
 
 	if (pointer->button_count == 1)
 		pointer->grab_serial =
 			wl_display_get_serial(compositor->wl_display);
 }
 
+WL_EXPORT void
+notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
+	      enum wl_pointer_button_state state)
+{
+	notify_button_usec(seat, (uint64_t) time * 1000, button, state);
+}
+
 WL_EXPORT void
 notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	    wl_fixed_t value)
@@ -1050,6 +1226,7 @@ notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	struct wl_list *resource_list;
 
 	weston_compositor_wake(compositor);
+	weston_seat_flush_input(seat);
 
 	if (!value)
 		return;
@@ -1258,19 +1435,21 @@ update_keymap(struct weston_seat *seat)
 #endif
 
 WL_EXPORT void
-notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
-	   enum wl_keyboard_key_state state,
-	   enum weston_key_state_update update_state)
+notify_key_usec(struct weston_seat *seat, uint64_t time, uint32_t key,
+		enum wl_keyboard_key_state state,
+		enum weston_key_state_update update_state)
 {
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_keyboard *keyboard = seat->keyboard;
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	weston_seat_flush_input(seat);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		keyboard->grab_key = key;
-		keyboard->grab_time = time;
+		keyboard->grab_time = time / 1000;
 	} else {
 		weston_compositor_idle_release(compositor);
 	}
@@ -1292,12 +1471,12 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 
 	if (grab == &keyboard->default_grab ||
 	    grab == &keyboard->input_method_grab) {
-		weston_compositor_run_key_binding(compositor, seat, time, key,
-						  state);
+		weston_compositor_run_key_binding(compositor, seat,
+						  time / 1000, key, state);
 		grab = keyboard->grab;
 	}
 
-	grab->interface->key(grab, time, key, state);
+	keyboard_grab_key(grab, time, key, state);
 
 	if (keyboard->pending_keymap &&
 	    keyboard->keys.size == 0)
@@ -1311,10 +1490,21 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	}
 }
 
+WL_EXPORT void
+notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
+	   enum wl_keyboard_key_state state,
+	   enum weston_key_state_update update_state)
+{
+	notify_key_usec(seat, (uint64_t) time * 1000, key, state,
+			update_state);
+}
+
 WL_EXPORT void
 notify_pointer_focus(struct weston_seat *seat, struct weston_output *output,
 		     wl_fixed_t x, wl_fixed_t y)
 {
+	weston_seat_flush_input(seat);
+
 	if (output) {
 		weston_pointer_move(seat->pointer, x, y);
 	} else {
@@ -1451,6 +1641,8 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	struct weston_view *ev;
 	wl_fixed_t sx, sy;
 
+	weston_seat_flush_input(seat);
+
 	/* Update grab's global coordinates. */
 	if (touch_id == touch->grab_touch_id && touch_type != WL_TOUCH_UP) {
 		touch->grab_x = x;
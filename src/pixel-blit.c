@@ -0,0 +1,932 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_BLIT 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_BLIT 1
+#include <arm_neon.h>
+#endif
+
+#include "pixel-blit.h"
+
+/* Rotations walk the source in square tiles so that the scattered
+ * destination writes of one tile stay within the cache. Must be a
+ * multiple of the largest SIMD block size. */
+#define TILE_SIZE 32
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+typedef void (*rotate_func_t)(enum pixel_rotation rotation,
+			      uint32_t *dst, int dst_stride,
+			      const uint32_t *src, int src_stride,
+			      int width, int height);
+
+typedef void (*dither_func_t)(enum pixel_format16 format,
+			      uint16_t *dst, int dst_stride,
+			      const uint32_t *src, int src_stride,
+			      int x, int y, int width, int height);
+
+typedef void (*delta_rle_func_t)(struct pixel_rle_state *state,
+				 uint32_t *frame, const uint32_t *src,
+				 int width);
+
+static const uint8_t bayer4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+struct format16_info {
+	int red_shift, red_bits;
+	int green_shift, green_bits;
+	int blue_shift, blue_bits;
+};
+
+static const struct format16_info format16_info[] = {
+	[PIXEL_FORMAT_R5G6B5] = { 11, 5, 5, 6, 0, 5 },
+	[PIXEL_FORMAT_X1R5G5B5] = { 10, 5, 5, 5, 0, 5 },
+};
+
+/* Address of the destination pixel that source pixel (x, y) of a
+ * width x height rectangle lands on.  Strides are in pixels here. */
+static inline uint32_t *
+rotated_pixel(enum pixel_rotation rotation, uint32_t *dst, int ds,
+	      int width, int height, int x, int y)
+{
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		return dst + y * ds + x;
+	case PIXEL_ROTATE_90:
+		return dst + x * ds + (height - 1 - y);
+	case PIXEL_ROTATE_180:
+		return dst + (height - 1 - y) * ds + (width - 1 - x);
+	case PIXEL_ROTATE_270:
+		return dst + (width - 1 - x) * ds + y;
+	}
+}
+
+/* Distance between the destination pixels of two horizontally adjacent
+ * source pixels. */
+static inline int
+rotated_step(enum pixel_rotation rotation, int ds)
+{
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		return 1;
+	case PIXEL_ROTATE_90:
+		return ds;
+	case PIXEL_ROTATE_180:
+		return -1;
+	case PIXEL_ROTATE_270:
+		return -ds;
+	}
+}
+
+/* Rotate the [x1, x2) x [y1, y2) part of a width x height source. */
+static void
+rotate_c_region(enum pixel_rotation rotation,
+		uint32_t *dst, int ds, const uint32_t *src, int ss,
+		int width, int height, int x1, int y1, int x2, int y2)
+{
+	const int step = rotated_step(rotation, ds);
+	const uint32_t *s;
+	uint32_t *d;
+	int x, y, tx, ty;
+
+	for (ty = y1; ty < y2; ty += TILE_SIZE) {
+		for (tx = x1; tx < x2; tx += TILE_SIZE) {
+			for (y = ty; y < MIN(ty + TILE_SIZE, y2); y++) {
+				s = src + y * ss + tx;
+				d = rotated_pixel(rotation, dst, ds,
+						  width, height, tx, y);
+				for (x = tx; x < MIN(tx + TILE_SIZE, x2); x++) {
+					*d = *s++;
+					d += step;
+				}
+			}
+		}
+	}
+}
+
+/* Fill in what an n x n block kernel left out: the right-hand column
+ * strip and the bottom row strip. */
+static void
+rotate_c_edges(enum pixel_rotation rotation,
+	       uint32_t *dst, int ds, const uint32_t *src, int ss,
+	       int width, int height, int n)
+{
+	int bw = width & ~(n - 1);
+	int bh = height & ~(n - 1);
+
+	if (bw < width)
+		rotate_c_region(rotation, dst, ds, src, ss, width, height,
+				bw, 0, width, bh);
+	if (bh < height)
+		rotate_c_region(rotation, dst, ds, src, ss, width, height,
+				0, bh, width, height);
+}
+
+static void
+rotate_c(enum pixel_rotation rotation,
+	 uint32_t *dst, int dst_stride,
+	 const uint32_t *src, int src_stride,
+	 int width, int height)
+{
+	int ds = dst_stride / 4, ss = src_stride / 4;
+	int y;
+
+	if (rotation == PIXEL_ROTATE_0) {
+		for (y = 0; y < height; y++)
+			memcpy(dst + y * ds, src + y * ss, width * 4);
+		return;
+	}
+
+	rotate_c_region(rotation, dst, ds, src, ss, width, height,
+			0, 0, width, height);
+}
+
+/* Add the ordered dither offset for a channel of the given depth, then
+ * truncate it to that depth. */
+static inline uint32_t
+dither_channel(uint32_t value, int bits, int threshold)
+{
+	value += (threshold << (8 - bits)) >> 4;
+	if (value > 0xff)
+		value = 0xff;
+
+	return value >> (8 - bits);
+}
+
+static void
+dither_c_region(enum pixel_format16 format,
+		uint16_t *dst, int ds, const uint32_t *src, int ss,
+		int x, int y, int x1, int x2, int height)
+{
+	const struct format16_info *f = &format16_info[format];
+	uint32_t p;
+	int i, j, t;
+
+	for (j = 0; j < height; j++) {
+		for (i = x1; i < x2; i++) {
+			p = src[j * ss + i];
+			t = bayer4[(y + j) & 3][(x + i) & 3];
+			dst[j * ds + i] =
+				dither_channel((p >> 16) & 0xff, f->red_bits, t)
+					<< f->red_shift |
+				dither_channel((p >> 8) & 0xff, f->green_bits, t)
+					<< f->green_shift |
+				dither_channel(p & 0xff, f->blue_bits, t)
+					<< f->blue_shift;
+		}
+	}
+}
+
+static void
+dither_c(enum pixel_format16 format,
+	 uint16_t *dst, int dst_stride,
+	 const uint32_t *src, int src_stride,
+	 int x, int y, int width, int height)
+{
+	dither_c_region(format, dst, dst_stride / 2, src, src_stride / 4,
+			x, y, 0, width, height);
+}
+
+/* Emits a run of run identical deltas in the wcap encoding: runs of up
+ * to 0xe0 go in the top byte, longer ones are split in power of two
+ * chunks. */
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((uint32_t) (run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((uint32_t) (i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static inline void
+rle_push(struct pixel_rle_state *state, uint32_t delta)
+{
+	if (state->run == 0 || delta == state->prev) {
+		state->run++;
+	} else {
+		state->out = output_run(state->out, state->prev, state->run);
+		state->run = 1;
+	}
+	state->prev = delta;
+}
+
+static void
+delta_rle_c(struct pixel_rle_state *state,
+	    uint32_t *frame, const uint32_t *src, int width)
+{
+	struct pixel_rle_state s = *state;
+	int i;
+
+	for (i = 0; i < width; i++) {
+		rle_push(&s, component_delta(src[i], frame[i]));
+		frame[i] = src[i];
+	}
+
+	*state = s;
+}
+
+#ifdef HAVE_X86_BLIT
+
+__attribute__((target("sse2")))
+static inline void
+transpose4_sse2(__m128i r[4])
+{
+	__m128i t0, t1, t2, t3;
+
+	t0 = _mm_unpacklo_epi32(r[0], r[1]);
+	t1 = _mm_unpacklo_epi32(r[2], r[3]);
+	t2 = _mm_unpackhi_epi32(r[0], r[1]);
+	t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+	r[0] = _mm_unpacklo_epi64(t0, t1);
+	r[1] = _mm_unpackhi_epi64(t0, t1);
+	r[2] = _mm_unpacklo_epi64(t2, t3);
+	r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+__attribute__((target("sse2")))
+static void
+rotate_tile_sse2(enum pixel_rotation rotation,
+		 uint32_t *dst, int ds, const uint32_t *src, int ss,
+		 int width, int height, int x1, int y1, int x2, int y2)
+{
+	/* Loading the rows bottom-up turns the transpose into a
+	 * clockwise rotation. */
+	int flip = rotation == PIXEL_ROTATE_90;
+	const uint32_t *s;
+	uint32_t *d;
+	__m128i r[4];
+	int x, y, i;
+
+	for (y = y1; y < y2; y += 4) {
+		for (x = x1; x < x2; x += 4) {
+			for (i = 0; i < 4; i++) {
+				s = src + (y + (flip ? 3 - i : i)) * ss + x;
+				r[i] = _mm_loadu_si128((const __m128i *) s);
+			}
+			transpose4_sse2(r);
+			for (i = 0; i < 4; i++) {
+				d = rotated_pixel(rotation, dst, ds,
+						  width, height, x + i,
+						  flip ? y + 3 : y);
+				_mm_storeu_si128((__m128i *) d, r[i]);
+			}
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+static void
+rotate_sse2(enum pixel_rotation rotation,
+	    uint32_t *dst, int dst_stride,
+	    const uint32_t *src, int src_stride,
+	    int width, int height)
+{
+	int ds = dst_stride / 4, ss = src_stride / 4;
+	int bw = width & ~3, bh = height & ~3;
+	int x, y, tx, ty;
+	const uint32_t *s;
+	uint32_t *d;
+	__m128i v;
+
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		rotate_c(rotation, dst, dst_stride, src, src_stride,
+			 width, height);
+		return;
+
+	case PIXEL_ROTATE_180:
+		for (y = 0; y < height; y++) {
+			s = src + y * ss;
+			d = dst + (height - 1 - y) * ds + width - 4;
+			for (x = 0; x < bw; x += 4) {
+				v = _mm_loadu_si128((const __m128i *) (s + x));
+				v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+				_mm_storeu_si128((__m128i *) (d - x), v);
+			}
+		}
+		rotate_c_region(rotation, dst, ds, src, ss, width, height,
+				bw, 0, width, height);
+		return;
+
+	case PIXEL_ROTATE_90:
+	case PIXEL_ROTATE_270:
+		for (ty = 0; ty < bh; ty += TILE_SIZE)
+			for (tx = 0; tx < bw; tx += TILE_SIZE)
+				rotate_tile_sse2(rotation, dst, ds, src, ss,
+						 width, height, tx, ty,
+						 MIN(tx + TILE_SIZE, bw),
+						 MIN(ty + TILE_SIZE, bh));
+		rotate_c_edges(rotation, dst, ds, src, ss, width, height, 4);
+		return;
+	}
+}
+
+/* Pack the x8r8g8b8 pixels of a vector into the low half of each lane. */
+__attribute__((target("sse2")))
+static inline __m128i
+pack565_sse2(__m128i p)
+{
+	__m128i r, g, b;
+
+	r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+	g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+	b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+
+	return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+/* Only R5G6B5 has a vector path; it is by far the most common narrow
+ * frame buffer format. */
+__attribute__((target("sse2")))
+static void
+dither_sse2(enum pixel_format16 format,
+	    uint16_t *dst, int dst_stride,
+	    const uint32_t *src, int src_stride,
+	    int x, int y, int width, int height)
+{
+	int ds = dst_stride / 2, ss = src_stride / 4;
+	int bw = width & ~7;
+	__m128i offsets, a, b;
+	uint8_t row[16];
+	int i, j, t;
+
+	if (format != PIXEL_FORMAT_R5G6B5) {
+		dither_c(format, dst, dst_stride, src, src_stride,
+			 x, y, width, height);
+		return;
+	}
+
+	for (j = 0; j < height; j++) {
+		/* Four pixels per vector, so the dither offsets of a row
+		 * repeat every vector. */
+		for (i = 0; i < 4; i++) {
+			t = bayer4[(y + j) & 3][(x + i) & 3];
+			row[i * 4 + 0] = t >> 1;
+			row[i * 4 + 1] = t >> 2;
+			row[i * 4 + 2] = t >> 1;
+			row[i * 4 + 3] = 0;
+		}
+		offsets = _mm_loadu_si128((const __m128i *) row);
+
+		for (i = 0; i < bw; i += 8) {
+			a = _mm_loadu_si128((const __m128i *) &src[j * ss + i]);
+			b = _mm_loadu_si128((const __m128i *) &src[j * ss + i + 4]);
+			a = _mm_adds_epu8(a, offsets);
+			b = _mm_adds_epu8(b, offsets);
+
+			a = pack565_sse2(a);
+			b = pack565_sse2(b);
+
+			/* Sign extend so the signed saturating pack keeps
+			 * the low 16 bits intact. */
+			a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+			b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+			_mm_storeu_si128((__m128i *) &dst[j * ds + i],
+					 _mm_packs_epi32(a, b));
+		}
+	}
+
+	if (bw < width)
+		dither_c_region(format, dst, ds, src, ss, x, y,
+				bw, width, height);
+}
+
+__attribute__((target("avx2")))
+static inline void
+transpose8_avx2(__m256i r[8])
+{
+	__m256i t[8], u[8];
+
+	t[0] = _mm256_unpacklo_epi32(r[0], r[1]);
+	t[1] = _mm256_unpackhi_epi32(r[0], r[1]);
+	t[2] = _mm256_unpacklo_epi32(r[2], r[3]);
+	t[3] = _mm256_unpackhi_epi32(r[2], r[3]);
+	t[4] = _mm256_unpacklo_epi32(r[4], r[5]);
+	t[5] = _mm256_unpackhi_epi32(r[4], r[5]);
+	t[6] = _mm256_unpacklo_epi32(r[6], r[7]);
+	t[7] = _mm256_unpackhi_epi32(r[6], r[7]);
+
+	u[0] = _mm256_unpacklo_epi64(t[0], t[2]);
+	u[1] = _mm256_unpackhi_epi64(t[0], t[2]);
+	u[2] = _mm256_unpacklo_epi64(t[1], t[3]);
+	u[3] = _mm256_unpackhi_epi64(t[1], t[3]);
+	u[4] = _mm256_unpacklo_epi64(t[4], t[6]);
+	u[5] = _mm256_unpackhi_epi64(t[4], t[6]);
+	u[6] = _mm256_unpacklo_epi64(t[5], t[7]);
+	u[7] = _mm256_unpackhi_epi64(t[5], t[7]);
+
+	r[0] = _mm256_permute2x128_si256(u[0], u[4], 0x20);
+	r[1] = _mm256_permute2x128_si256(u[1], u[5], 0x20);
+	r[2] = _mm256_permute2x128_si256(u[2], u[6], 0x20);
+	r[3] = _mm256_permute2x128_si256(u[3], u[7], 0x20);
+	r[4] = _mm256_permute2x128_si256(u[0], u[4], 0x31);
+	r[5] = _mm256_permute2x128_si256(u[1], u[5], 0x31);
+	r[6] = _mm256_permute2x128_si256(u[2], u[6], 0x31);
+	r[7] = _mm256_permute2x128_si256(u[3], u[7], 0x31);
+}
+
+__attribute__((target("avx2")))
+static void
+rotate_tile_avx2(enum pixel_rotation rotation,
+		 uint32_t *dst, int ds, const uint32_t *src, int ss,
+		 int width, int height, int x1, int y1, int x2, int y2)
+{
+	/* Loading the rows bottom-up turns the transpose into a
+	 * clockwise rotation. */
+	int flip = rotation == PIXEL_ROTATE_90;
+	const uint32_t *s;
+	uint32_t *d;
+	__m256i r[8];
+	int x, y, i;
+
+	for (y = y1; y < y2; y += 8) {
+		for (x = x1; x < x2; x += 8) {
+			for (i = 0; i < 8; i++) {
+				s = src + (y + (flip ? 7 - i : i)) * ss + x;
+				r[i] = _mm256_loadu_si256((const __m256i *) s);
+			}
+			transpose8_avx2(r);
+			for (i = 0; i < 8; i++) {
+				d = rotated_pixel(rotation, dst, ds,
+						  width, height, x + i,
+						  flip ? y + 7 : y);
+				_mm256_storeu_si256((__m256i *) d, r[i]);
+			}
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void
+rotate_avx2(enum pixel_rotation rotation,
+	    uint32_t *dst, int dst_stride,
+	    const uint32_t *src, int src_stride,
+	    int width, int height)
+{
+	int ds = dst_stride / 4, ss = src_stride / 4;
+	int bw = width & ~7, bh = height & ~7;
+	int x, y, tx, ty;
+	const uint32_t *s;
+	uint32_t *d;
+	__m256i v, reverse;
+
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		rotate_c(rotation, dst, dst_stride, src, src_stride,
+			 width, height);
+		return;
+
+	case PIXEL_ROTATE_180:
+		reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+		for (y = 0; y < height; y++) {
+			s = src + y * ss;
+			d = dst + (height - 1 - y) * ds + width - 8;
+			for (x = 0; x < bw; x += 8) {
+				v = _mm256_loadu_si256((const __m256i *) (s + x));
+				v = _mm256_permutevar8x32_epi32(v, reverse);
+				_mm256_storeu_si256((__m256i *) (d - x), v);
+			}
+		}
+		rotate_c_region(rotation, dst, ds, src, ss, width, height,
+				bw, 0, width, height);
+		return;
+
+	case PIXEL_ROTATE_90:
+	case PIXEL_ROTATE_270:
+		for (ty = 0; ty < bh; ty += TILE_SIZE)
+			for (tx = 0; tx < bw; tx += TILE_SIZE)
+				rotate_tile_avx2(rotation, dst, ds, src, ss,
+						 width, height, tx, ty,
+						 MIN(tx + TILE_SIZE, bw),
+						 MIN(ty + TILE_SIZE, bh));
+		rotate_c_edges(rotation, dst, ds, src, ss, width, height, 8);
+		return;
+	}
+}
+
+/* The deltas are plain byte subtractions with the alpha byte masked
+ * off.  A whole vector that continues the current run, which is what
+ * unchanged areas look like, only costs a compare. */
+__attribute__((target("sse2")))
+static void
+delta_rle_sse2(struct pixel_rle_state *state,
+	       uint32_t *frame, const uint32_t *src, int width)
+{
+	const __m128i mask = _mm_set1_epi32(0x00ffffff);
+	struct pixel_rle_state s = *state;
+	uint32_t lanes[4];
+	__m128i n, f, d;
+	int i, k;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		n = _mm_loadu_si128((const __m128i *) (src + i));
+		f = _mm_loadu_si128((const __m128i *) (frame + i));
+		d = _mm_and_si128(_mm_sub_epi8(n, f), mask);
+		_mm_storeu_si128((__m128i *) (frame + i), n);
+
+		if (s.run > 0 &&
+		    _mm_movemask_epi8(_mm_cmpeq_epi32(d,
+				_mm_set1_epi32(s.prev))) == 0xffff) {
+			s.run += 4;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *) lanes, d);
+		for (k = 0; k < 4; k++)
+			rle_push(&s, lanes[k]);
+	}
+
+	*state = s;
+	delta_rle_c(state, frame + i, src + i, width - i);
+}
+
+__attribute__((target("avx2")))
+static void
+delta_rle_avx2(struct pixel_rle_state *state,
+	       uint32_t *frame, const uint32_t *src, int width)
+{
+	const __m256i mask = _mm256_set1_epi32(0x00ffffff);
+	struct pixel_rle_state s = *state;
+	uint32_t lanes[8];
+	__m256i n, f, d;
+	int i, k;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		n = _mm256_loadu_si256((const __m256i *) (src + i));
+		f = _mm256_loadu_si256((const __m256i *) (frame + i));
+		d = _mm256_and_si256(_mm256_sub_epi8(n, f), mask);
+		_mm256_storeu_si256((__m256i *) (frame + i), n);
+
+		if (s.run > 0 &&
+		    _mm256_movemask_epi8(_mm256_cmpeq_epi32(d,
+				_mm256_set1_epi32(s.prev))) == -1) {
+			s.run += 8;
+			continue;
+		}
+
+		_mm256_storeu_si256((__m256i *) lanes, d);
+		for (k = 0; k < 8; k++)
+			rle_push(&s, lanes[k]);
+	}
+
+	*state = s;
+	delta_rle_sse2(state, frame + i, src + i, width - i);
+}
+
+#endif /* HAVE_X86_BLIT */
+
+#ifdef HAVE_NEON_BLIT
+
+static inline void
+transpose4_neon(uint32x4_t r[4])
+{
+	uint32x4x2_t p0 = vtrnq_u32(r[0], r[1]);
+	uint32x4x2_t p1 = vtrnq_u32(r[2], r[3]);
+
+	r[0] = vcombine_u32(vget_low_u32(p0.val[0]), vget_low_u32(p1.val[0]));
+	r[1] = vcombine_u32(vget_low_u32(p0.val[1]), vget_low_u32(p1.val[1]));
+	r[2] = vcombine_u32(vget_high_u32(p0.val[0]), vget_high_u32(p1.val[0]));
+	r[3] = vcombine_u32(vget_high_u32(p0.val[1]), vget_high_u32(p1.val[1]));
+}
+
+static void
+rotate_tile_neon(enum pixel_rotation rotation,
+		 uint32_t *dst, int ds, const uint32_t *src, int ss,
+		 int width, int height, int x1, int y1, int x2, int y2)
+{
+	/* Loading the rows bottom-up turns the transpose into a
+	 * clockwise rotation. */
+	int flip = rotation == PIXEL_ROTATE_90;
+	const uint32_t *s;
+	uint32_t *d;
+	uint32x4_t r[4];
+	int x, y, i;
+
+	for (y = y1; y < y2; y += 4) {
+		for (x = x1; x < x2; x += 4) {
+			for (i = 0; i < 4; i++) {
+				s = src + (y + (flip ? 3 - i : i)) * ss + x;
+				r[i] = vld1q_u32(s);
+			}
+			transpose4_neon(r);
+			for (i = 0; i < 4; i++) {
+				d = rotated_pixel(rotation, dst, ds,
+						  width, height, x + i,
+						  flip ? y + 3 : y);
+				vst1q_u32(d, r[i]);
+			}
+		}
+	}
+}
+
+static void
+rotate_neon(enum pixel_rotation rotation,
+	    uint32_t *dst, int dst_stride,
+	    const uint32_t *src, int src_stride,
+	    int width, int height)
+{
+	int ds = dst_stride / 4, ss = src_stride / 4;
+	int bw = width & ~3, bh = height & ~3;
+	int x, y, tx, ty;
+	const uint32_t *s;
+	uint32_t *d;
+	uint32x4_t v;
+
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		rotate_c(rotation, dst, dst_stride, src, src_stride,
+			 width, height);
+		return;
+
+	case PIXEL_ROTATE_180:
+		for (y = 0; y < height; y++) {
+			s = src + y * ss;
+			d = dst + (height - 1 - y) * ds + width - 4;
+			for (x = 0; x < bw; x += 4) {
+				v = vrev64q_u32(vld1q_u32(s + x));
+				v = vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+				vst1q_u32(d - x, v);
+			}
+		}
+		rotate_c_region(rotation, dst, ds, src, ss, width, height,
+				bw, 0, width, height);
+		return;
+
+	case PIXEL_ROTATE_90:
+	case PIXEL_ROTATE_270:
+		for (ty = 0; ty < bh; ty += TILE_SIZE)
+			for (tx = 0; tx < bw; tx += TILE_SIZE)
+				rotate_tile_neon(rotation, dst, ds, src, ss,
+						 width, height, tx, ty,
+						 MIN(tx + TILE_SIZE, bw),
+						 MIN(ty + TILE_SIZE, bh));
+		rotate_c_edges(rotation, dst, ds, src, ss, width, height, 4);
+		return;
+	}
+}
+
+#endif /* HAVE_NEON_BLIT */
+
+static const rotate_func_t rotate_funcs[PIXEL_BLIT_IMPL_COUNT] = {
+	[PIXEL_BLIT_IMPL_C] = rotate_c,
+#ifdef HAVE_X86_BLIT
+	[PIXEL_BLIT_IMPL_SSE2] = rotate_sse2,
+	[PIXEL_BLIT_IMPL_AVX2] = rotate_avx2,
+#endif
+#ifdef HAVE_NEON_BLIT
+	[PIXEL_BLIT_IMPL_NEON] = rotate_neon,
+#endif
+};
+
+static const dither_func_t dither_funcs[PIXEL_BLIT_IMPL_COUNT] = {
+	[PIXEL_BLIT_IMPL_C] = dither_c,
+#ifdef HAVE_X86_BLIT
+	[PIXEL_BLIT_IMPL_SSE2] = dither_sse2,
+#endif
+};
+
+static const delta_rle_func_t delta_rle_funcs[PIXEL_BLIT_IMPL_COUNT] = {
+	[PIXEL_BLIT_IMPL_C] = delta_rle_c,
+#ifdef HAVE_X86_BLIT
+	[PIXEL_BLIT_IMPL_SSE2] = delta_rle_sse2,
+	[PIXEL_BLIT_IMPL_AVX2] = delta_rle_avx2,
+#endif
+};
+
+static const char * const impl_names[PIXEL_BLIT_IMPL_COUNT] = {
+	[PIXEL_BLIT_IMPL_C] = "C",
+	[PIXEL_BLIT_IMPL_SSE2] = "SSE2",
+	[PIXEL_BLIT_IMPL_AVX2] = "AVX2",
+	[PIXEL_BLIT_IMPL_NEON] = "NEON",
+};
+
+static int
+cpu_supports(enum pixel_blit_impl impl)
+{
+	switch (impl) {
+	case PIXEL_BLIT_IMPL_C:
+		return 1;
+#ifdef HAVE_X86_BLIT
+	case PIXEL_BLIT_IMPL_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	case PIXEL_BLIT_IMPL_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+#ifdef HAVE_NEON_BLIT
+	case PIXEL_BLIT_IMPL_NEON:
+		/* Only built when the compiler targets NEON. */
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+int
+pixel_blit_impl_supported(enum pixel_blit_impl impl)
+{
+	if (impl >= PIXEL_BLIT_IMPL_COUNT || !rotate_funcs[impl])
+		return 0;
+
+	return cpu_supports(impl);
+}
+
+const char *
+pixel_blit_impl_name(enum pixel_blit_impl impl)
+{
+	if (impl >= PIXEL_BLIT_IMPL_COUNT)
+		return "unknown";
+
+	return impl_names[impl];
+}
+
+static const enum pixel_blit_impl preference[] = {
+	PIXEL_BLIT_IMPL_AVX2,
+	PIXEL_BLIT_IMPL_SSE2,
+	PIXEL_BLIT_IMPL_NEON,
+};
+
+enum pixel_blit_impl
+pixel_blit_best_impl(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof preference / sizeof preference[0]; i++)
+		if (pixel_blit_impl_supported(preference[i]))
+			return preference[i];
+
+	return PIXEL_BLIT_IMPL_C;
+}
+
+int
+pixel_blit_rotate32_impl(enum pixel_blit_impl impl,
+			 enum pixel_rotation rotation,
+			 uint32_t *dst, int dst_stride,
+			 const uint32_t *src, int src_stride,
+			 int width, int height)
+{
+	if (!pixel_blit_impl_supported(impl))
+		return -1;
+
+	rotate_funcs[impl](rotation, dst, dst_stride,
+			   src, src_stride, width, height);
+
+	return 0;
+}
+
+void
+pixel_blit_rotate32(enum pixel_rotation rotation,
+		    uint32_t *dst, int dst_stride,
+		    const uint32_t *src, int src_stride,
+		    int width, int height)
+{
+	static rotate_func_t rotate;
+
+	if (!rotate)
+		rotate = rotate_funcs[pixel_blit_best_impl()];
+
+	rotate(rotation, dst, dst_stride, src, src_stride, width, height);
+}
+
+int
+pixel_blit_dither16_impl(enum pixel_blit_impl impl,
+			 enum pixel_format16 format,
+			 uint16_t *dst, int dst_stride,
+			 const uint32_t *src, int src_stride,
+			 int x, int y, int width, int height)
+{
+	if (!pixel_blit_impl_supported(impl) || !dither_funcs[impl])
+		return -1;
+
+	dither_funcs[impl](format, dst, dst_stride, src, src_stride,
+			   x, y, width, height);
+
+	return 0;
+}
+
+void
+pixel_blit_dither16(enum pixel_format16 format,
+		    uint16_t *dst, int dst_stride,
+		    const uint32_t *src, int src_stride,
+		    int x, int y, int width, int height)
+{
+	static dither_func_t dither;
+	unsigned int i;
+
+	if (!dither) {
+		dither = dither_c;
+		for (i = 0; i < sizeof preference / sizeof preference[0]; i++) {
+			if (dither_funcs[preference[i]] &&
+			    pixel_blit_impl_supported(preference[i])) {
+				dither = dither_funcs[preference[i]];
+				break;
+			}
+		}
+	}
+
+	dither(format, dst, dst_stride, src, src_stride, x, y, width, height);
+}
+
+int
+pixel_blit_delta_rle_impl(enum pixel_blit_impl impl,
+			  struct pixel_rle_state *state,
+			  uint32_t *frame, const uint32_t *src, int width)
+{
+	if (!pixel_blit_impl_supported(impl) || !delta_rle_funcs[impl])
+		return -1;
+
+	delta_rle_funcs[impl](state, frame, src, width);
+
+	return 0;
+}
+
+void
+pixel_blit_delta_rle(struct pixel_rle_state *state,
+		     uint32_t *frame, const uint32_t *src, int width)
+{
+	static delta_rle_func_t delta_rle;
+	unsigned int i;
+
+	if (!delta_rle) {
+		delta_rle = delta_rle_c;
+		for (i = 0; i < sizeof preference / sizeof preference[0]; i++) {
+			if (delta_rle_funcs[preference[i]] &&
+			    pixel_blit_impl_supported(preference[i])) {
+				delta_rle = delta_rle_funcs[preference[i]];
+				break;
+			}
+		}
+	}
+
+	delta_rle(state, frame, src, width);
+}
+
+void
+pixel_blit_delta_rle_finish(struct pixel_rle_state *state)
+{
+	state->out = output_run(state->out, state->prev, state->run);
+	state->run = 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_PIXEL_BLIT_H
+#define _WESTON_PIXEL_BLIT_H
+
+#include <stdint.h>
+
+/* Clockwise rotations; the values match the corresponding
+ * wl_output_transform enumerants so that they can be cast directly. */
+enum pixel_rotation {
+	PIXEL_ROTATE_0 = 0,
+	PIXEL_ROTATE_90 = 1,
+	PIXEL_ROTATE_180 = 2,
+	PIXEL_ROTATE_270 = 3,
+};
+
+/* Narrow frame buffer formats the dithering converters can produce. */
+enum pixel_format16 {
+	PIXEL_FORMAT_R5G6B5,
+	PIXEL_FORMAT_X1R5G5B5,
+};
+
+/* Run-length encoder state for pixel_blit_delta_rle(); runs carry on
+ * from one call to the next.  Start with run = 0. */
+struct pixel_rle_state {
+	uint32_t *out; /* where the next encoded word goes */
+	uint32_t prev; /* delta repeated by the current run */
+	int run;
+};
+
+enum pixel_blit_impl {
+	PIXEL_BLIT_IMPL_C,
+	PIXEL_BLIT_IMPL_SSE2,
+	PIXEL_BLIT_IMPL_AVX2,
+	PIXEL_BLIT_IMPL_NEON,
+	PIXEL_BLIT_IMPL_COUNT
+};
+
+/* Copy a width x height rectangle of 32 bpp pixels from src to dst,
+ * rotating it on the way.  dst points at the top-left pixel of the
+ * destination rectangle, which is height x width for 90 and 270 degree
+ * rotations.  Strides are in bytes.  The fastest implementation supported
+ * by the running CPU is picked on first use. */
+void
+pixel_blit_rotate32(enum pixel_rotation rotation,
+		    uint32_t *dst, int dst_stride,
+		    const uint32_t *src, int src_stride,
+		    int width, int height);
+
+/* Same as pixel_blit_rotate32(), but forces the given implementation.
+ * Returns -1 if it is not supported on this CPU or build. */
+int
+pixel_blit_rotate32_impl(enum pixel_blit_impl impl,
+			 enum pixel_rotation rotation,
+			 uint32_t *dst, int dst_stride,
+			 const uint32_t *src, int src_stride,
+			 int width, int height);
+
+/* Convert a width x height rectangle of x8r8g8b8 pixels to a 16 bpp
+ * format with a 4x4 ordered dither.  x and y are the position of the
+ * rectangle on the output, so that the dither pattern stays anchored to
+ * the screen whatever rectangles it is applied to. */
+void
+pixel_blit_dither16(enum pixel_format16 format,
+		    uint16_t *dst, int dst_stride,
+		    const uint32_t *src, int src_stride,
+		    int x, int y, int width, int height);
+
+/* Returns -1 if the implementation has no kernel for this operation or
+ * is not supported on this CPU or build. */
+int
+pixel_blit_dither16_impl(enum pixel_blit_impl impl,
+			 enum pixel_format16 format,
+			 uint16_t *dst, int dst_stride,
+			 const uint32_t *src, int src_stride,
+			 int x, int y, int width, int height);
+
+/* Encode one row of width x8r8g8b8 pixels as in the wcap format: the
+ * per-channel difference between src and frame is run-length encoded
+ * into state->out, and frame is updated to src.  At most one word is
+ * written per pixel. */
+void
+pixel_blit_delta_rle(struct pixel_rle_state *state,
+		     uint32_t *frame, const uint32_t *src, int width);
+
+/* Returns -1 if the implementation has no kernel for this operation or
+ * is not supported on this CPU or build. */
+int
+pixel_blit_delta_rle_impl(enum pixel_blit_impl impl,
+			  struct pixel_rle_state *state,
+			  uint32_t *frame, const uint32_t *src, int width);
+
+/* Writes out the pending run. */
+void
+pixel_blit_delta_rle_finish(struct pixel_rle_state *state);
+
+int
+pixel_blit_impl_supported(enum pixel_blit_impl impl);
+
+const char *
+pixel_blit_impl_name(enum pixel_blit_impl impl);
+
+enum pixel_blit_impl
+pixel_blit_best_impl(void);
+
+#endif
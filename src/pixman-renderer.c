@@ -24,9 +24,13 @@
 #include "config.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "pixman-renderer.h"
+#include "pixel-blit.h"
+#include "damage-heatmap.h"
 
 #include <linux/input.h>
 
@@ -34,6 +38,26 @@ struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* For 90, 180 and 270 degree outputs the shadow image is kept
+	 * upright and rotated only when copied to the hardware buffer, so
+	 * that the per-view composites do not need transformed fetches. */
+	enum wl_output_transform copy_transform;
+
+	/* Composite opaque regions straight into a narrow hw_buffer and
+	 * go through the shadow image only where blending is needed. */
+	int native_composite;
+
+	/* Counted while stats are enabled and logged by stats_report()
+	 * about once per second. */
+	uint32_t stats_time;
+	uint32_t stats_frames;
+	uint32_t stats_fills;
+	uint32_t stats_composites;
+	uint64_t stats_direct;
+	uint64_t stats_blended;
+
+	struct damage_heatmap heatmap;
 };
 
 struct pixman_surface_state {
@@ -42,6 +66,20 @@ struct pixman_surface_state {
 	pixman_image_t *image;
 	struct weston_buffer_reference buffer_ref;
 
+	/* Set by surface_set_color(); image is then a solid fill. */
+	int solid;
+	pixman_color_t solid_color;
+
+	/* Damage accumulated for the heat map report, in pixels. */
+	uint64_t damage_area;
+
+	/* Copy of a static buffer with the buffer transform and viewport
+	 * already applied, in surface coordinates.  Kept up to date on
+	 * damage so that repaints do not have to transform the buffer. */
+	pixman_image_t *cache_image;
+	struct weston_buffer_viewport cache_viewport;
+	int idle_repaints;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
@@ -54,6 +92,17 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	int stats_debug;
+	struct weston_binding *stats_binding;
+	uint32_t frame_fills;
+	uint32_t frame_composites;
+
+	int surface_cache;
+
+	int heatmap_debug;
+	struct weston_binding *heatmap_binding;
+	uint32_t heatmap_report_time;
+
 	struct wl_signal destroy_signal;
 };
 
@@ -127,12 +176,26 @@ pixman_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+/* The output transform still to be applied when rendering into the
+ * shadow image. */
+static enum wl_output_transform
+shadow_transform(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (po->copy_transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return WL_OUTPUT_TRANSFORM_NORMAL;
+
+	return output->transform;
+}
+
 static void
 region_global_to_output(struct weston_output *output, pixman_region32_t *region)
 {
 	pixman_region32_translate(region, -output->x, -output->y);
 	weston_transformed_region(output->width, output->height,
-				  output->transform, output->current_scale,
+				  shadow_transform(output),
+				  output->current_scale,
 				  region, region);
 }
 
@@ -167,22 +230,217 @@ transform_apply_viewport(pixman_transform_t *transform,
 	pixman_transform_translate(transform, NULL, D2F(src_x), D2F(src_y));
 }
 
+/* Continues transform with the mapping from surface coordinates to
+ * buffer coordinates. */
+static void
+surface_to_buffer_transform(pixman_transform_t *transform,
+			    struct weston_surface *surface)
+{
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+	pixman_fixed_t fw, fh;
+
+	transform_apply_viewport(transform, surface);
+
+	fw = pixman_int_to_fixed(surface->width_from_buffer);
+	fh = pixman_int_to_fixed(surface->height_from_buffer);
+
+	switch (vp->buffer.transform) {
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		pixman_transform_scale(transform, NULL,
+				       pixman_int_to_fixed (-1),
+				       pixman_int_to_fixed (1));
+		pixman_transform_translate(transform, NULL, fw, 0);
+		break;
+	}
+
+	switch (vp->buffer.transform) {
+	default:
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		pixman_transform_rotate(transform, NULL, 0, pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, fh, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		pixman_transform_rotate(transform, NULL, -pixman_fixed_1, 0);
+		pixman_transform_translate(transform, NULL, fw, fh);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		pixman_transform_rotate(transform, NULL, 0, -pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, 0, fw);
+		break;
+	}
+
+	pixman_transform_scale(transform, NULL,
+			       pixman_double_to_fixed(vp->buffer.scale),
+			       pixman_double_to_fixed(vp->buffer.scale));
+}
+
+/* Number of repaints a surface has to go without new content before its
+ * buffer is worth caching. */
+#define SURFACE_CACHE_IDLE_REPAINTS 2
+#define STATS_INTERVAL_MS 1000
+
+static int
+surface_cache_wanted(struct weston_surface *surface)
+{
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+
+	/* Solid colour surfaces have no buffer, and buffers that are not
+	 * transformed are blitted straight away anyway.  Scaled buffers
+	 * are left alone so that HiDPI outputs keep their resolution. */
+	if (!ps->buffer_ref.buffer || vp->buffer.scale != 1)
+		return 0;
+
+	return vp->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	       vp->buffer.src_width != wl_fixed_from_int(-1) ||
+	       vp->surface.width != -1;
+}
+
+static void
+surface_cache_drop(struct pixman_surface_state *ps)
+{
+	if (ps->cache_image) {
+		pixman_image_unref(ps->cache_image);
+		ps->cache_image = NULL;
+	}
+}
+
+/* region is in surface coordinates */
+static void
+surface_cache_update(struct weston_surface *surface,
+		     pixman_region32_t *region)
+{
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+
+	pixman_transform_init_identity(&transform);
+	surface_to_buffer_transform(&transform, surface);
+	pixman_image_set_transform(ps->image, &transform);
+
+	/* Pure rotations and flips map pixels one to one. */
+	if (vp->buffer.src_width == wl_fixed_from_int(-1) &&
+	    vp->surface.width == -1)
+		filter = PIXMAN_FILTER_NEAREST;
+	else
+		filter = PIXMAN_FILTER_BILINEAR;
+	pixman_image_set_filter(ps->image, filter, NULL, 0);
+
+	pixman_image_set_clip_region32(ps->cache_image, region);
+
+	wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 ps->image, /* src */
+				 NULL /* mask */,
+				 ps->cache_image, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 surface->width, /* width */
+				 surface->height /* height */);
+	wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+
+	pixman_image_set_clip_region32(ps->cache_image, NULL);
+	pixman_image_set_transform(ps->image, NULL);
+}
+
+static int
+buffer_viewport_equal(const struct weston_buffer_viewport *a,
+		      const struct weston_buffer_viewport *b)
+{
+	return a->buffer.transform == b->buffer.transform &&
+	       a->buffer.scale == b->buffer.scale &&
+	       a->buffer.src_x == b->buffer.src_x &&
+	       a->buffer.src_y == b->buffer.src_y &&
+	       a->buffer.src_width == b->buffer.src_width &&
+	       a->buffer.src_height == b->buffer.src_height &&
+	       a->surface.width == b->surface.width &&
+	       a->surface.height == b->surface.height;
+}
+
+static int
+surface_cache_valid(struct weston_surface *surface)
+{
+	struct pixman_surface_state *ps = get_surface_state(surface);
+
+	return ps->cache_image &&
+	       pixman_image_get_width(ps->cache_image) == surface->width &&
+	       pixman_image_get_height(ps->cache_image) == surface->height &&
+	       buffer_viewport_equal(&ps->cache_viewport,
+				     &surface->buffer_viewport);
+}
+
+/* Called before a view of the surface is drawn.  Once the surface has
+ * been idle for a while, (re)build the cache from the whole buffer. */
+static void
+surface_cache_prepare(struct weston_surface *surface)
+{
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	pixman_format_code_t format;
+	pixman_region32_t all;
+
+	if (!surface_cache_wanted(surface)) {
+		surface_cache_drop(ps);
+		return;
+	}
+
+	if (surface_cache_valid(surface))
+		return;
+
+	surface_cache_drop(ps);
+
+	if (ps->idle_repaints < SURFACE_CACHE_IDLE_REPAINTS) {
+		ps->idle_repaints++;
+		return;
+	}
+
+	if (PIXMAN_FORMAT_A(pixman_image_get_format(ps->image)))
+		format = PIXMAN_a8r8g8b8;
+	else
+		format = PIXMAN_x8r8g8b8;
+
+	ps->cache_image = pixman_image_create_bits(format,
+						   surface->width,
+						   surface->height,
+						   NULL, 0);
+	if (!ps->cache_image)
+		return;
+
+	ps->cache_viewport = surface->buffer_viewport;
+
+	pixman_region32_init_rect(&all, 0, 0, surface->width, surface->height);
+	surface_cache_update(surface, &all);
+	pixman_region32_fini(&all);
+}
+
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
+	       pixman_image_t *target,
 	       pixman_region32_t *region, pixman_region32_t *surf_region,
 	       pixman_op_t pixman_op)
 {
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
 	pixman_region32_t final_region;
 	float view_x, view_y;
 	pixman_transform_t transform;
 	pixman_fixed_t fw, fh;
+	pixman_image_t *src_image;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
+	enum wl_output_transform output_transform = shadow_transform(output);
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -212,7 +470,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	region_global_to_output(output, &final_region);
 
 	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
+	pixman_image_set_clip_region32 (target, &final_region);
 
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
@@ -224,7 +482,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 
 	fw = pixman_int_to_fixed(output->width);
 	fh = pixman_int_to_fixed(output->height);
-	switch (output->transform) {
+	switch (output_transform) {
 	default:
 	case WL_OUTPUT_TRANSFORM_NORMAL:
 	case WL_OUTPUT_TRANSFORM_FLIPPED:
@@ -246,7 +504,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		break;
 	}
 
-	switch (output->transform) {
+	switch (output_transform) {
 	case WL_OUTPUT_TRANSFORM_FLIPPED:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
@@ -289,57 +547,22 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 					   pixman_double_to_fixed ((double)-ev->geometry.y));
 	}
 
-	transform_apply_viewport(&transform, ev->surface);
-
-	fw = pixman_int_to_fixed(ev->surface->width_from_buffer);
-	fh = pixman_int_to_fixed(ev->surface->height_from_buffer);
-
-	switch (vp->buffer.transform) {
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		pixman_transform_scale(&transform, NULL,
-				       pixman_int_to_fixed (-1),
-				       pixman_int_to_fixed (1));
-		pixman_transform_translate(&transform, NULL, fw, 0);
-		break;
-	}
-
-	switch (vp->buffer.transform) {
-	default:
-	case WL_OUTPUT_TRANSFORM_NORMAL:
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-		break;
-	case WL_OUTPUT_TRANSFORM_90:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		pixman_transform_rotate(&transform, NULL, 0, pixman_fixed_1);
-		pixman_transform_translate(&transform, NULL, fh, 0);
-		break;
-	case WL_OUTPUT_TRANSFORM_180:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		pixman_transform_rotate(&transform, NULL, -pixman_fixed_1, 0);
-		pixman_transform_translate(&transform, NULL, fw, fh);
-		break;
-	case WL_OUTPUT_TRANSFORM_270:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		pixman_transform_rotate(&transform, NULL, 0, -pixman_fixed_1);
-		pixman_transform_translate(&transform, NULL, 0, fw);
-		break;
+	if (ps->cache_image) {
+		src_image = ps->cache_image;
+	} else {
+		src_image = ps->image;
+		surface_to_buffer_transform(&transform, ev->surface);
 	}
 
-	pixman_transform_scale(&transform, NULL,
-			       pixman_double_to_fixed(vp->buffer.scale),
-			       pixman_double_to_fixed(vp->buffer.scale));
+	pixman_image_set_transform(src_image, &transform);
 
-	pixman_image_set_transform(ps->image, &transform);
-
-	if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+	if (ev->transform.enabled ||
+	    output->current_scale != (ps->cache_image ? 1 : vp->buffer.scale))
+		pixman_image_set_filter(src_image, PIXMAN_FILTER_BILINEAR, NULL, 0);
 	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+		pixman_image_set_filter(src_image, PIXMAN_FILTER_NEAREST, NULL, 0);
 
-	if (ps->buffer_ref.buffer)
+	if (ps->buffer_ref.buffer && !ps->cache_image)
 		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
 
 	if (ev->alpha < 1.0) {
@@ -349,42 +572,97 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		mask_image = NULL;
 	}
 
+	pr->frame_composites++;
 	pixman_image_composite32(pixman_op,
-				 ps->image, /* src */
+				 src_image, /* src */
 				 mask_image, /* mask */
-				 po->shadow_image, /* dest */
+				 target, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+				 pixman_image_get_width (target), /* width */
+				 pixman_image_get_height (target) /* height */);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
 
-	if (ps->buffer_ref.buffer)
+	if (ps->buffer_ref.buffer && !ps->cache_image)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
 
 	if (pr->repaint_debug)
 		pixman_image_composite32(PIXMAN_OP_OVER,
 					 pr->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 target, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (target), /* width */
+					 pixman_image_get_height (target) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (target, NULL);
+
+	pixman_region32_fini(&final_region);
+}
+
+/* Opaque solid colour views do not need to be composited at all, as
+ * long as they still cover an axis-aligned rectangle on the output. */
+static int
+view_is_solid_fill(struct weston_view *ev)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+
+	return ps->solid && ps->solid_color.alpha == 0xffff &&
+	       ev->alpha == 1.0 &&
+	       (!ev->transform.enabled ||
+		ev->transform.matrix.type == WESTON_MATRIX_TRANSFORM_TRANSLATE);
+}
+
+static void
+fill_region(struct weston_view *ev, struct weston_output *output,
+	    pixman_image_t *target, pixman_region32_t *region)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	pixman_region32_t final_region;
+	pixman_box32_t *boxes;
+	int nboxes;
+
+	pixman_region32_init(&final_region);
+	pixman_region32_copy(&final_region, region);
+	region_global_to_output(output, &final_region);
+	pixman_region32_intersect_rect(&final_region, &final_region, 0, 0,
+				       pixman_image_get_width(target),
+				       pixman_image_get_height(target));
+
+	boxes = pixman_region32_rectangles(&final_region, &nboxes);
+	pixman_image_fill_boxes(PIXMAN_OP_SRC, target, &ps->solid_color,
+				nboxes, boxes);
+	pr->frame_fills++;
+
+	if (pr->repaint_debug) {
+		pixman_image_set_clip_region32 (target, &final_region);
+		pixman_image_composite32(PIXMAN_OP_OVER,
+					 pr->debug_color, /* src */
+					 NULL /* mask */,
+					 target, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pixman_image_get_width (target), /* width */
+					 pixman_image_get_height (target) /* height */);
+		pixman_image_set_clip_region32 (target, NULL);
+	}
 
 	pixman_region32_fini(&final_region);
 }
 
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
+	  pixman_image_t *target,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
@@ -408,11 +686,19 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		goto out;
 	}
 
+	if (view_is_solid_fill(ev)) {
+		fill_region(ev, output, target, &repaint);
+		goto out;
+	}
+
+	if (pr->surface_cache)
+		surface_cache_prepare(ev->surface);
+
 	/* TODO: Implement repaint_region_complex() using pixman_composite_trapezoids() */
 	if (ev->alpha != 1.0 ||
 	    (ev->transform.enabled &&
 	     ev->transform.matrix.type != WESTON_MATRIX_TRANSFORM_TRANSLATE)) {
-		repaint_region(ev, output, &repaint, NULL, PIXMAN_OP_OVER);
+		repaint_region(ev, output, target, &repaint, NULL, PIXMAN_OP_OVER);
 	} else {
 		/* blended region is whole surface minus opaque region: */
 		pixman_region32_init_rect(&surface_blend, 0, 0,
@@ -420,11 +706,11 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
 
 		if (pixman_region32_not_empty(&ev->surface->opaque)) {
-			repaint_region(ev, output, &repaint, &ev->surface->opaque, PIXMAN_OP_SRC);
+			repaint_region(ev, output, target, &repaint, &ev->surface->opaque, PIXMAN_OP_SRC);
 		}
 
 		if (pixman_region32_not_empty(&surface_blend)) {
-			repaint_region(ev, output, &repaint, &surface_blend, PIXMAN_OP_OVER);
+			repaint_region(ev, output, target, &repaint, &surface_blend, PIXMAN_OP_OVER);
 		}
 		pixman_region32_fini(&surface_blend);
 	}
@@ -434,14 +720,76 @@ out:
 	pixman_region32_fini(&repaint);
 }
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct weston_output *output, pixman_image_t *target,
+		 pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_view *view;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
 		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+			draw_view(view, output, target, damage);
+}
+
+/* Maps hardware buffer pixels back to the upright shadow image. */
+static void
+shadow_copy_transform(pixman_transform_t *transform,
+		      enum wl_output_transform copy_transform,
+		      int width, int height)
+{
+	pixman_fixed_t fw = pixman_int_to_fixed(width);
+	pixman_fixed_t fh = pixman_int_to_fixed(height);
+
+	pixman_transform_init_identity(transform);
+
+	switch (copy_transform) {
+	default:
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		pixman_transform_rotate(transform, NULL, 0, -pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, 0, fh);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		pixman_transform_rotate(transform, NULL, -pixman_fixed_1, 0);
+		pixman_transform_translate(transform, NULL, fw, fh);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		pixman_transform_rotate(transform, NULL, 0, pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, fw, 0);
+		break;
+	}
+}
+
+/* region is in shadow image coordinates and within its bounds */
+static void
+copy_to_hw_buffer_rotated(struct weston_output *output,
+			  pixman_region32_t *region)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	int width = pixman_image_get_width(po->shadow_image);
+	int height = pixman_image_get_height(po->shadow_image);
+	int src_stride = pixman_image_get_stride(po->shadow_image);
+	int dst_stride = pixman_image_get_stride(po->hw_buffer);
+	uint32_t *src = pixman_image_get_data(po->shadow_image);
+	uint32_t *dst = pixman_image_get_data(po->hw_buffer);
+	pixman_box32_t *rects, box;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++) {
+		box = weston_transformed_rect(width, height,
+					      po->copy_transform, 1, rects[i]);
+
+		pixel_blit_rotate32((enum pixel_rotation) po->copy_transform,
+				    dst + box.y1 * (dst_stride / 4) + box.x1,
+				    dst_stride,
+				    src + rects[i].y1 * (src_stride / 4) +
+				    rects[i].x1,
+				    src_stride,
+				    rects[i].x2 - rects[i].x1,
+				    rects[i].y2 - rects[i].y1);
+	}
 }
 
 static void
@@ -449,12 +797,34 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 {
 	struct pixman_output_state *po = get_output_state(output);
 	pixman_region32_t output_region;
+	pixman_transform_t transform;
+	int width, height;
 
 	pixman_region32_init(&output_region);
 	pixman_region32_copy(&output_region, region);
 
 	region_global_to_output(output, &output_region);
 
+	if (po->copy_transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		width = pixman_image_get_width(po->shadow_image);
+		height = pixman_image_get_height(po->shadow_image);
+		pixman_region32_intersect_rect(&output_region, &output_region,
+					       0, 0, width, height);
+
+		if (pixman_image_get_format(po->hw_buffer) == PIXMAN_x8r8g8b8) {
+			copy_to_hw_buffer_rotated(output, &output_region);
+			pixman_region32_fini(&output_region);
+			return;
+		}
+
+		/* No kernel for this format, let pixman do the rotation. */
+		weston_transformed_region(width, height, po->copy_transform, 1,
+					  &output_region, &output_region);
+		shadow_copy_transform(&transform, po->copy_transform,
+				      width, height);
+		pixman_image_set_transform(po->shadow_image, &transform);
+	}
+
 	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
@@ -468,19 +838,320 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 				 pixman_image_get_height (po->hw_buffer) /* height */);
 
 	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	pixman_image_set_transform(po->shadow_image, NULL);
+
+	pixman_region32_fini(&output_region);
+}
+
+/* Collects the parts of damage, in global coordinates, where some view
+ * has to be blended rather than simply copied. */
+static void
+blended_region(struct weston_output *output, pixman_region32_t *damage,
+	       pixman_region32_t *blend)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view *ev;
+	struct pixman_surface_state *ps;
+	pixman_region32_t repaint, surface_blend;
+	float view_x, view_y;
+
+	wl_list_for_each(ev, &compositor->view_list, link) {
+		if (ev->plane != &compositor->primary_plane)
+			continue;
+
+		ps = get_surface_state(ev->surface);
+		if (!ps->image)
+			continue;
+
+		if (view_is_solid_fill(ev))
+			continue;
+
+		pixman_region32_init(&repaint);
+		pixman_region32_intersect(&repaint,
+					  &ev->transform.boundingbox, damage);
+		pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+
+		if (ev->alpha != 1.0 ||
+		    (ev->transform.enabled &&
+		     ev->transform.matrix.type !=
+		     WESTON_MATRIX_TRANSFORM_TRANSLATE)) {
+			pixman_region32_union(blend, blend, &repaint);
+		} else {
+			pixman_region32_init_rect(&surface_blend, 0, 0,
+						  ev->surface->width,
+						  ev->surface->height);
+			pixman_region32_subtract(&surface_blend,
+						 &surface_blend,
+						 &ev->surface->opaque);
+			weston_view_to_global_float(ev, 0, 0,
+						    &view_x, &view_y);
+			pixman_region32_translate(&surface_blend,
+						  (int)view_x, (int)view_y);
+			pixman_region32_intersect(&surface_blend,
+						  &surface_blend, &repaint);
+			pixman_region32_union(blend, blend, &surface_blend);
+			pixman_region32_fini(&surface_blend);
+		}
+
+		pixman_region32_fini(&repaint);
+	}
+}
+
+static uint32_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint32_t area = 0;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static int
+native_format16(pixman_format_code_t format, enum pixel_format16 *out)
+{
+	switch (format) {
+	case PIXMAN_r5g6b5:
+		*out = PIXEL_FORMAT_R5G6B5;
+		return 1;
+	case PIXMAN_x1r5g5b5:
+		*out = PIXEL_FORMAT_X1R5G5B5;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* region is in output coordinates */
+static void
+copy_to_hw_buffer_dithered(struct weston_output *output,
+			   pixman_region32_t *region,
+			   enum pixel_format16 format)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	int src_stride = pixman_image_get_stride(po->shadow_image);
+	int dst_stride = pixman_image_get_stride(po->hw_buffer);
+	uint32_t *src = pixman_image_get_data(po->shadow_image);
+	uint16_t *dst = (uint16_t *) pixman_image_get_data(po->hw_buffer);
+	pixman_box32_t *rects;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		pixel_blit_dither16(format,
+				    dst + rects[i].y1 * (dst_stride / 2) +
+				    rects[i].x1,
+				    dst_stride,
+				    src + rects[i].y1 * (src_stride / 4) +
+				    rects[i].x1,
+				    src_stride,
+				    rects[i].x1, rects[i].y1,
+				    rects[i].x2 - rects[i].x1,
+				    rects[i].y2 - rects[i].y1);
+}
+
+static void
+repaint_output_native(struct weston_output *output,
+		      pixman_region32_t *output_damage)
+{
+	struct pixman_renderer *pr =
+		(struct pixman_renderer *) output->compositor->renderer;
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t blend, direct;
+	enum pixel_format16 format;
+
+	pixman_region32_init(&blend);
+	pixman_region32_init(&direct);
+
+	blended_region(output, output_damage, &blend);
+	pixman_region32_subtract(&direct, output_damage, &blend);
+
+	/* Nothing in the direct region needs to read back the destination,
+	 * so it can be composited in the frame buffer format. */
+	if (pixman_region32_not_empty(&direct))
+		repaint_surfaces(output, po->hw_buffer, &direct);
+
+	if (pixman_region32_not_empty(&blend)) {
+		repaint_surfaces(output, po->shadow_image, &blend);
+
+		if (native_format16(pixman_image_get_format(po->hw_buffer),
+				    &format)) {
+			region_global_to_output(output, &blend);
+			pixman_region32_intersect_rect(&blend, &blend, 0, 0,
+				pixman_image_get_width(po->shadow_image),
+				pixman_image_get_height(po->shadow_image));
+			copy_to_hw_buffer_dithered(output, &blend, format);
+		} else {
+			copy_to_hw_buffer(output, &blend);
+		}
+	}
+
+	if (pr->stats_debug) {
+		po->stats_direct += region_area(&direct);
+		po->stats_blended += region_area(&blend);
+	}
+
+	pixman_region32_fini(&direct);
+	pixman_region32_fini(&blend);
+}
+
+static void
+stats_report(struct weston_output *output, int force)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	uint32_t now, elapsed;
+	uint64_t written, shadow_written;
+	int bpp;
+
+	now = weston_compositor_get_time();
+	elapsed = now - po->stats_time;
+	if (!force && elapsed < STATS_INTERVAL_MS)
+		return;
+
+	if (po->stats_frames > 0 && po->hw_buffer) {
+		weston_log("pixman: output %s: %u frames in %u ms, "
+			   "%u fills, %u composites\n",
+			   output->name ? output->name : "unnamed",
+			   po->stats_frames, elapsed,
+			   po->stats_fills, po->stats_composites);
+
+		/* Direct pixels are written once in the frame buffer format;
+		 * blended ones are written to and read back from the shadow,
+		 * then written again in the frame buffer format. */
+		bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(po->hw_buffer));
+		written = po->stats_direct * bpp / 8 +
+			  po->stats_blended * (8 + bpp / 8);
+		shadow_written = (po->stats_direct + po->stats_blended) *
+				 (8 + bpp / 8);
+		if (po->stats_direct || po->stats_blended)
+			weston_log_continue(STAMP_SPACE "%" PRIu64 " px direct, "
+					    "%" PRIu64 " px blended, ~%" PRIu64
+					    " kB written (%" PRIu64 " kB with "
+					    "a 32 bpp shadow)\n",
+					    po->stats_direct,
+					    po->stats_blended,
+					    written / 1024,
+					    shadow_written / 1024);
+	}
+
+	po->stats_time = now;
+	po->stats_frames = 0;
+	po->stats_fills = 0;
+	po->stats_composites = 0;
+	po->stats_direct = 0;
+	po->stats_blended = 0;
+}
+
+static void
+draw_heatmap(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t tile;
+	pixman_box32_t box, *rects;
+	pixman_color_t color;
+	float rgba[4];
+	int tx, ty, nrects;
+
+	pixman_region32_init(&tile);
+
+	for (ty = 0; ty < po->heatmap.height; ty++) {
+		for (tx = 0; tx < po->heatmap.width; tx++) {
+			if (!damage_heatmap_tile(&po->heatmap, tx, ty,
+						 &box, rgba))
+				continue;
+
+			/* The overlay goes on the hardware buffer, so that
+			 * the shadow image stays clean. */
+			pixman_region32_reset(&tile, &box);
+			pixman_region32_intersect(&tile, &tile,
+						  &output->region);
+			pixman_region32_translate(&tile,
+						  -output->x, -output->y);
+			weston_transformed_region(output->width,
+						  output->height,
+						  output->transform,
+						  output->current_scale,
+						  &tile, &tile);
+
+			color.red = rgba[0] * 0xffff;
+			color.green = rgba[1] * 0xffff;
+			color.blue = rgba[2] * 0xffff;
+			color.alpha = rgba[3] * 0xffff;
+
+			rects = pixman_region32_rectangles(&tile, &nrects);
+			pixman_image_fill_boxes(PIXMAN_OP_OVER, po->hw_buffer,
+						&color, nrects, rects);
+		}
+	}
+
+	pixman_region32_fini(&tile);
+}
+
+static uint64_t
+take_damage_area(struct weston_surface *surface)
+{
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	uint64_t area = ps->damage_area;
+
+	ps->damage_area = 0;
+
+	return area;
 }
 
 static void
 pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
+	struct pixman_renderer *pr =
+		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_output_state *po = get_output_state(output);
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	pr->frame_fills = 0;
+	pr->frame_composites = 0;
+
+	if (pr->heatmap_debug && !po->heatmap.history)
+		damage_heatmap_init(&po->heatmap, output->x, output->y,
+				    output->width, output->height);
+
+	if (po->heatmap.history) {
+		damage_heatmap_add_frame(&po->heatmap, output_damage);
+
+		/* The overlay covers the whole output, so have it all
+		 * repainted and flushed by the backend. */
+		pixman_region32_union(output_damage, output_damage,
+				      &output->region);
+	}
+
+	if (po->native_composite && !pr->repaint_debug &&
+	    !po->heatmap.history &&
+	    PIXMAN_FORMAT_BPP(pixman_image_get_format(po->hw_buffer)) < 32) {
+		repaint_output_native(output, output_damage);
+	} else {
+		repaint_surfaces(output, po->shadow_image, output_damage);
+		copy_to_hw_buffer(output, output_damage);
+	}
+
+	if (po->heatmap.history) {
+		draw_heatmap(output);
+		damage_heatmap_report_surfaces(&pr->heatmap_report_time,
+					       output->compositor,
+					       take_damage_area);
+	}
+
+	if (pr->stats_debug) {
+		po->stats_fills += pr->frame_fills;
+		po->stats_composites += pr->frame_composites;
+		po->stats_frames++;
+		stats_report(output, 0);
+	}
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -491,7 +1162,35 @@ pixman_renderer_repaint_output(struct weston_output *output,
 static void
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	pixman_box32_t *extents;
+
+	if (get_renderer(surface->compositor)->heatmap_debug)
+		ps->damage_area += region_area(&surface->damage);
+
+	/* This runs on every repaint, damaged or not.  An undamaged cache
+	 * is still good, and surface_cache_prepare() drops it if the size
+	 * or viewport changed. */
+	if (!pixman_region32_not_empty(&surface->damage))
+		return;
+
+	ps->idle_repaints = 0;
+
+	if (!ps->image || !surface_cache_valid(surface)) {
+		surface_cache_drop(ps);
+		return;
+	}
+
+	/* Surfaces that keep redrawing most of themselves are not static,
+	 * so stop paying for the extra copy until they settle down. */
+	extents = pixman_region32_extents(&surface->damage);
+	if ((extents->x2 - extents->x1) * (extents->y2 - extents->y1) * 2 >
+	    surface->width * surface->height) {
+		surface_cache_drop(ps);
+		return;
+	}
+
+	surface_cache_update(surface, &surface->damage);
 }
 
 static void
@@ -518,6 +1217,7 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	pixman_format_code_t pixman_format;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
+	ps->solid = 0;
 
 	if (ps->buffer_destroy_listener.notify) {
 		wl_list_remove(&ps->buffer_destroy_listener.link);
@@ -529,8 +1229,10 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		ps->image = NULL;
 	}
 
-	if (!buffer)
+	if (!buffer) {
+		surface_cache_drop(ps);
 		return;
+	}
 	
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
@@ -588,6 +1290,7 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	surface_cache_drop(ps);
 	weston_buffer_reference(&ps->buffer_ref, NULL);
 	free(ps);
 }
@@ -657,8 +1360,11 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	surface_cache_drop(ps);
 
 	ps->image = pixman_image_create_solid_fill(&color);
+	ps->solid = 1;
+	ps->solid_color = color;
 }
 
 static void
@@ -668,6 +1374,8 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	weston_binding_destroy(pr->stats_binding);
+	weston_binding_destroy(pr->heatmap_binding);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -694,15 +1402,64 @@ debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	}
 }
 
+static void
+stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+	      void *data)
+{
+	struct weston_compositor *ec = data;
+	struct pixman_renderer *pr = (struct pixman_renderer *) ec->renderer;
+	struct weston_output *output;
+	struct pixman_output_state *po;
+
+	pr->stats_debug ^= 1;
+
+	/* Turning stats off logs what was counted since the last report,
+	 * turning them on starts counting afresh. */
+	wl_list_for_each(output, &ec->output_list, link) {
+		po = get_output_state(output);
+		if (po)
+			stats_report(output, 1);
+	}
+}
+
+static void
+heatmap_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		void *data)
+{
+	struct weston_compositor *ec = data;
+	struct pixman_renderer *pr = (struct pixman_renderer *) ec->renderer;
+	struct weston_output *output;
+	struct pixman_output_state *po;
+
+	pr->heatmap_debug ^= 1;
+
+	if (pr->heatmap_debug) {
+		pr->heatmap_report_time = weston_compositor_get_time();
+	} else {
+		wl_list_for_each(output, &ec->output_list, link) {
+			po = get_output_state(output);
+			if (po)
+				damage_heatmap_release(&po->heatmap);
+		}
+	}
+
+	weston_compositor_damage_all(ec);
+}
+
 WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	struct weston_config_section *section;
 
 	renderer = calloc(1, sizeof *renderer);
 	if (renderer == NULL)
 		return -1;
 
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "pixman-surface-cache",
+				       &renderer->surface_cache, 0);
+
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
@@ -718,6 +1475,12 @@ pixman_renderer_init(struct weston_compositor *ec)
 	renderer->debug_binding =
 		weston_compositor_add_debug_binding(ec, KEY_R,
 						    debug_binding, ec);
+	renderer->stats_binding =
+		weston_compositor_add_debug_binding(ec, KEY_N,
+						    stats_binding, ec);
+	renderer->heatmap_binding =
+		weston_compositor_add_debug_binding(ec, KEY_H,
+						    heatmap_binding, ec);
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
 
@@ -754,6 +1517,23 @@ pixman_renderer_output_create(struct weston_output *output)
 	w = output->current_mode->width;
 	h = output->current_mode->height;
 
+	switch (output->transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_270:
+		w = output->current_mode->height;
+		h = output->current_mode->width;
+		/* fall through */
+	case WL_OUTPUT_TRANSFORM_180:
+		po->copy_transform = output->transform;
+		weston_log("pixman renderer: rotating output with %s "
+			   "blitter\n",
+			   pixel_blit_impl_name(pixel_blit_best_impl()));
+		break;
+	default:
+		po->copy_transform = WL_OUTPUT_TRANSFORM_NORMAL;
+		break;
+	}
+
 	po->shadow_buffer = malloc(w * h * 4);
 
 	if (!po->shadow_buffer) {
@@ -776,11 +1556,27 @@ pixman_renderer_output_create(struct weston_output *output)
 	return 0;
 }
 
+WL_EXPORT void
+pixman_renderer_output_set_native_composite(struct weston_output *output,
+					    int enable)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (enable && po->copy_transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		weston_log("pixman renderer: native compositing is not "
+			   "supported on rotated outputs\n");
+		return;
+	}
+
+	po->native_composite = enable;
+}
+
 WL_EXPORT void
 pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	damage_heatmap_release(&po->heatmap);
 	pixman_image_unref(po->shadow_image);
 
 	if (po->hw_buffer)
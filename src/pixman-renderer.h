@@ -33,5 +33,9 @@ pixman_renderer_output_create(struct weston_output *output);
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
 
+void
+pixman_renderer_output_set_native_composite(struct weston_output *output,
+					    int enable);
+
 void
 pixman_renderer_output_destroy(struct weston_output *output);
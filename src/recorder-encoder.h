@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _RECORDER_ENCODER_H_
+#define _RECORDER_ENCODER_H_
+
+#include <stdint.h>
+
+/* Video encoders for the screen recorder.  The recorder keeps a complete
+ * copy of the output up to date from the damage of each repaint and
+ * passes it to the encoder from its worker thread, so encoders may be
+ * slow but must not call into the compositor from frame or destroy. */
+
+enum recorder_encoder_format {
+	RECORDER_FORMAT_XRGB8888,
+	RECORDER_FORMAT_XBGR8888,
+};
+
+struct recorder_encoder {
+	/* Encodes a full frame, top row first.  msecs is the output frame
+	 * time.  Returns -1 on failure, after which only destroy is
+	 * called. */
+	int (*frame)(struct recorder_encoder *encoder,
+		     const uint32_t *pixels, int stride, uint32_t msecs);
+	void (*destroy)(struct recorder_encoder *encoder);
+};
+
+struct recorder_encoder_backend {
+	const char *name;
+	const char *extension;
+	struct recorder_encoder *(*create)(int width, int height,
+					   enum recorder_encoder_format format,
+					   const char *filename);
+};
+
+#ifdef BUILD_VPX_RECORDER
+extern const struct recorder_encoder_backend vpx_recorder_backend;
+#endif
+
+#endif /* _RECORDER_ENCODER_H_ */
@@ -39,6 +39,13 @@
 #include "../shared/os-compatibility.h"
 #include "fullscreen-shell-client-protocol.h"
 
+/* Frames committed to the parent compositor whose frame callback has not
+ * come back yet.  Allowing more than one lets reading back the next frame
+ * overlap with the parent presenting the previous one. */
+#define SS_MAX_FRAMES_IN_FLIGHT 2
+
+#define SS_STATS_INTERVAL 10000 /* ms */
+
 struct shared_output {
 	struct weston_output *output;
 	struct wl_listener output_destroyed;
@@ -53,7 +60,8 @@ struct shared_output {
 		struct _wl_fullscreen_shell *fshell;
 		struct wl_output *output;
 		struct wl_surface *surface;
-		struct wl_callback *frame_cb;
+		struct wl_list frame_list;
+		int frames_in_flight;
 		struct _wl_fullscreen_shell_mode_feedback *mode_feedback;
 	} parent;
 
@@ -68,9 +76,26 @@ struct shared_output {
 	} shm;
 
 	int cache_dirty;
+	uint32_t cache_time; /* of the oldest repaint not yet sent */
 	pixman_image_t *cache_image;
 	uint32_t *tmp_data;
 	size_t tmp_data_size;
+
+	struct {
+		uint32_t start;
+		uint32_t frames;
+		uint64_t bytes_read;
+		uint64_t bytes_copied;
+		uint32_t latency_total;
+		uint32_t latency_max;
+	} stats;
+};
+
+struct ss_frame {
+	struct shared_output *output;
+	struct wl_callback *callback;
+	struct wl_list link;
+	uint32_t capture_time;
 };
 
 struct ss_seat {
@@ -405,7 +430,8 @@ shared_output_get_shm_buffer(struct shared_output *so)
 	    so->shm.height != height) {
 
 		/* Destroy free buffers */
-		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers, link)
+		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers,
+				      free_link)
 			ss_shm_buffer_destroy(sb);
 
 		/* Orphan in-use buffers so they get destroyed */
@@ -571,16 +597,65 @@ shared_output_ensure_tmp_data(struct shared_output *so,
 static void
 shared_output_update(struct shared_output *so);
 
+static uint32_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *r;
+	uint32_t area = 0;
+	int i, nrects;
+
+	r = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	return area;
+}
+
 static void
-shared_output_frame_callback(void *data, struct wl_callback *cb, uint32_t time)
+ss_frame_destroy(struct ss_frame *frame)
 {
-	struct shared_output *so = data;
+	wl_callback_destroy(frame->callback);
+	wl_list_remove(&frame->link);
+	free(frame);
+}
 
-	if (cb != so->parent.frame_cb)
-		return;
+static void
+shared_output_log_stats(struct shared_output *so, uint32_t now)
+{
+	if (so->stats.frames > 0)
+		weston_log("screen-share: %u frames in %u ms, "
+			   "%llu kB read back, %llu kB copied, "
+			   "latency avg %u ms max %u ms\n",
+			   so->stats.frames, now - so->stats.start,
+			   (unsigned long long) so->stats.bytes_read / 1024,
+			   (unsigned long long) so->stats.bytes_copied / 1024,
+			   so->stats.latency_total / so->stats.frames,
+			   so->stats.latency_max);
+
+	memset(&so->stats, 0, sizeof so->stats);
+	so->stats.start = now;
+}
 
-	wl_callback_destroy(cb);
-	so->parent.frame_cb = NULL;
+/* The latency is from the repaint the frame was read back in to the
+ * parent compositor showing it. */
+static void
+shared_output_frame_callback(void *data, struct wl_callback *cb, uint32_t time)
+{
+	struct ss_frame *frame = data;
+	struct shared_output *so = frame->output;
+	uint32_t now, latency;
+
+	now = weston_compositor_get_time();
+	latency = now - frame->capture_time;
+	so->stats.frames++;
+	so->stats.latency_total += latency;
+	if (latency > so->stats.latency_max)
+		so->stats.latency_max = latency;
+	if (now - so->stats.start >= SS_STATS_INTERVAL)
+		shared_output_log_stats(so, now);
+
+	ss_frame_destroy(frame);
+	so->parent.frames_in_flight--;
 
 	shared_output_update(so);
 }
@@ -589,21 +664,34 @@ static const struct wl_callback_listener shared_output_frame_listener = {
 	shared_output_frame_callback
 };
 
+static int
+output_is_untransformed(struct weston_output *output)
+{
+	return output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		output->current_scale == 1;
+}
+
+/* Bring the parts of the buffer that changed since it was last sent up
+ * to date from the cache. */
 static void
-shared_output_update(struct shared_output *so)
+shared_output_copy_damage(struct shared_output *so, struct ss_shm_buffer *sb)
 {
-	struct ss_shm_buffer *sb;
-	pixman_box32_t *r;
-	int i, nrects;
 	pixman_transform_t transform;
-
-	/* Only update if we need to */
-	if (!so->cache_dirty || so->parent.frame_cb)
-		return;
-
-	sb = shared_output_get_shm_buffer(so);
-	if (sb == NULL) {
-		shared_output_destroy(so);
+	pixman_box32_t *r;
+	int i, nrects, stride;
+
+	/* Without a transform, the buffer and the cache line up, so the
+	 * damaged rectangles can just be copied. */
+	if (output_is_untransformed(so->output) &&
+	    pixman_image_get_width(so->cache_image) == so->shm.width &&
+	    pixman_image_get_height(so->cache_image) == so->shm.height) {
+		stride = so->shm.width;
+		r = pixman_region32_rectangles(&sb->damage, &nrects);
+		for (i = 0; i < nrects; i++)
+			pixman_blt(pixman_image_get_data(so->cache_image),
+				   sb->data, stride, stride, 32, 32,
+				   r[i].x1, r[i].y1, r[i].x1, r[i].y1,
+				   r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
 		return;
 	}
 
@@ -632,6 +720,35 @@ shared_output_update(struct shared_output *so)
 
 	pixman_image_set_transform(sb->pm_image, NULL);
 	pixman_image_set_clip_region32(sb->pm_image, NULL);
+}
+
+static void
+shared_output_update(struct shared_output *so)
+{
+	struct ss_shm_buffer *sb;
+	struct ss_frame *frame;
+	pixman_box32_t *r;
+	int i, nrects;
+
+	/* Only update if we need to */
+	if (!so->cache_dirty ||
+	    so->parent.frames_in_flight >= SS_MAX_FRAMES_IN_FLIGHT)
+		return;
+
+	sb = shared_output_get_shm_buffer(so);
+	if (sb == NULL) {
+		shared_output_destroy(so);
+		return;
+	}
+
+	frame = zalloc(sizeof *frame);
+	if (frame == NULL) {
+		shared_output_destroy(so);
+		return;
+	}
+
+	shared_output_copy_damage(so, sb);
+	so->stats.bytes_copied += 4 * region_area(&sb->damage);
 
 	r = pixman_region32_rectangles(&sb->damage, &nrects);
 	for (i = 0; i < nrects; ++i)
@@ -640,14 +757,19 @@ shared_output_update(struct shared_output *so)
 
 	wl_surface_attach(so->parent.surface, sb->buffer, 0, 0);
 
-	so->parent.frame_cb = wl_surface_frame(so->parent.surface);
-	wl_callback_add_listener(so->parent.frame_cb,
-				 &shared_output_frame_listener, so);
+	frame->output = so;
+	frame->capture_time = so->cache_time;
+	frame->callback = wl_surface_frame(so->parent.surface);
+	wl_callback_add_listener(frame->callback,
+				 &shared_output_frame_listener, frame);
+	wl_list_insert(&so->parent.frame_list, &frame->link);
+	so->parent.frames_in_flight++;
 
 	wl_surface_commit(so->parent.surface);
-	wl_callback_destroy(wl_display_sync(so->parent.display));
 	wl_display_flush(so->parent.display);
 
+	so->cache_dirty = 0;
+
 	/* Clear the buffer damage */
 	pixman_region32_fini(&sb->damage);
 	pixman_region32_init(&sb->damage);
@@ -847,8 +969,11 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		}
 	}
 
+	so->stats.bytes_read += 4 * region_area(&damage);
 	pixman_region32_fini(&damage);
 
+	if (!so->cache_dirty)
+		so->cache_time = weston_compositor_get_time();
 	so->cache_dirty = 1;
 
 	shared_output_update(so);
@@ -934,6 +1059,8 @@ shared_output_create(struct weston_output *output, int parent_fd)
 	/* Ok, everything's created.  We should be good to go */
 	wl_list_init(&so->shm.buffers);
 	wl_list_init(&so->shm.free_buffers);
+	wl_list_init(&so->parent.frame_list);
+	so->stats.start = weston_compositor_get_time();
 
 	so->output = output;
 	so->output_destroyed.notify = output_destroyed;
@@ -961,13 +1088,18 @@ static void
 shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
+	struct ss_frame *frame, *fnext;
 
 	so->output->disable_planes--;
 
+	shared_output_log_stats(so, weston_compositor_get_time());
+
+	wl_list_for_each_safe(frame, fnext, &so->parent.frame_list, link)
+		ss_frame_destroy(frame);
+
+	/* Free buffers are on both lists. */
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
-	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, link)
-		ss_shm_buffer_destroy(buffer);
 
 	wl_display_disconnect(so->parent.display);
 	wl_event_source_remove(so->event_source);
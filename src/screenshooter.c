@@ -29,9 +29,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <pthread.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
 
 #include "compositor.h"
 #include "screenshooter-server-protocol.h"
+#include "pixel-blit.h"
+#include "recorder-encoder.h"
 
 #include "../wcap/wcap-decode.h"
 
@@ -45,31 +52,31 @@ struct screenshooter {
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
+	struct wl_listener buffer_destroy_listener;
+	struct weston_compositor *compositor;
 	struct weston_buffer *buffer;
+	int32_t x, y, width, height;
 	weston_screenshooter_done_func_t done;
 	void *data;
 };
 
+/* The copies take a signed source stride, so a y-flipped capture is
+ * copied straight into the client buffer by walking the source from its
+ * last row upwards. */
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_bgra(uint8_t *dst, int dst_stride, uint8_t *src, int src_stride,
+	  int height, int bytes)
 {
 	uint8_t *end;
 
-	end = dst + height * stride;
+	end = dst + height * dst_stride;
 	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
+		memcpy(dst, src, bytes);
+		dst += dst_stride;
+		src += src_stride;
 	}
 }
 
-static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
-}
-
 static void
 copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 {
@@ -88,29 +95,111 @@ copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_rgba(uint8_t *dst, int dst_stride, uint8_t *src, int src_stride,
+	  int height, int bytes)
 {
 	uint8_t *end;
 
-	end = dst + height * stride;
+	end = dst + height * dst_stride;
 	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+		copy_row_swap_RB(dst, src, bytes);
+		dst += dst_stride;
+		src += src_stride;
 	}
 }
 
+/* Copy a width x height block read back from the renderer to dst_x,
+ * dst_y in a client shm buffer. */
 static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_to_shm_buffer(struct weston_compositor *compositor,
+		   struct wl_shm_buffer *shm_buffer, int32_t dst_x, int32_t dst_y,
+		   uint8_t *pixels, int stride, int32_t width, int32_t height)
 {
-	uint8_t *end;
+	int32_t dst_stride, bpp;
+	uint8_t *d;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
+	bpp = PIXMAN_FORMAT_BPP(compositor->read_format) / 8;
+	dst_stride = wl_shm_buffer_get_stride(shm_buffer);
+	d = wl_shm_buffer_get_data(shm_buffer);
+	d += dst_y * dst_stride + dst_x * bpp;
+
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP) {
+		pixels += stride * (height - 1);
+		stride = -stride;
+	}
+
+	wl_shm_buffer_begin_access(shm_buffer);
+
+	switch (compositor->read_format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		copy_bgra(d, dst_stride, pixels, stride, height, width * bpp);
+		break;
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_a8b8g8r8:
+		copy_rgba(d, dst_stride, pixels, stride, height, width * bpp);
+		break;
+	default:
+		break;
 	}
+
+	wl_shm_buffer_end_access(shm_buffer);
+}
+
+/* Output frame buffer rows are read bottom up when captures need a
+ * y-flip. */
+static int32_t
+read_y(struct weston_output *output, int32_t y, int32_t height)
+{
+	if (output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		return output->current_mode->height - y - height;
+	else
+		return y;
+}
+
+static int
+rect_fits_mode(struct weston_output *output, int32_t x, int32_t y,
+	       int32_t width, int32_t height)
+{
+	return x >= 0 && y >= 0 && width > 0 && height > 0 &&
+		x <= output->current_mode->width - width &&
+		y <= output->current_mode->height - height;
+}
+
+static void
+screenshooter_frame_listener_destroy(struct screenshooter_frame_listener *l)
+{
+	if (l->buffer)
+		wl_list_remove(&l->buffer_destroy_listener.link);
+	free(l);
+}
+
+static void
+screenshooter_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
+
+	l->buffer = NULL;
+}
+
+static void
+screenshooter_read_done(void *data, void *pixels, int stride)
+{
+	struct screenshooter_frame_listener *l = data;
+
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+	} else if (pixels == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+	} else {
+		copy_to_shm_buffer(l->compositor, l->buffer->shm_buffer, 0, 0,
+				   pixels, stride, l->width, l->height);
+		l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+	}
+
+	screenshooter_frame_listener_destroy(l);
 }
 
 static void
@@ -121,62 +210,53 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 			     struct screenshooter_frame_listener, listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
+	struct weston_renderer *renderer = compositor->renderer;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	uint8_t *pixels;
 
 	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
 
-	if (pixels == NULL) {
-		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
-		free(l);
+	/* The mode may have changed since the shot was requested. */
+	if (l->buffer == NULL ||
+	    !rect_fits_mode(output, l->x, l->y, l->width, l->height)) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		screenshooter_frame_listener_destroy(l);
 		return;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
-
-	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
-
-	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	/* Let the renderer finish the read in the background if it can,
+	 * rather than stall the compositor on it. */
+	if (renderer->read_pixels_async &&
+	    renderer->read_pixels_async(output, compositor->read_format,
+					l->x, read_y(output, l->y, l->height),
+					l->width, l->height,
+					screenshooter_read_done, l) == 0)
+		return;
 
-	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
+	stride = l->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+	pixels = malloc(stride * l->height);
 
-	switch (compositor->read_format) {
-	case PIXMAN_a8r8g8b8:
-	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
-		break;
-	case PIXMAN_x8b8g8r8:
-	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
-		break;
-	default:
-		break;
+	if (pixels == NULL) {
+		screenshooter_read_done(l, NULL, 0);
+		return;
 	}
 
-	wl_shm_buffer_end_access(l->buffer->shm_buffer);
+	renderer->read_pixels(output, compositor->read_format, pixels,
+			      l->x, read_y(output, l->y, l->height),
+			      l->width, l->height);
 
-	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+	screenshooter_read_done(l, pixels, stride);
 	free(pixels);
-	free(l);
 }
 
 WL_EXPORT int
-weston_screenshooter_shoot(struct weston_output *output,
-			   struct weston_buffer *buffer,
-			   weston_screenshooter_done_func_t done, void *data)
+weston_screenshooter_shoot_region(struct weston_output *output,
+				  struct weston_buffer *buffer,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  weston_screenshooter_done_func_t done,
+				  void *data)
 {
 	struct screenshooter_frame_listener *l;
 
@@ -189,8 +269,8 @@ weston_screenshooter_shoot(struct weston_output *output,
 	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
 
-	if (buffer->width < output->current_mode->width ||
-	    buffer->height < output->current_mode->height) {
+	if (!rect_fits_mode(output, x, y, width, height) ||
+	    buffer->width < width || buffer->height < height) {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
@@ -201,7 +281,14 @@ weston_screenshooter_shoot(struct weston_output *output,
 		return -1;
 	}
 
+	l->compositor = output->compositor;
+	l->x = x;
+	l->y = y;
+	l->width = width;
+	l->height = height;
 	l->buffer = buffer;
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &l->buffer_destroy_listener);
 	l->done = done;
 	l->data = data;
 	l->listener.notify = screenshooter_frame_notify;
@@ -212,6 +299,17 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+WL_EXPORT int
+weston_screenshooter_shoot(struct weston_output *output,
+			   struct weston_buffer *buffer,
+			   weston_screenshooter_done_func_t done, void *data)
+{
+	return weston_screenshooter_shoot_region(output, buffer, 0, 0,
+						 output->current_mode->width,
+						 output->current_mode->height,
+						 done, data);
+}
+
 static void
 screenshooter_done(void *data, enum weston_screenshooter_outcome outcome)
 {
@@ -248,8 +346,362 @@ screenshooter_shoot(struct wl_client *client,
 	weston_screenshooter_shoot(output, buffer, screenshooter_done, resource);
 }
 
+static void
+screenshooter_shoot_region(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *output_resource,
+			   struct wl_resource *buffer_resource,
+			   int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct weston_buffer *buffer =
+		weston_buffer_from_resource(buffer_resource);
+
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	weston_screenshooter_shoot_region(output, buffer, x, y, width, height,
+					  screenshooter_done, resource);
+}
+
+/* A stream keeps capturing a rectangle of an output into a ring of
+ * client buffers.  Each buffer remembers which parts of the rectangle
+ * have changed since it was last filled, so only those are read back
+ * when it comes round again. */
+#define STREAM_MAX_READS 16
+
+struct screenshooter_stream {
+	struct wl_resource *resource;
+	struct weston_output *output;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	int32_t x, y, width, height;
+
+	/* changed since the last buffer was returned, relative to x, y */
+	pixman_region32_t pending;
+
+	struct wl_list buffer_list;
+	struct wl_list queue;
+
+	uint8_t *pixels;
+	int size;
+};
+
+struct stream_buffer {
+	struct screenshooter_stream *stream;
+	struct weston_buffer *buffer;
+	struct wl_listener destroy_listener;
+	struct wl_list link;		/* screenshooter_stream::buffer_list */
+	struct wl_list queue_link;	/* screenshooter_stream::queue */
+	int queued;
+
+	/* not up to date in this buffer, relative to stream x, y */
+	pixman_region32_t stale;
+};
+
+static void
+stream_buffer_destroy(struct stream_buffer *sb)
+{
+	wl_list_remove(&sb->destroy_listener.link);
+	wl_list_remove(&sb->link);
+	if (sb->queued)
+		wl_list_remove(&sb->queue_link);
+	pixman_region32_fini(&sb->stale);
+	free(sb);
+}
+
+static void
+stream_buffer_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct stream_buffer *sb =
+		container_of(listener, struct stream_buffer, destroy_listener);
+
+	stream_buffer_destroy(sb);
+}
+
+static struct stream_buffer *
+stream_get_buffer(struct screenshooter_stream *stream,
+		  struct weston_buffer *buffer)
+{
+	struct stream_buffer *sb;
+
+	wl_list_for_each(sb, &stream->buffer_list, link)
+		if (sb->buffer == buffer)
+			return sb;
+
+	sb = zalloc(sizeof *sb);
+	if (sb == NULL)
+		return NULL;
+
+	sb->stream = stream;
+	sb->buffer = buffer;
+	sb->destroy_listener.notify = stream_buffer_handle_destroy;
+	wl_signal_add(&buffer->destroy_signal, &sb->destroy_listener);
+	pixman_region32_init_rect(&sb->stale, 0, 0,
+				  stream->width, stream->height);
+	wl_list_insert(&stream->buffer_list, &sb->link);
+
+	return sb;
+}
+
+static int
+stream_fill_buffer(struct screenshooter_stream *stream,
+		   struct stream_buffer *sb)
+{
+	struct weston_output *output = stream->output;
+	struct weston_compositor *compositor = output->compositor;
+	pixman_box32_t *rects;
+	int i, n, width, height, stride, size;
+	uint8_t *pixels;
+
+	/* Each read back is a round trip to the renderer, so past a handful
+	 * of rectangles, read their bounding box once instead. */
+	rects = pixman_region32_rectangles(&sb->stale, &n);
+	if (n > STREAM_MAX_READS) {
+		rects = pixman_region32_extents(&sb->stale);
+		n = 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		width = rects[i].x2 - rects[i].x1;
+		height = rects[i].y2 - rects[i].y1;
+		stride = width * 4;
+		size = stride * height;
+
+		if (size > stream->size) {
+			pixels = realloc(stream->pixels, size);
+			if (pixels == NULL)
+				return -1;
+			stream->pixels = pixels;
+			stream->size = size;
+		}
+
+		compositor->renderer->read_pixels(output,
+				compositor->read_format, stream->pixels,
+				stream->x + rects[i].x1,
+				read_y(output, stream->y + rects[i].y1, height),
+				width, height);
+		copy_to_shm_buffer(compositor, sb->buffer->shm_buffer,
+				   rects[i].x1, rects[i].y1,
+				   stream->pixels, stride, width, height);
+	}
+
+	pixman_region32_fini(&sb->stale);
+	pixman_region32_init(&sb->stale);
+
+	return 0;
+}
+
+static void
+stream_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_stream *stream =
+		container_of(listener, struct screenshooter_stream,
+			     frame_listener);
+	struct weston_output *output = data;
+	struct stream_buffer *sb;
+	pixman_region32_t damage;
+	pixman_box32_t *rects;
+	int i, n;
+
+	/* Bring the damage of this repaint to frame buffer coordinates,
+	 * as the recorder does, and then relative to the rectangle. */
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &output->region,
+				  &output->previous_damage);
+	pixman_region32_translate(&damage, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				  output->transform, output->current_scale,
+				  &damage, &damage);
+	pixman_region32_intersect_rect(&damage, &damage,
+				       stream->x, stream->y,
+				       stream->width, stream->height);
+	pixman_region32_translate(&damage, -stream->x, -stream->y);
+
+	pixman_region32_union(&stream->pending, &stream->pending, &damage);
+	wl_list_for_each(sb, &stream->buffer_list, link)
+		pixman_region32_union(&sb->stale, &sb->stale, &damage);
+	pixman_region32_fini(&damage);
+
+	if (!pixman_region32_not_empty(&stream->pending) ||
+	    wl_list_empty(&stream->queue))
+		return;
+
+	sb = container_of(stream->queue.next, struct stream_buffer,
+			  queue_link);
+	wl_list_remove(&sb->queue_link);
+	sb->queued = 0;
+
+	if (!rect_fits_mode(output, stream->x, stream->y,
+			    stream->width, stream->height) ||
+	    stream_fill_buffer(stream, sb) < 0) {
+		screenshooter_stream_send_failed(stream->resource,
+						 sb->buffer->resource);
+		return;
+	}
+
+	rects = pixman_region32_rectangles(&stream->pending, &n);
+	for (i = 0; i < n; i++)
+		screenshooter_stream_send_damage(stream->resource,
+						 rects[i].x1, rects[i].y1,
+						 rects[i].x2 - rects[i].x1,
+						 rects[i].y2 - rects[i].y1);
+	screenshooter_stream_send_ready(stream->resource,
+					sb->buffer->resource,
+					output->frame_time);
+
+	pixman_region32_fini(&stream->pending);
+	pixman_region32_init(&stream->pending);
+}
+
+static void
+stream_detach_output(struct screenshooter_stream *stream)
+{
+	if (stream->output == NULL)
+		return;
+
+	wl_list_remove(&stream->frame_listener.link);
+	wl_list_remove(&stream->output_destroy_listener.link);
+	stream->output->disable_planes--;
+	stream->output = NULL;
+}
+
+static void
+stream_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_stream *stream =
+		container_of(listener, struct screenshooter_stream,
+			     output_destroy_listener);
+
+	stream_detach_output(stream);
+}
+
+static void
+stream_capture(struct wl_client *client, struct wl_resource *resource,
+	       struct wl_resource *buffer_resource)
+{
+	struct screenshooter_stream *stream =
+		wl_resource_get_user_data(resource);
+	struct weston_buffer *buffer;
+	struct stream_buffer *sb;
+
+	buffer = weston_buffer_from_resource(buffer_resource);
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (stream->output == NULL || buffer->shm_buffer == NULL ||
+	    wl_shm_buffer_get_width(buffer->shm_buffer) < stream->width ||
+	    wl_shm_buffer_get_height(buffer->shm_buffer) < stream->height) {
+		screenshooter_stream_send_failed(resource, buffer_resource);
+		return;
+	}
+	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
+	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+
+	sb = stream_get_buffer(stream, buffer);
+	if (sb == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	if (sb->queued)
+		return;
+
+	sb->queued = 1;
+	wl_list_insert(stream->queue.prev, &sb->queue_link);
+
+	if (pixman_region32_not_empty(&stream->pending))
+		weston_output_schedule_repaint(stream->output);
+}
+
+static void
+stream_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct screenshooter_stream_interface stream_implementation = {
+	stream_destroy,
+	stream_capture
+};
+
+static void
+destroy_stream(struct wl_resource *resource)
+{
+	struct screenshooter_stream *stream =
+		wl_resource_get_user_data(resource);
+	struct stream_buffer *sb, *next;
+
+	stream_detach_output(stream);
+
+	wl_list_for_each_safe(sb, next, &stream->buffer_list, link)
+		stream_buffer_destroy(sb);
+
+	pixman_region32_fini(&stream->pending);
+	free(stream->pixels);
+	free(stream);
+}
+
+static void
+screenshooter_create_stream(struct wl_client *client,
+			    struct wl_resource *resource, uint32_t id,
+			    struct wl_resource *output_resource,
+			    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct screenshooter_stream *stream;
+
+	stream = zalloc(sizeof *stream);
+	if (stream == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	stream->resource =
+		wl_resource_create(client, &screenshooter_stream_interface,
+				   1, id);
+	if (stream->resource == NULL) {
+		free(stream);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	stream->x = x;
+	stream->y = y;
+	stream->width = width;
+	stream->height = height;
+	pixman_region32_init_rect(&stream->pending, 0, 0, width, height);
+	wl_list_init(&stream->buffer_list);
+	wl_list_init(&stream->queue);
+
+	wl_resource_set_implementation(stream->resource,
+				       &stream_implementation,
+				       stream, destroy_stream);
+
+	/* Without an output, every buffer queued fails. */
+	if (!rect_fits_mode(output, x, y, width, height))
+		return;
+
+	stream->output = output;
+	stream->frame_listener.notify = stream_frame_notify;
+	wl_signal_add(&output->frame_signal, &stream->frame_listener);
+	stream->output_destroy_listener.notify = stream_output_destroyed;
+	wl_signal_add(&output->destroy_signal,
+		      &stream->output_destroy_listener);
+	output->disable_planes++;
+}
+
 struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
+	screenshooter_shoot,
+	screenshooter_shoot_region,
+	screenshooter_create_stream
 };
 
 static void
@@ -259,8 +711,8 @@ bind_shooter(struct wl_client *client,
 	struct screenshooter *shooter = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client,
-				      &screenshooter_interface, 1, id);
+	resource = wl_resource_create(client, &screenshooter_interface,
+				      MIN(version, 2), id);
 
 	if (client != shooter->client) {
 		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
@@ -294,49 +746,241 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 					screenshooter_exe, screenshooter_sigchld);
 }
 
+/* Captured frames waiting for the encoder thread.  When the encoder
+ * falls behind, frames are dropped and their damage is carried over to
+ * the next frame that is captured. */
+#define RECORDER_QUEUE_LENGTH 4
+
+/* A full frame is captured and encoded against black this often, so that
+ * wcap-decode can start decoding there when seeking.  Video encoders
+ * place their own keyframes. */
+#define RECORDER_KEYFRAME_INTERVAL 2000 /* ms */
+
+struct recorder_frame {
+	uint32_t msecs;
+	int keyframe;
+	pixman_region32_t damage; /* in frame buffer coordinates */
+	uint32_t *pixels; /* the damage rectangles as read, one by one */
+	int size; /* in pixels */
+};
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
+	uint32_t *frame, *outbuf; /* owned by the encoder thread */
+	int width, height;
+	int do_yflip;
+	uint64_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	pixman_region32_t dropped_damage;
+	uint32_t last_keyframe;
+
+	/* Replaces the wcap writer when set */
+	struct recorder_encoder *encoder;
+	int encoder_failed;
+
+	char *compressed; /* owned by the encoder thread */
+	int compressed_size;
+	struct wcap_index_entry *index;
+	uint32_t index_count, index_alloc;
+	int index_failed;
+
+	pthread_t worker_thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t queue_cond;
+	struct recorder_frame queue[RECORDER_QUEUE_LENGTH];
+	int head, length;
+	int quit;
+	uint32_t frames_encoded, frames_dropped;
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+static void
+weston_recorder_destroy(struct weston_recorder *recorder);
+
+static void
+recorder_add_index_entry(struct weston_recorder *recorder,
+			 uint32_t msecs, uint32_t flags, uint64_t offset)
 {
-	int i;
+	struct wcap_index_entry *index;
+	uint32_t alloc;
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
-		}
+	if (recorder->index_failed)
+		return;
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+	if (recorder->index_count == recorder->index_alloc) {
+		alloc = recorder->index_alloc ? recorder->index_alloc * 2 : 256;
+		index = realloc(recorder->index, alloc * sizeof *index);
+		if (index == NULL) {
+			/* wcap-decode rebuilds a missing index on load. */
+			recorder->index_failed = 1;
+			return;
+		}
+		recorder->index = index;
+		recorder->index_alloc = alloc;
 	}
 
-	return p;
+	index = &recorder->index[recorder->index_count++];
+	index->msecs = msecs;
+	index->flags = flags;
+	index->offset = offset;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static void
+recorder_encode_frame(struct weston_recorder *recorder,
+		      struct recorder_frame *frame)
 {
-	unsigned char dr, dg, db;
+	static const char padding[4];
+	struct wcap_frame_header_v2 header;
+	struct pixel_rle_state state;
+	pixman_box32_t *r;
+	int i, j, n, width, height, y;
+	uint32_t *s;
+	struct iovec v[4];
+
+	r = pixman_region32_rectangles(&frame->damage, &n);
+
+	header.msecs = frame->msecs;
+	header.nrects = n;
+	header.flags = 0;
+
+	/* Keyframes cover the whole output and are encoded against black,
+	 * so decoding can start at any of them. */
+	if (frame->keyframe) {
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+		header.flags |= WCAP_FRAME_KEYFRAME;
+	}
+
+	state.out = recorder->outbuf;
+	s = frame->pixels;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		state.prev = 0;
+		state.run = 0;
+		for (j = 0; j < height; j++) {
+			if (recorder->do_yflip)
+				y = r[i].y2 - j - 1;
+			else
+				y = r[i].y1 + j;
+
+			pixel_blit_delta_rle(&state, recorder->frame +
+					     recorder->width * y + r[i].x1,
+					     s, width);
+			s += width;
+		}
+		pixel_blit_delta_rle_finish(&state);
+	}
+
+	header.raw_size = (state.out - recorder->outbuf) * 4;
+	header.size = header.raw_size;
+	v[2].iov_base = recorder->outbuf;
+
+#ifdef HAVE_LZ4
+	if (recorder->compressed) {
+		int size;
+
+		size = LZ4_compress_default((const char *) recorder->outbuf,
+					    recorder->compressed,
+					    header.raw_size,
+					    recorder->compressed_size);
+		if (size > 0 && (uint32_t) size < header.raw_size) {
+			header.size = size;
+			header.flags |= WCAP_FRAME_LZ4;
+			v[2].iov_base = recorder->compressed;
+		}
+	}
+#endif
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	recorder_add_index_entry(recorder, header.msecs, header.flags,
+				 recorder->total);
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+	v[1].iov_base = r;
+	v[1].iov_len = n * sizeof *r;
+	v[2].iov_len = header.size;
+	v[3].iov_base = (void *) padding;
+	v[3].iov_len = -header.size & 3;
+	recorder->total += writev(recorder->fd, v, 4);
 }
 
+/* Brings the copy of the output up to date and hands all of it to the
+ * video encoder. */
 static void
-weston_recorder_destroy(struct weston_recorder *recorder);
+recorder_encode_video_frame(struct weston_recorder *recorder,
+			    struct recorder_frame *frame)
+{
+	struct recorder_encoder *encoder = recorder->encoder;
+	pixman_box32_t *r;
+	int i, j, n, width, height, y;
+	uint32_t *s;
+
+	if (recorder->encoder_failed)
+		return;
+
+	r = pixman_region32_rectangles(&frame->damage, &n);
+	s = frame->pixels;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		for (j = 0; j < height; j++) {
+			if (recorder->do_yflip)
+				y = r[i].y2 - j - 1;
+			else
+				y = r[i].y1 + j;
+
+			memcpy(recorder->frame + recorder->width * y + r[i].x1,
+			       s, width * 4);
+			s += width;
+		}
+	}
+
+	if (encoder->frame(encoder, recorder->frame, recorder->width * 4,
+			   frame->msecs) < 0)
+		recorder->encoder_failed = 1;
+}
+
+static void *
+recorder_worker_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct recorder_frame *frame;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	while (1) {
+		while (recorder->length == 0 && !recorder->quit)
+			pthread_cond_wait(&recorder->queue_cond,
+					  &recorder->mutex);
+
+		/* Drain the queue before quitting. */
+		if (recorder->length == 0)
+			break;
+
+		/* The head slot is not reused by the compositor until it is
+		 * taken off the queue, so it can be encoded unlocked. */
+		frame = &recorder->queue[recorder->head];
+		pthread_mutex_unlock(&recorder->mutex);
+
+		if (recorder->encoder)
+			recorder_encode_video_frame(recorder, frame);
+		else
+			recorder_encode_frame(recorder, frame);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->head = (recorder->head + 1) % RECORDER_QUEUE_LENGTH;
+		recorder->length--;
+		recorder->frames_encoded++;
+	}
+
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return NULL;
+}
 
 static void
 weston_recorder_frame_notify(struct wl_listener *listener, void *data)
@@ -345,106 +989,100 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
+	struct recorder_frame *frame;
 	pixman_box32_t *r;
-	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	pixman_region32_t damage;
+	int i, n, area, width, height, y_orig, keyframe;
+	uint32_t *p;
 
 	pixman_region32_init(&damage);
-	pixman_region32_init(&transformed_damage);
 	pixman_region32_intersect(&damage, &output->region,
 				  &output->previous_damage);
 	pixman_region32_translate(&damage, -output->x, -output->y);
 	weston_transformed_region(output->width, output->height,
 				 output->transform, output->current_scale,
-				 &damage, &transformed_damage);
-	pixman_region32_fini(&damage);
+				 &damage, &damage);
+	pixman_region32_union(&damage, &damage, &recorder->dropped_damage);
+
+	r = pixman_region32_rectangles(&damage, &n);
+	if (n == 0)
+		goto out;
+
+	keyframe = recorder->count == 0 ||
+		(!recorder->encoder &&
+		 output->frame_time - recorder->last_keyframe >=
+		 RECORDER_KEYFRAME_INTERVAL);
+	if (keyframe) {
+		pixman_region32_union_rect(&damage, &damage, 0, 0,
+					   recorder->width, recorder->height);
+		r = pixman_region32_rectangles(&damage, &n);
+	}
 
-	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
+	pthread_mutex_lock(&recorder->mutex);
+	if (recorder->length == RECORDER_QUEUE_LENGTH) {
+		recorder->frames_dropped++;
+		frame = NULL;
+	} else {
+		frame = &recorder->queue[(recorder->head + recorder->length) %
+					 RECORDER_QUEUE_LENGTH];
 	}
+	pthread_mutex_unlock(&recorder->mutex);
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	if (frame == NULL) {
+		pixman_region32_copy(&recorder->dropped_damage, &damage);
+		goto out;
+	}
+
+	area = 0;
+	for (i = 0; i < n; i++)
+		area += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	if (area > frame->size) {
+		p = realloc(frame->pixels, area * 4);
+		if (p == NULL) {
+			weston_log("%s: out of memory\n", __func__);
+			pixman_region32_copy(&recorder->dropped_damage,
+					     &damage);
+			goto out;
+		}
+		frame->pixels = p;
+		frame->size = area;
+	}
 
+	p = frame->pixels;
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
+		if (recorder->do_yflip)
 			y_orig = output->current_mode->height - r[i].y2;
 		else
 			y_orig = r[i].y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
+				compositor->read_format, p,
 				r[i].x1, y_orig, width, height);
+		p += width * height;
+	}
 
-		s = recorder->rect;
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
-			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
-
-		p = output_run(p, prev, run);
+	frame->msecs = output->frame_time;
+	frame->keyframe = keyframe;
+	if (keyframe)
+		recorder->last_keyframe = frame->msecs;
+	pixman_region32_copy(&frame->damage, &damage);
+	pixman_region32_fini(&recorder->dropped_damage);
+	pixman_region32_init(&recorder->dropped_damage);
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->length++;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
-	}
-
-	pixman_region32_fini(&transformed_damage);
 	recorder->count++;
 
+out:
+	pixman_region32_fini(&damage);
+
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
 }
@@ -452,52 +1090,130 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 static void
 weston_recorder_free(struct weston_recorder *recorder)
 {
+	int i;
+
 	if (recorder == NULL)
 		return;
-	free(recorder->rect);
-	free(recorder->tmpbuf);
+
+	for (i = 0; i < RECORDER_QUEUE_LENGTH; i++) {
+		pixman_region32_fini(&recorder->queue[i].damage);
+		free(recorder->queue[i].pixels);
+	}
+	pixman_region32_fini(&recorder->dropped_damage);
+	free(recorder->index);
+	free(recorder->compressed);
+	free(recorder->outbuf);
 	free(recorder->frame);
 	free(recorder);
 }
 
+/* Video encoders built in, looked up by the encoder key of the
+ * [recorder] section.  wcap is always available. */
+static const struct recorder_encoder_backend *recorder_encoders[] = {
+#ifdef BUILD_VPX_RECORDER
+	&vpx_recorder_backend,
+#endif
+	NULL
+};
+
+static const struct recorder_encoder_backend *
+recorder_find_encoder(struct weston_compositor *compositor)
+{
+	const struct recorder_encoder_backend *backend = NULL;
+	struct weston_config_section *section;
+	char *name;
+	int i;
+
+	section = weston_config_get_section(compositor->config,
+					    "recorder", NULL, NULL);
+	weston_config_section_get_string(section, "encoder", &name, "wcap");
+
+	for (i = 0; recorder_encoders[i]; i++)
+		if (strcmp(recorder_encoders[i]->name, name) == 0)
+			backend = recorder_encoders[i];
+
+	if (!backend && strcmp(name, "wcap") != 0)
+		weston_log("recorder encoder %s not available, "
+			   "recording wcap\n", name);
+
+	free(name);
+
+	return backend;
+}
+
 static void
-weston_recorder_create(struct weston_output *output, const char *filename)
+weston_recorder_create(struct weston_output *output, const char *filename,
+		       const struct recorder_encoder_backend *backend)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
-	int stride, size;
+	enum recorder_encoder_format format;
+	int i, size;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	recorder = malloc(sizeof *recorder);
+	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
 		weston_log("%s: out of memory\n", __func__);
 		return;
 	}
 
-	stride = output->current_mode->width;
-	size = stride * 4 * output->current_mode->height;
+	for (i = 0; i < RECORDER_QUEUE_LENGTH; i++)
+		pixman_region32_init(&recorder->queue[i].damage);
+	pixman_region32_init(&recorder->dropped_damage);
+
+	recorder->width = output->current_mode->width;
+	recorder->height = output->current_mode->height;
+	size = recorder->width * 4 * recorder->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
-	recorder->total = 0;
-	recorder->count = 0;
-	recorder->destroying = 0;
+	if (!backend)
+		recorder->outbuf = malloc(size);
 	recorder->output = output;
+	recorder->fd = -1;
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) ||
+	    (!backend && recorder->outbuf == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		weston_recorder_free(recorder);
 		return;
 	}
 
-	if (do_yflip)
-		recorder->tmpbuf = NULL;
-	else
-		recorder->tmpbuf = malloc(size);
+	if (backend) {
+		switch (compositor->read_format) {
+		case PIXMAN_x8r8g8b8:
+		case PIXMAN_a8r8g8b8:
+			format = RECORDER_FORMAT_XRGB8888;
+			break;
+		case PIXMAN_a8b8g8r8:
+			format = RECORDER_FORMAT_XBGR8888;
+			break;
+		default:
+			weston_log("unknown recorder format\n");
+			weston_recorder_free(recorder);
+			return;
+		}
 
-	header.magic = WCAP_HEADER_MAGIC;
+		recorder->encoder = backend->create(recorder->width,
+						    recorder->height,
+						    format, filename);
+		if (!recorder->encoder) {
+			weston_log("failed to create %s recorder\n",
+				   backend->name);
+			weston_recorder_free(recorder);
+			return;
+		}
+
+		goto start;
+	}
+
+#ifdef HAVE_LZ4
+	/* Recording still works uncompressed if this fails. */
+	recorder->compressed_size = LZ4_compressBound(size);
+	recorder->compressed = malloc(recorder->compressed_size);
+#endif
+
+	header.magic = WCAP_HEADER_MAGIC_V2;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -522,22 +1238,98 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return;
 	}
 
-	header.width = output->current_mode->width;
-	header.height = output->current_mode->height;
+	header.width = recorder->width;
+	header.height = recorder->height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
 
+start:
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->queue_cond, NULL);
+	if (pthread_create(&recorder->worker_thread, NULL,
+			   recorder_worker_thread, recorder) != 0) {
+		weston_log("failed to start recorder thread\n");
+		pthread_mutex_destroy(&recorder->mutex);
+		pthread_cond_destroy(&recorder->queue_cond);
+		if (recorder->encoder)
+			recorder->encoder->destroy(recorder->encoder);
+		else
+			close(recorder->fd);
+		weston_recorder_free(recorder);
+		return;
+	}
+
+	if (backend)
+		weston_log("recorder using %s encoder\n", backend->name);
+	else
+		weston_log("recorder using %s delta encoder%s\n",
+			   pixel_blit_impl_name(pixel_blit_best_impl()),
+			   recorder->compressed ? ", lz4 compression" : "");
+
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
 	weston_output_damage(output);
 }
 
+/* The index lists every frame with its offset and ends with a fixed
+ * size trailer, so wcap-decode can find it from the end of the file. */
+static void
+recorder_write_index(struct weston_recorder *recorder)
+{
+	static const char padding[8];
+	struct wcap_index_trailer trailer;
+	struct iovec v[3];
+
+	if (recorder->index_failed)
+		return;
+
+	v[0].iov_base = (void *) padding;
+	v[0].iov_len = -recorder->total & 7;
+	trailer.offset = recorder->total + v[0].iov_len;
+	trailer.count = recorder->index_count;
+	trailer.magic = WCAP_INDEX_MAGIC;
+	v[1].iov_base = recorder->index;
+	v[1].iov_len = recorder->index_count * sizeof *recorder->index;
+	v[2].iov_base = &trailer;
+	v[2].iov_len = sizeof trailer;
+	recorder->total += writev(recorder->fd, v, 3);
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
-	close(recorder->fd);
 	recorder->output->disable_planes--;
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->quit = 1;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->worker_thread, NULL);
+
+	pthread_mutex_destroy(&recorder->mutex);
+	pthread_cond_destroy(&recorder->queue_cond);
+
+	if (recorder->encoder) {
+		if (recorder->encoder_failed)
+			weston_log("recorder encoder failed, "
+				   "recording is incomplete\n");
+		weston_log("recorder stopped, %u frames encoded, "
+			   "%u dropped\n",
+			   recorder->frames_encoded, recorder->frames_dropped);
+		recorder->encoder->destroy(recorder->encoder);
+		weston_recorder_free(recorder);
+		return;
+	}
+
+	recorder_write_index(recorder);
+
+	weston_log("recorder stopped, total file size %dM, "
+		   "%u frames encoded, %u dropped\n",
+		   (int) (recorder->total / (1024 * 1024)),
+		   recorder->frames_encoded, recorder->frames_dropped);
+
+	close(recorder->fd);
 	weston_recorder_free(recorder);
 }
 
@@ -549,7 +1341,8 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 	struct weston_output *output;
 	struct wl_listener *listener = NULL;
 	struct weston_recorder *recorder;
-	static const char filename[] = "capture.wcap";
+	const struct recorder_encoder_backend *backend;
+	char filename[32];
 
 	wl_list_for_each(output, &seat->compositor->output_list, link) {
 		listener = wl_signal_get(&output->frame_signal,
@@ -562,9 +1355,8 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 		recorder = container_of(listener, struct weston_recorder,
 					frame_listener);
 
-		weston_log(
-			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
+		weston_log("stopping recorder, %d frames captured\n",
+			   recorder->count);
 
 		recorder->destroying = 1;
 		weston_output_schedule_repaint(recorder->output);
@@ -576,9 +1368,13 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *da
 			output = container_of(ec->output_list.next,
 					      struct weston_output, link);
 
+		backend = recorder_find_encoder(ec);
+		snprintf(filename, sizeof filename, "capture.%s",
+			 backend ? backend->extension : "wcap");
+
 		weston_log("starting recorder for output %s, file %s\n",
 			   output->name, filename);
-		weston_recorder_create(output, filename);
+		weston_recorder_create(output, filename, backend);
 	}
 }
 
@@ -605,7 +1401,7 @@ screenshooter_create(struct weston_compositor *ec)
 	shooter->client = NULL;
 
 	shooter->global = wl_global_create(ec->wl_display,
-					   &screenshooter_interface, 1,
+					   &screenshooter_interface, 2,
 					   shooter, bind_shooter);
 	weston_compositor_add_key_binding(ec, KEY_S, MODIFIER_SUPER,
 					  screenshooter_binding, shooter);
@@ -90,6 +90,12 @@ device_added(struct udev_device *udev_device, struct udev_input *input)
 		return 0;
 	}
 
+	if (input->input_thread)
+		evdev_input_thread_add_device(input->input_thread, device);
+
+	device->record_fd = input->record_fd;
+	device->record_id = input->record_next_id++;
+
 	calibration_values =
 		udev_device_get_property_value(udev_device,
 					       "WL_CALIBRATION");
@@ -313,17 +319,40 @@ int
 udev_input_init(struct udev_input *input, struct weston_compositor *c, struct udev *udev,
 		const char *seat_id)
 {
+	struct weston_config_section *section;
+	int input_thread;
+	char *record;
+
 	memset(input, 0, sizeof *input);
 	input->seat_id = strdup(seat_id);
 	input->compositor = c;
 	input->udev = udev;
 	input->udev = udev_ref(udev);
+
+	section = weston_config_get_section(c->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "input-thread",
+				       &input_thread, 0);
+	if (input_thread)
+		input->input_thread = evdev_input_thread_create(c);
+
+	input->record_fd = -1;
+	weston_config_section_get_string(section, "record-input",
+					 &record, NULL);
+	if (record) {
+		input->record_fd = evdev_record_open(record);
+		free(record);
+	}
+
 	if (udev_input_enable(input) < 0)
 		goto err;
 
 	return 0;
 
  err:
+	if (input->input_thread)
+		evdev_input_thread_destroy(input->input_thread);
+	if (input->record_fd >= 0)
+		close(input->record_fd);
 	free(input->seat_id);
 	return -1;
 }
@@ -335,6 +364,10 @@ udev_input_destroy(struct udev_input *input)
 	udev_input_disable(input);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
+	if (input->input_thread)
+		evdev_input_thread_destroy(input->input_thread);
+	if (input->record_fd >= 0)
+		close(input->record_fd);
 	udev_unref(input->udev);
 	free(input->seat_id);
 }
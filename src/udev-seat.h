@@ -41,6 +41,9 @@ struct udev_input {
 	struct wl_event_source *udev_monitor_source;
 	char *seat_id;
 	struct weston_compositor *compositor;
+	struct evdev_input_thread *input_thread;
+	int record_fd;
+	uint32_t record_next_id;
 	int enabled;
 };
 
@@ -49,8 +49,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
-#include <assert.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -89,30 +89,60 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
+#define MAX_QUEUE_LENGTH 16
+
+struct recorder_input {
+	VASurfaceID surface;
+	uint32_t msecs;
+	uint64_t queue_time; /* us */
+};
+
 struct vaapi_recorder {
 	int drm_fd, output_fd;
 	int width, height;
 	int frame_count;
 
+	/* The raw H.264 stream has no timestamps, so the frame times are
+	 * written to a separate timecode file (mkvmerge format v2). */
+	FILE *timecodes;
+	uint32_t first_msecs;
+
 	int error;
 	int destroying;
 	pthread_t worker_thread;
 	pthread_mutex_t mutex;
 	pthread_cond_t input_cond;
+	pthread_cond_t space_cond;
+
+	/* Frames waiting for the worker thread.  The scanout buffers are
+	 * reused once flipped away from, so each frame is converted into
+	 * a YUV surface of our own before it is queued.  There is one
+	 * surface more than the queue holds, for the frame being encoded,
+	 * and the unused ones are kept in free. */
+	struct {
+		struct recorder_input *frames;
+		int size, head, length;
+		enum vaapi_recorder_policy policy;
+		VASurfaceID *surfaces, *free;
+		int nfree;
+	} queue;
 
 	struct {
-		int valid;
-		int prime_fd, stride;
-	} input;
+		uint32_t queued, encoded, dropped;
+		uint64_t latency_total; /* us */
+		uint64_t latency_max;
+		uint64_t blocked; /* us */
+	} stats;
 
 	VADisplay va_dpy;
 
-	/* video post processing is used for colorspace conversion */
+	/* video post processing is used for colorspace conversion.  It
+	 * only runs on the compositor thread and the encoder only on the
+	 * worker thread. */
 	struct {
 		VAConfigID cfg;
 		VAContextID ctx;
 		VABufferID pipeline_buf;
-		VASurfaceID output;
 	} vpp;
 
 	struct {
@@ -841,8 +871,12 @@ encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 		vaDestroyBuffer(r->va_dpy, buffers[--count]);
 	} while (ret == OUTPUT_WRITE_OVERFLOW);
 
-	if (ret == OUTPUT_WRITE_FATAL)
-		r->error = errno;
+	if (ret == OUTPUT_WRITE_FATAL) {
+		i = errno;
+		pthread_mutex_lock(&r->mutex);
+		r->error = i;
+		pthread_mutex_unlock(&r->mutex);
+	}
 
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
@@ -887,18 +921,8 @@ setup_vpp(struct vaapi_recorder *r)
 		goto err_ctx;
 	}
 
-	status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_YUV420,
-				  r->width, r->height, &r->vpp.output, 1,
-				  NULL, 0);
-	if (status != VA_STATUS_SUCCESS) {
-		weston_log("vaapi: failed to create YUV surface\n");
-		goto err_buf;
-	}
-
 	return 0;
 
-err_buf:
-	vaDestroyBuffer(r->va_dpy, r->vpp.pipeline_buf);
 err_ctx:
 	vaDestroyConfig(r->va_dpy, r->vpp.ctx);
 err_cfg:
@@ -910,20 +934,67 @@ err_cfg:
 static void
 vpp_destroy(struct vaapi_recorder *r)
 {
-	vaDestroySurfaces(r->va_dpy, &r->vpp.output, 1);
 	vaDestroyBuffer(r->va_dpy, r->vpp.pipeline_buf);
 	vaDestroyConfig(r->va_dpy, r->vpp.ctx);
 	vaDestroyConfig(r->va_dpy, r->vpp.cfg);
 }
 
+static int
+setup_queue_surfaces(struct vaapi_recorder *r)
+{
+	VAStatus status;
+	int count = r->queue.size + 1;
+
+	r->queue.surfaces = calloc(count, sizeof *r->queue.surfaces);
+	r->queue.free = calloc(count, sizeof *r->queue.free);
+	if (!r->queue.surfaces || !r->queue.free)
+		goto err_free;
+
+	status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_YUV420,
+				  r->width, r->height, r->queue.surfaces,
+				  count, NULL, 0);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("vaapi: failed to create YUV surfaces\n");
+		goto err_free;
+	}
+
+	memcpy(r->queue.free, r->queue.surfaces, count * sizeof *r->queue.free);
+	r->queue.nfree = count;
+
+	return 0;
+
+err_free:
+	free(r->queue.surfaces);
+	free(r->queue.free);
+	r->queue.surfaces = NULL;
+	r->queue.free = NULL;
+
+	return -1;
+}
+
+static void
+queue_surfaces_destroy(struct vaapi_recorder *r)
+{
+	vaDestroySurfaces(r->va_dpy, r->queue.surfaces, r->queue.size + 1);
+	free(r->queue.surfaces);
+	free(r->queue.free);
+}
+
 static int
 setup_worker_thread(struct vaapi_recorder *r)
 {
 	pthread_mutex_init(&r->mutex, NULL);
 	pthread_cond_init(&r->input_cond, NULL);
-	pthread_create(&r->worker_thread, NULL, worker_thread_function, r);
+	pthread_cond_init(&r->space_cond, NULL);
+	if (pthread_create(&r->worker_thread, NULL,
+			   worker_thread_function, r) != 0) {
+		pthread_mutex_destroy(&r->mutex);
+		pthread_cond_destroy(&r->input_cond);
+		pthread_cond_destroy(&r->space_cond);
+		return -1;
+	}
 
-	return 1;
+	return 0;
 }
 
 static void
@@ -931,7 +1002,8 @@ destroy_worker_thread(struct vaapi_recorder *r)
 {
 	pthread_mutex_lock(&r->mutex);
 
-	/* Make sure the worker thread finishes */
+	/* Make sure the worker thread finishes, after encoding what is
+	 * still queued */
 	r->destroying = 1;
 	pthread_cond_signal(&r->input_cond);
 
@@ -941,15 +1013,18 @@ destroy_worker_thread(struct vaapi_recorder *r)
 
 	pthread_mutex_destroy(&r->mutex);
 	pthread_cond_destroy(&r->input_cond);
+	pthread_cond_destroy(&r->space_cond);
 }
 
 struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename,
+		      int queue_length, enum vaapi_recorder_policy policy)
 {
 	struct vaapi_recorder *r;
 	VAStatus status;
 	int major, minor;
 	int flags;
+	char *timecodes;
 
 	r = calloc(1, sizeof *r);
 	if (!r)
@@ -959,14 +1034,32 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 	r->height = height;
 	r->drm_fd = drm_fd;
 
-	if (setup_worker_thread(r) < 0)
+	if (queue_length < 1)
+		queue_length = 1;
+	if (queue_length > MAX_QUEUE_LENGTH)
+		queue_length = MAX_QUEUE_LENGTH;
+	r->queue.frames = calloc(queue_length, sizeof *r->queue.frames);
+	if (!r->queue.frames)
 		goto err_free;
+	r->queue.size = queue_length;
+	r->queue.policy = policy;
+
+	if (setup_worker_thread(r) < 0)
+		goto err_queue;
 
 	flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
 	r->output_fd = open(filename, flags, 0644);
 	if (r->output_fd < 0)
 		goto err_thread;
 
+	if (asprintf(&timecodes, "%s.timecodes", filename) < 0)
+		goto err_fd;
+	r->timecodes = fopen(timecodes, "we");
+	free(timecodes);
+	if (!r->timecodes)
+		goto err_fd;
+	fprintf(r->timecodes, "# timecode format v2\n");
+
 	r->va_dpy = vaGetDisplayDRM(drm_fd);
 	if (!r->va_dpy) {
 		weston_log("failed to create VA display\n");
@@ -984,20 +1077,29 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename)
 		goto err_va_dpy;
 	}
 
-	if (setup_encoder(r) < 0) {
+	if (setup_queue_surfaces(r) < 0)
 		goto err_vpp;
+
+	if (setup_encoder(r) < 0) {
+		goto err_surfaces;
 	}
 
 	return r;
 
+err_surfaces:
+	queue_surfaces_destroy(r);
 err_vpp:
 	vpp_destroy(r);
 err_va_dpy:
 	vaTerminate(r->va_dpy);
 err_fd:
+	if (r->timecodes)
+		fclose(r->timecodes);
 	close(r->output_fd);
 err_thread:
 	destroy_worker_thread(r);
+err_queue:
+	free(r->queue.frames);
 err_free:
 	free(r);
 
@@ -1009,17 +1111,39 @@ vaapi_recorder_destroy(struct vaapi_recorder *r)
 {
 	destroy_worker_thread(r);
 
+	weston_log("[libva recorder] %u frames encoded, %u dropped, "
+		   "encode latency avg %.1f ms max %.1f ms, "
+		   "compositor blocked %.1f ms\n",
+		   r->stats.encoded, r->stats.dropped,
+		   r->stats.encoded ?
+		   r->stats.latency_total / 1000.0 / r->stats.encoded : 0.0,
+		   r->stats.latency_max / 1000.0,
+		   r->stats.blocked / 1000.0);
+
 	encoder_destroy(r);
+	queue_surfaces_destroy(r);
 	vpp_destroy(r);
 
 	vaTerminate(r->va_dpy);
 
+	fclose(r->timecodes);
 	close(r->output_fd);
 	close(r->drm_fd);
 
+	free(r->queue.frames);
 	free(r);
 }
 
+static uint64_t
+get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static VAStatus
 create_surface_from_fd(struct vaapi_recorder *r, int prime_fd,
 		       int stride, VASurfaceID *surface)
@@ -1060,7 +1184,8 @@ create_surface_from_fd(struct vaapi_recorder *r, int prime_fd,
 }
 
 static VAStatus
-convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
+convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface,
+		   VASurfaceID output)
 {
 	VAProcPipelineParameterBuffer *pipeline_param;
 	VAStatus status;
@@ -1082,7 +1207,7 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, r->vpp.output);
+	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, output);
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
@@ -1095,55 +1220,90 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	return status;
+	return vaSyncSurface(r->va_dpy, output);
 }
 
-static void
-recorder_frame(struct vaapi_recorder *r)
+/* Copies the scanout buffer into output while it still holds this
+ * frame.  Takes ownership of prime_fd. */
+static int
+recorder_convert(struct vaapi_recorder *r, int prime_fd, int stride,
+		 VASurfaceID output)
 {
 	VASurfaceID rgb_surface;
 	VAStatus status;
 
-	status = create_surface_from_fd(r, r->input.prime_fd,
-					r->input.stride, &rgb_surface);
+	status = create_surface_from_fd(r, prime_fd, stride, &rgb_surface);
+	close(prime_fd);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "failed to create surface from bo\n");
-		return;
+		return -1;
 	}
 
-	close(r->input.prime_fd);
-
-	status = convert_rgb_to_yuv(r, rgb_surface);
+	status = convert_rgb_to_yuv(r, rgb_surface, output);
+	vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[libva recorder] "
 			   "color space conversion failed\n");
-		return;
+		return -1;
 	}
 
-	encoder_encode(r, r->vpp.output);
+	return 0;
+}
+
+static void
+recorder_frame(struct vaapi_recorder *r, struct recorder_input *input)
+{
+	int count = r->frame_count;
+
+	encoder_encode(r, input->surface);
 
-	vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
+	if (r->frame_count == count)
+		return;
+
+	if (count == 0)
+		r->first_msecs = input->msecs;
+	fprintf(r->timecodes, "%u\n", input->msecs - r->first_msecs);
 }
 
 static void *
 worker_thread_function(void *data)
 {
 	struct vaapi_recorder *r = data;
+	struct recorder_input input;
+	uint64_t latency;
 
 	pthread_mutex_lock(&r->mutex);
 
-	while (!r->destroying) {
-		if (!r->input.valid)
+	while (1) {
+		while (r->queue.length == 0 && !r->destroying)
 			pthread_cond_wait(&r->input_cond, &r->mutex);
 
-		/* If the thread is awaken by destroy_worker_thread(),
-		 * there might not be valid input */
-		if (!r->input.valid)
+		/* Encode what is left in the queue before quitting */
+		if (r->queue.length == 0)
+			break;
+
+		input = r->queue.frames[r->queue.head];
+		r->queue.head = (r->queue.head + 1) % r->queue.size;
+		r->queue.length--;
+		pthread_cond_signal(&r->space_cond);
+
+		if (r->error) {
+			r->queue.free[r->queue.nfree++] = input.surface;
 			continue;
+		}
+
+		pthread_mutex_unlock(&r->mutex);
+		recorder_frame(r, &input);
+		latency = get_time_us() - input.queue_time;
+		pthread_mutex_lock(&r->mutex);
 
-		recorder_frame(r);
-		r->input.valid = 0;
+		r->queue.free[r->queue.nfree++] = input.surface;
+
+		r->stats.encoded++;
+		r->stats.latency_total += latency;
+		if (latency > r->stats.latency_max)
+			r->stats.latency_max = latency;
 	}
 
 	pthread_mutex_unlock(&r->mutex);
@@ -1151,26 +1311,77 @@ worker_thread_function(void *data)
 	return NULL;
 }
 
+/* Queues a frame for encoding and takes ownership of prime_fd.  msecs is
+ * the frame time, written to the timecode file.  When the queue is full
+ * the policy decides whether to wait for the encoder, or which frame to
+ * drop.  The frame is converted to YUV before this returns, so the
+ * caller may reuse the buffer right away. */
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
+vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride,
+		     uint32_t msecs)
 {
+	struct recorder_input *input;
+	VASurfaceID surface;
+	uint64_t now, start;
 	int ret = 0;
 
+	now = get_time_us();
+
 	pthread_mutex_lock(&r->mutex);
 
 	if (r->error) {
 		errno = r->error;
 		ret = -1;
+		close(prime_fd);
+		goto unlock;
+	}
+
+	r->stats.queued++;
+
+	if (r->queue.length == r->queue.size) {
+		switch (r->queue.policy) {
+		case VAAPI_RECORDER_BLOCK:
+			start = now;
+			while (r->queue.length == r->queue.size)
+				pthread_cond_wait(&r->space_cond, &r->mutex);
+			now = get_time_us();
+			r->stats.blocked += now - start;
+			break;
+		case VAAPI_RECORDER_DROP_OLDEST:
+			r->queue.free[r->queue.nfree++] =
+				r->queue.frames[r->queue.head].surface;
+			r->queue.head = (r->queue.head + 1) % r->queue.size;
+			r->queue.length--;
+			r->stats.dropped++;
+			break;
+		case VAAPI_RECORDER_DROP_NEWEST:
+			close(prime_fd);
+			r->stats.dropped++;
+			goto unlock;
+		}
+	}
+
+	/* With the queue not full, at most size - 1 surfaces are queued
+	 * and one is being encoded, so one is free. */
+	surface = r->queue.free[--r->queue.nfree];
+	pthread_mutex_unlock(&r->mutex);
+
+	if (recorder_convert(r, prime_fd, stride, surface) < 0) {
+		pthread_mutex_lock(&r->mutex);
+		r->queue.free[r->queue.nfree++] = surface;
+		r->stats.dropped++;
 		goto unlock;
 	}
 
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if input.valid is true. */
-	assert(!r->input.valid);
+	pthread_mutex_lock(&r->mutex);
 
-	r->input.prime_fd = prime_fd;
-	r->input.stride = stride;
-	r->input.valid = 1;
+	/* Only this thread adds frames, so there is still room. */
+	input = &r->queue.frames[(r->queue.head + r->queue.length) %
+				 r->queue.size];
+	input->surface = surface;
+	input->msecs = msecs;
+	input->queue_time = now;
+	r->queue.length++;
 	pthread_cond_signal(&r->input_cond);
 
 unlock:
@@ -23,13 +23,24 @@
 #ifndef _VAAPI_RECORDER_H_
 #define _VAAPI_RECORDER_H_
 
+#include <stdint.h>
+
 struct vaapi_recorder;
 
+/* What vaapi_recorder_frame() does when the queue is full */
+enum vaapi_recorder_policy {
+	VAAPI_RECORDER_BLOCK,		/* wait for the encoder */
+	VAAPI_RECORDER_DROP_OLDEST,	/* replace the oldest queued frame */
+	VAAPI_RECORDER_DROP_NEWEST,	/* drop the new frame */
+};
+
 struct vaapi_recorder *
-vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
+vaapi_recorder_create(int drm_fd, int width, int height, const char *filename,
+		      int queue_length, enum vaapi_recorder_policy policy);
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r);
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride,
+		     uint32_t msecs);
 
 #endif /* _VAAPI_RECORDER_H_ */
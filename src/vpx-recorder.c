@@ -0,0 +1,319 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Software VP8 encoder for the screen recorder, writing an IVF file as
+ * produced by the libvpx tools, which ffmpeg and gstreamer can read. */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include "compositor.h"
+#include "recorder-encoder.h"
+
+#define VPX_RECORDER_MAX_THREADS 8
+#define VPX_RECORDER_KEYFRAME_INTERVAL 120 /* frames */
+
+struct ivf_header {
+	char signature[4];
+	uint16_t version;
+	uint16_t header_size;
+	char fourcc[4];
+	uint16_t width;
+	uint16_t height;
+	uint32_t rate;
+	uint32_t scale;
+	uint32_t frame_count;
+	uint32_t unused;
+} __attribute__ ((packed));
+
+struct ivf_frame_header {
+	uint32_t size;
+	uint64_t pts;
+} __attribute__ ((packed));
+
+struct vpx_recorder {
+	struct recorder_encoder base;
+	enum recorder_encoder_format format;
+	int width, height;
+	int fd;
+
+	vpx_codec_ctx_t codec;
+	vpx_image_t image;
+	uint32_t first_msecs;
+	int64_t last_pts;
+	uint32_t frame_count;
+};
+
+static inline int
+rgb_to_y(int r, int g, int b)
+{
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline int
+rgb_to_u(int r, int g, int b)
+{
+	return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline int
+rgb_to_v(int r, int g, int b)
+{
+	return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+/* BT.601 studio range, chroma from the average of each 2x2 block.  For
+ * odd sizes the last row and column stand in for the missing ones. */
+static void
+vpx_recorder_convert(struct vpx_recorder *r, const uint32_t *pixels,
+		     int stride)
+{
+	vpx_image_t *img = &r->image;
+	const uint32_t *row[2];
+	uint8_t *y_row, *u_row, *v_row;
+	int x, y, i, j, rs, gs, bs, rr, gg, bb, rshift, bshift;
+	uint32_t p;
+
+	if (r->format == RECORDER_FORMAT_XRGB8888) {
+		rshift = 16;
+		bshift = 0;
+	} else {
+		rshift = 0;
+		bshift = 16;
+	}
+
+	stride /= 4;
+	for (y = 0; y < r->height; y += 2) {
+		row[0] = pixels + y * stride;
+		row[1] = y + 1 < r->height ? row[0] + stride : row[0];
+		u_row = img->planes[VPX_PLANE_U] +
+			(y / 2) * img->stride[VPX_PLANE_U];
+		v_row = img->planes[VPX_PLANE_V] +
+			(y / 2) * img->stride[VPX_PLANE_V];
+
+		for (x = 0; x < r->width; x += 2) {
+			rs = gs = bs = 0;
+			for (j = 0; j < 2; j++) {
+				y_row = img->planes[VPX_PLANE_Y] +
+					(y + j) * img->stride[VPX_PLANE_Y];
+				for (i = 0; i < 2; i++) {
+					p = row[j][x + i < r->width ?
+						   x + i : x];
+					rr = (p >> rshift) & 0xff;
+					gg = (p >> 8) & 0xff;
+					bb = (p >> bshift) & 0xff;
+					if (y + j < r->height &&
+					    x + i < r->width)
+						y_row[x + i] =
+							rgb_to_y(rr, gg, bb);
+					rs += rr;
+					gs += gg;
+					bs += bb;
+				}
+			}
+
+			u_row[x / 2] = rgb_to_u(rs / 4, gs / 4, bs / 4);
+			v_row[x / 2] = rgb_to_v(rs / 4, gs / 4, bs / 4);
+		}
+	}
+}
+
+static int
+vpx_recorder_write_packets(struct vpx_recorder *r)
+{
+	const vpx_codec_cx_pkt_t *pkt;
+	vpx_codec_iter_t iter = NULL;
+	struct ivf_frame_header header;
+
+	while ((pkt = vpx_codec_get_cx_data(&r->codec, &iter))) {
+		if (pkt->kind != VPX_CODEC_CX_FRAME_PKT)
+			continue;
+
+		header.size = pkt->data.frame.sz;
+		header.pts = pkt->data.frame.pts;
+		if (write(r->fd, &header, sizeof header) != sizeof header ||
+		    write(r->fd, pkt->data.frame.buf, pkt->data.frame.sz) !=
+		    (ssize_t) pkt->data.frame.sz)
+			return -1;
+
+		r->frame_count++;
+	}
+
+	return 0;
+}
+
+static int
+vpx_recorder_frame(struct recorder_encoder *base,
+		   const uint32_t *pixels, int stride, uint32_t msecs)
+{
+	struct vpx_recorder *r = (struct vpx_recorder *) base;
+	int64_t pts;
+
+	vpx_recorder_convert(r, pixels, stride);
+
+	/* The timebase is milliseconds, but libvpx wants strictly
+	 * increasing timestamps. */
+	if (r->last_pts < 0)
+		r->first_msecs = msecs;
+	pts = (uint32_t) (msecs - r->first_msecs);
+	if (pts <= r->last_pts)
+		pts = r->last_pts + 1;
+	r->last_pts = pts;
+
+	if (vpx_codec_encode(&r->codec, &r->image, pts, 1, 0,
+			     VPX_DL_REALTIME) != VPX_CODEC_OK)
+		return -1;
+
+	return vpx_recorder_write_packets(r);
+}
+
+static void
+vpx_recorder_destroy(struct recorder_encoder *base)
+{
+	struct vpx_recorder *r = (struct vpx_recorder *) base;
+	uint32_t count;
+
+	/* Flush any frames still held by the encoder. */
+	if (vpx_codec_encode(&r->codec, NULL, -1, 1, 0,
+			     VPX_DL_REALTIME) == VPX_CODEC_OK)
+		vpx_recorder_write_packets(r);
+
+	count = r->frame_count;
+	if (pwrite(r->fd, &count, sizeof count,
+		   offsetof(struct ivf_header, frame_count)) < 0)
+		weston_log("vpx recorder: failed to update frame count\n");
+
+	close(r->fd);
+	vpx_codec_destroy(&r->codec);
+	vpx_img_free(&r->image);
+	free(r);
+}
+
+static struct recorder_encoder *
+vpx_recorder_create(int width, int height,
+		    enum recorder_encoder_format format, const char *filename)
+{
+	struct vpx_recorder *r;
+	struct ivf_header header;
+	vpx_codec_enc_cfg_t cfg;
+	long threads;
+
+	if (vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &cfg, 0)) {
+		weston_log("vpx recorder: no default configuration\n");
+		return NULL;
+	}
+
+	r = zalloc(sizeof *r);
+	if (r == NULL)
+		return NULL;
+
+	r->base.frame = vpx_recorder_frame;
+	r->base.destroy = vpx_recorder_destroy;
+	r->format = format;
+	r->width = width;
+	r->height = height;
+	r->last_pts = -1;
+
+	if (!vpx_img_alloc(&r->image, VPX_IMG_FMT_I420, width, height, 16)) {
+		weston_log("vpx recorder: out of memory\n");
+		free(r);
+		return NULL;
+	}
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > VPX_RECORDER_MAX_THREADS)
+		threads = VPX_RECORDER_MAX_THREADS;
+
+	cfg.g_w = width;
+	cfg.g_h = height;
+	cfg.g_timebase.num = 1;
+	cfg.g_timebase.den = 1000;
+	cfg.g_threads = threads;
+	cfg.g_lag_in_frames = 0;
+	cfg.g_error_resilient = 0;
+	cfg.rc_end_usage = VPX_VBR;
+	/* About 4 Mbit/s for 1080p; screen content is mostly static. */
+	cfg.rc_target_bitrate = width * height / 512;
+	cfg.kf_max_dist = VPX_RECORDER_KEYFRAME_INTERVAL;
+
+	if (vpx_codec_enc_init(&r->codec, vpx_codec_vp8_cx(), &cfg, 0)) {
+		weston_log("vpx recorder: failed to initialize encoder: %s\n",
+			   vpx_codec_error(&r->codec));
+		vpx_img_free(&r->image);
+		free(r);
+		return NULL;
+	}
+
+	/* Favour speed, the recorder drops frames it cannot keep up with. */
+	vpx_codec_control(&r->codec, VP8E_SET_CPUUSED, 8);
+	vpx_codec_control(&r->codec, VP8E_SET_TOKEN_PARTITIONS,
+			  threads > 1 ? VP8_FOUR_TOKENPARTITION :
+			  VP8_ONE_TOKENPARTITION);
+
+	r->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (r->fd < 0) {
+		weston_log("problem opening output file %s: %m\n", filename);
+		goto err_codec;
+	}
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.signature, "DKIF", 4);
+	header.version = 0;
+	header.header_size = sizeof header;
+	memcpy(header.fourcc, "VP80", 4);
+	header.width = width;
+	header.height = height;
+	header.rate = cfg.g_timebase.den;
+	header.scale = cfg.g_timebase.num;
+	if (write(r->fd, &header, sizeof header) != sizeof header) {
+		weston_log("vpx recorder: failed to write header: %m\n");
+		close(r->fd);
+		goto err_codec;
+	}
+
+	weston_log("vpx recorder: VP8 %dx%d, %ld threads\n",
+		   width, height, threads);
+
+	return &r->base;
+
+err_codec:
+	vpx_codec_destroy(&r->codec);
+	vpx_img_free(&r->image);
+	free(r);
+	return NULL;
+}
+
+const struct recorder_encoder_backend vpx_recorder_backend = {
+	"vp8",
+	"ivf",
+	vpx_recorder_create
+};
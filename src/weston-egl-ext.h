@@ -66,6 +66,21 @@ typedef EGLBoolean (EGLAPIENTRYP PFNEGLQUERYWAYLANDBUFFERWL) (EGLDisplay dpy, st
 #define EGL_WAYLAND_Y_INVERTED_WL		0x31DB /* eglQueryWaylandBufferWL attribute */
 #endif
 
+/* Pixel buffer objects are core in OpenGL ES 3.0 and desktop GL, but
+ * the renderer is built against the GLES 2 headers, so the tokens are
+ * defined here and the entry points looked up at runtime. */
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER                                    0x88EB
+#endif
+
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ                                          0x88E1
+#endif
+
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT                                         0x0001
+#endif
+
 /* Mesas gl2ext.h and probably Khronos upstream defined
  * GL_EXT_unpack_subimage with non _EXT suffixed GL_UNPACK_* tokens.
  * In case we're using that mess, manually define the _EXT versions
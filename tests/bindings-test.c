@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../src/compositor.h"
+
+#define NUM_BINDINGS 500
+#define ITERATIONS 200000
+
+/* Well above the key and button codes the shell binds. */
+#define CODE_BASE 0x1000
+
+struct bindings_test {
+	int key_hits;
+	int button_hits;
+	int axis_hits;
+};
+
+static uint32_t
+binding_modifier(int i)
+{
+	return i % (MODIFIER_SHIFT << 1);
+}
+
+static void
+key_handler(struct weston_seat *seat, uint32_t time, uint32_t key,
+	    void *data)
+{
+	struct bindings_test *test = data;
+
+	test->key_hits++;
+}
+
+static void
+button_handler(struct weston_seat *seat, uint32_t time, uint32_t button,
+	       void *data)
+{
+	struct bindings_test *test = data;
+
+	test->button_hits++;
+}
+
+static void
+axis_handler(struct weston_seat *seat, uint32_t time, uint32_t axis,
+	     wl_fixed_t value, void *data)
+{
+	struct bindings_test *test = data;
+
+	test->axis_hits++;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The walk over every button binding that dispatch used to do. */
+static int
+walk_button_bindings(struct weston_compositor *compositor)
+{
+	struct weston_binding *b;
+	int count = 0;
+
+	wl_list_for_each(b, &compositor->button_binding_list, link)
+		count++;
+
+	return count;
+}
+
+static void
+bindings_dispatch(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_binding *bindings[3 * NUM_BINDINGS];
+	struct bindings_test test;
+	struct weston_seat seat;
+	double start, hashed, linear;
+	uint32_t code;
+	int i, n = 0, sink = 0;
+
+	memset(&test, 0, sizeof test);
+	memset(&seat, 0, sizeof seat);
+	weston_seat_init(&seat, compositor, "bindings-test");
+	assert(weston_seat_init_keyboard(&seat, NULL) == 0);
+
+	for (i = 0; i < NUM_BINDINGS; i++) {
+		code = CODE_BASE + i;
+		bindings[n++] =
+			weston_compositor_add_key_binding(compositor, code,
+							  binding_modifier(i),
+							  key_handler, &test);
+		bindings[n++] =
+			weston_compositor_add_button_binding(compositor, code,
+							     binding_modifier(i),
+							     button_handler,
+							     &test);
+		bindings[n++] =
+			weston_compositor_add_axis_binding(compositor, code,
+							   binding_modifier(i),
+							   axis_handler,
+							   &test);
+	}
+
+	/* Each binding runs for its own code and modifiers only. */
+	for (i = 0; i < NUM_BINDINGS; i++) {
+		code = CODE_BASE + i;
+
+		seat.modifier_state = binding_modifier(i);
+		weston_compositor_run_key_binding(compositor, &seat, 0, code,
+						  WL_KEYBOARD_KEY_STATE_PRESSED);
+		assert(test.key_hits == i + 1);
+		/* Drop the grab swallowing the key release. */
+		seat.keyboard->grab->interface->cancel(seat.keyboard->grab);
+
+		weston_compositor_run_button_binding(compositor, &seat, 0, code,
+						     WL_POINTER_BUTTON_STATE_PRESSED);
+		assert(test.button_hits == i + 1);
+
+		assert(weston_compositor_run_axis_binding(compositor, &seat,
+							  0, code,
+							  wl_fixed_from_int(1)));
+		assert(test.axis_hits == i + 1);
+
+		seat.modifier_state = binding_modifier(i + 1);
+		weston_compositor_run_key_binding(compositor, &seat, 0, code,
+						  WL_KEYBOARD_KEY_STATE_PRESSED);
+		weston_compositor_run_button_binding(compositor, &seat, 0, code,
+						     WL_POINTER_BUTTON_STATE_PRESSED);
+		assert(!weston_compositor_run_axis_binding(compositor, &seat,
+							   0, code,
+							   wl_fixed_from_int(1)));
+		assert(test.key_hits == i + 1);
+		assert(test.button_hits == i + 1);
+		assert(test.axis_hits == i + 1);
+	}
+
+	/* Timings are only printed with WESTON_TEST_BENCHMARK set. */
+	if (getenv("WESTON_TEST_BENCHMARK")) {
+		test.button_hits = 0;
+		start = now_ns();
+		for (i = 0; i < ITERATIONS; i++) {
+			code = CODE_BASE + i % NUM_BINDINGS;
+			seat.modifier_state =
+				binding_modifier(i % NUM_BINDINGS);
+			weston_compositor_run_button_binding(compositor, &seat,
+							     0, code,
+							     WL_POINTER_BUTTON_STATE_PRESSED);
+		}
+		hashed = (now_ns() - start) / ITERATIONS;
+		assert(test.button_hits == ITERATIONS);
+
+		start = now_ns();
+		for (i = 0; i < ITERATIONS; i++)
+			sink += walk_button_bindings(compositor);
+		linear = (now_ns() - start) / ITERATIONS;
+
+		fprintf(stderr, "%d button bindings: %.1f ns per dispatch, "
+			"%.1f ns to walk the %d bindings in the list\n",
+			NUM_BINDINGS, hashed, linear, sink / ITERATIONS);
+	}
+
+	for (i = 0; i < n; i++)
+		weston_binding_destroy(bindings[i]);
+
+	/* Destroyed bindings are gone from the tables too. */
+	seat.modifier_state = binding_modifier(0);
+	test.button_hits = 0;
+	weston_compositor_run_button_binding(compositor, &seat, 0, CODE_BASE,
+					     WL_POINTER_BUTTON_STATE_PRESSED);
+	assert(test.button_hits == 0);
+
+	weston_seat_release(&seat);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, bindings_dispatch, compositor);
+
+	return 0;
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <linux/input.h>
+
+#include "../src/compositor.h"
+#include "../src/evdev.h"
+
+/* The dispatch evdev devices use unless they are touchpads */
+extern struct evdev_dispatch_interface fallback_interface;
+
+enum touch_event_type {
+	TOUCH_DOWN,
+	TOUCH_MOTION,
+	TOUCH_UP,
+	TOUCH_FRAME
+};
+
+struct touch_event {
+	enum touch_event_type type;
+	int id, x, y;
+};
+
+struct evdev_touch_test {
+	struct weston_touch_grab grab;
+	struct weston_seat seat;
+	struct weston_view *view;
+	struct evdev_dispatch dispatch;
+	struct evdev_device device;
+	struct touch_event log[16];
+	int count;
+	uint32_t msecs;
+};
+
+static void
+log_event(struct evdev_touch_test *test, enum touch_event_type type,
+	  int id, wl_fixed_t sx, wl_fixed_t sy)
+{
+	struct touch_event *e;
+
+	assert(test->count < (int) ARRAY_LENGTH(test->log));
+	e = &test->log[test->count++];
+	e->type = type;
+	e->id = id;
+	e->x = wl_fixed_to_int(sx);
+	e->y = wl_fixed_to_int(sy);
+}
+
+static void
+grab_down(struct weston_touch_grab *grab, uint32_t time, int touch_id,
+	  wl_fixed_t sx, wl_fixed_t sy)
+{
+	struct evdev_touch_test *test =
+		container_of(grab, struct evdev_touch_test, grab);
+
+	/* Nothing is mapped under the touch points, so the first one
+	 * comes without a view and notify_touch() only stored its global
+	 * position.  Focus a view at the origin, so that motion is
+	 * delivered too, in global coordinates. */
+	if (grab->touch->focus == NULL) {
+		grab->touch->focus = test->view;
+		weston_view_from_global_fixed(test->view,
+					      grab->touch->grab_x,
+					      grab->touch->grab_y,
+					      &sx, &sy);
+	}
+
+	log_event(test, TOUCH_DOWN, touch_id, sx, sy);
+}
+
+static void
+grab_up(struct weston_touch_grab *grab, uint32_t time, int touch_id)
+{
+	struct evdev_touch_test *test =
+		container_of(grab, struct evdev_touch_test, grab);
+
+	log_event(test, TOUCH_UP, touch_id, 0, 0);
+}
+
+static void
+grab_motion(struct weston_touch_grab *grab, uint32_t time, int touch_id,
+	    wl_fixed_t sx, wl_fixed_t sy)
+{
+	struct evdev_touch_test *test =
+		container_of(grab, struct evdev_touch_test, grab);
+
+	log_event(test, TOUCH_MOTION, touch_id, sx, sy);
+}
+
+static void
+grab_frame(struct weston_touch_grab *grab)
+{
+	struct evdev_touch_test *test =
+		container_of(grab, struct evdev_touch_test, grab);
+
+	log_event(test, TOUCH_FRAME, -1, 0, 0);
+}
+
+static void
+grab_cancel(struct weston_touch_grab *grab)
+{
+}
+
+static const struct weston_touch_grab_interface grab_interface = {
+	grab_down,
+	grab_up,
+	grab_motion,
+	grab_frame,
+	grab_cancel,
+};
+
+/* Feeds events through evdev_process_events(), as if read from the
+ * device in one go, and checks what reached the touch grab. */
+static void
+process(struct evdev_touch_test *test,
+	struct input_event *events, int count,
+	const struct touch_event *expected, int expected_count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		events[i].time.tv_sec = test->msecs / 1000;
+		events[i].time.tv_usec = (test->msecs % 1000) * 1000;
+	}
+	test->msecs += 16;
+
+	test->count = 0;
+	evdev_process_events(&test->device, events, count);
+
+	assert(test->count == expected_count);
+	for (i = 0; i < expected_count; i++) {
+		assert(test->log[i].type == expected[i].type);
+		assert(test->log[i].id == expected[i].id);
+		if (expected[i].type == TOUCH_DOWN ||
+		    expected[i].type == TOUCH_MOTION) {
+			assert(test->log[i].x == expected[i].x);
+			assert(test->log[i].y == expected[i].y);
+		}
+	}
+}
+
+#define PROCESS(test, events, expected) \
+	process(test, events, ARRAY_LENGTH(events), \
+		expected, ARRAY_LENGTH(expected))
+
+static void
+touch_frames(struct evdev_touch_test *test)
+{
+	struct input_event two_down[] = {
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 0 },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = 10 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_X, .value = 100 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_Y, .value = 50 },
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 1 },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = 11 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_X, .value = 200 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_Y, .value = 150 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	static const struct touch_event two_down_expected[] = {
+		{ TOUCH_DOWN, 0, 100, 50 },
+		{ TOUCH_DOWN, 1, 200, 150 },
+		{ TOUCH_FRAME, -1 },
+	};
+
+	/* X and Y of one slot in one frame make a single motion. */
+	struct input_event both_move[] = {
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 0 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_X, .value = 110 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_Y, .value = 60 },
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 1 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_Y, .value = 160 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	static const struct touch_event both_move_expected[] = {
+		{ TOUCH_MOTION, 0, 110, 60 },
+		{ TOUCH_MOTION, 1, 200, 160 },
+		{ TOUCH_FRAME, -1 },
+	};
+
+	struct input_event one_up[] = {
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 0 },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = -1 },
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 1 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_X, .value = 220 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	static const struct touch_event one_up_expected[] = {
+		{ TOUCH_UP, 0 },
+		{ TOUCH_MOTION, 1, 220, 160 },
+		{ TOUCH_FRAME, -1 },
+	};
+
+	/* A report without touch changes sends no frame. */
+	struct input_event empty[] = {
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+
+	/* Lifting and putting down slot 0 in one frame sends both, in
+	 * order, and still ends the frame only once. */
+	struct input_event down_again[] = {
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 0 },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = 12 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_X, .value = 300 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_Y, .value = 250 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = -1 },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = 13 },
+		{ .type = EV_ABS, .code = ABS_MT_POSITION_X, .value = 310 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	static const struct touch_event down_again_expected[] = {
+		{ TOUCH_DOWN, 0, 300, 250 },
+		{ TOUCH_FRAME, -1 },
+		{ TOUCH_UP, 0 },
+		{ TOUCH_DOWN, 0, 310, 250 },
+		{ TOUCH_FRAME, -1 },
+	};
+
+	struct input_event all_up[] = {
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = -1 },
+		{ .type = EV_ABS, .code = ABS_MT_SLOT, .value = 1 },
+		{ .type = EV_ABS, .code = ABS_MT_TRACKING_ID, .value = -1 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	static const struct touch_event all_up_expected[] = {
+		{ TOUCH_UP, 0 },
+		{ TOUCH_UP, 1 },
+		{ TOUCH_FRAME, -1 },
+	};
+
+	PROCESS(test, two_down, two_down_expected);
+	PROCESS(test, both_move, both_move_expected);
+	PROCESS(test, one_up, one_up_expected);
+	process(test, empty, ARRAY_LENGTH(empty), NULL, 0);
+	PROCESS(test, down_again, down_again_expected);
+	PROCESS(test, all_up, all_up_expected);
+}
+
+static void
+evdev_touch_test(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct evdev_touch_test *test;
+	struct weston_output *output;
+	struct weston_surface *surface;
+
+	test = calloc(1, sizeof *test);
+	assert(test);
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+
+	weston_seat_init(&test->seat, compositor, "evdev-touch-test");
+	weston_seat_init_touch(&test->seat);
+	test->grab.interface = &grab_interface;
+	weston_touch_start_grab(test->seat.touch, &test->grab);
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	test->view = weston_view_create(surface);
+	assert(test->view);
+	weston_view_set_position(test->view, 0, 0);
+	weston_view_update_transform(test->view);
+
+	/* A touchscreen whose axes match the output one to one */
+	test->dispatch.interface = &fallback_interface;
+	test->device.dispatch = &test->dispatch;
+	test->device.seat = &test->seat;
+	test->device.output = output;
+	test->device.seat_caps = EVDEV_SEAT_TOUCH;
+	test->device.is_mt = 1;
+	test->device.mt.slot = -1;
+	test->device.abs.max_x = output->current_mode->width;
+	test->device.abs.max_y = output->current_mode->height;
+	test->device.pending_event = EVDEV_NONE;
+	test->device.record_fd = -1;
+
+	touch_frames(test);
+
+	weston_touch_end_grab(test->seat.touch);
+	weston_view_destroy(test->view);
+	weston_surface_destroy(surface);
+	weston_seat_release(&test->seat);
+	free(test);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, evdev_touch_test, compositor);
+
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/filter.h"
+
+#define EVENTS 20000
+#define INTERVAL 1000 /* usecs, a 1 kHz device */
+
+/* The touchpad profile with a factor of 1 at 10 units/ms. */
+#define CONSTANT_FACTOR 0.1
+#define MIN_FACTOR 0.2
+#define MAX_FACTOR 2.0
+
+struct motion {
+	double dx, dy;
+	uint64_t time;
+};
+
+static double
+profile(struct weston_motion_filter *filter, void *data,
+	double velocity, uint64_t time)
+{
+	double factor = velocity * CONSTANT_FACTOR;
+
+	if (factor > MAX_FACTOR)
+		factor = MAX_FACTOR;
+	else if (factor < MIN_FACTOR)
+		factor = MIN_FACTOR;
+
+	return factor;
+}
+
+static struct weston_motion_filter *
+create_curve_filter(void)
+{
+	struct weston_motion_filter *filter;
+
+	filter = create_pointer_accelator_curve_filter(profile, NULL,
+						       MAX_FACTOR /
+						       CONSTANT_FACTOR);
+	assert(filter);
+
+	return filter;
+}
+
+/* Strokes that speed up and slow down again, with pauses between them. */
+static struct motion *
+make_strokes(int n)
+{
+	struct motion *motions;
+	uint64_t time = 1000000;
+	double speed, angle;
+	int i, step;
+
+	motions = malloc(n * sizeof *motions);
+	assert(motions);
+
+	for (i = 0; i < n; i++) {
+		step = i % 400;
+		if (step == 0)
+			time += 500000;
+		angle = (i / 400) * 0.7;
+		speed = 1 + 24 * sin(M_PI * step / 400);
+
+		motions[i].dx = round(speed * cos(angle));
+		motions[i].dy = round(speed * sin(angle));
+		motions[i].time = time;
+		time += INTERVAL;
+	}
+
+	return motions;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double
+run_filter(struct weston_motion_filter *filter,
+	   const struct motion *motions, struct weston_motion_params *out,
+	   int n)
+{
+	double start;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		out[i].dx = motions[i].dx;
+		out[i].dy = motions[i].dy;
+		weston_filter_dispatch(filter, &out[i], NULL,
+				       motions[i].time);
+	}
+
+	return (now_ns() - start) / n;
+}
+
+TEST(curve_filter_constant_speed)
+{
+	struct weston_motion_filter *curve, *tracker;
+	struct weston_motion_params a, b;
+	uint64_t time = 1000000;
+	int i, dx;
+
+	/* At a steady speed both settle on the factor for that speed,
+	 * up to the interpolation where the curve bends between two
+	 * samples. */
+	for (dx = 1; dx <= 30; dx++) {
+		curve = create_curve_filter();
+		tracker = create_pointer_accelator_filter(profile);
+		assert(tracker);
+
+		for (i = 0; i < 100; i++) {
+			a.dx = b.dx = dx;
+			a.dy = b.dy = 0;
+			weston_filter_dispatch(curve, &a, NULL, time);
+			weston_filter_dispatch(tracker, &b, NULL, time);
+			time += INTERVAL;
+		}
+
+		assert(fabs(a.dx - b.dx) < 0.02 * b.dx);
+		assert(a.dy == 0 && b.dy == 0);
+
+		curve->interface->destroy(curve);
+		tracker->interface->destroy(tracker);
+	}
+}
+
+TEST(curve_filter_pause)
+{
+	struct weston_motion_filter *curve;
+	struct weston_motion_params m;
+	uint64_t time = 1000000;
+	int i;
+
+	curve = create_curve_filter();
+
+	for (i = 0; i < 100; i++) {
+		m.dx = 20;
+		m.dy = 0;
+		weston_filter_dispatch(curve, &m, NULL, time);
+		time += INTERVAL;
+	}
+	assert(m.dx > 20);
+
+	/* Moving again after a pause starts out slow. */
+	time += 1000000;
+	for (i = 0; i < 2; i++) {
+		m.dx = 2;
+		m.dy = 0;
+		weston_filter_dispatch(curve, &m, NULL, time);
+		time += INTERVAL;
+	}
+	assert(m.dx < 2);
+
+	curve->interface->destroy(curve);
+}
+
+TEST(curve_filter_compare)
+{
+	struct weston_motion_filter *curve, *tracker;
+	struct weston_motion_params *a, *b;
+	struct motion *motions;
+	double curve_ns, tracker_ns, ax = 0, ay = 0, bx = 0, by = 0;
+	double distance_a, distance_b;
+	int i;
+
+	motions = make_strokes(EVENTS);
+	a = malloc(EVENTS * sizeof *a);
+	b = malloc(EVENTS * sizeof *b);
+	assert(a && b);
+
+	curve = create_curve_filter();
+	tracker = create_pointer_accelator_filter(profile);
+	assert(tracker);
+
+	curve_ns = run_filter(curve, motions, a, EVENTS);
+	tracker_ns = run_filter(tracker, motions, b, EVENTS);
+
+	for (i = 0; i < EVENTS; i++) {
+		ax += a[i].dx;
+		ay += a[i].dy;
+		bx += b[i].dx;
+		by += b[i].dy;
+	}
+	distance_a = sqrt(ax * ax + ay * ay);
+	distance_b = sqrt(bx * bx + by * by);
+
+	/* Timings are only printed with WESTON_TEST_BENCHMARK set. */
+	if (getenv("WESTON_TEST_BENCHMARK"))
+		fprintf(stderr, "curve filter: %.1f ns per event, "
+			"tracker filter: %.1f ns per event, "
+			"distance %.0f vs %.0f\n",
+			curve_ns, tracker_ns, distance_a, distance_b);
+
+	/* The pointer ends up in about the same place. */
+	assert(fabs(ax - bx) < 0.05 * fabs(bx) + 100);
+	assert(fabs(ay - by) < 0.05 * fabs(by) + 100);
+
+	curve->interface->destroy(curve);
+	tracker->interface->destroy(tracker);
+	free(motions);
+	free(a);
+	free(b);
+}
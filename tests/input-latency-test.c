@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include "weston-test-client-helper.h"
+#include "../src/input-record.h"
+
+#define MOTION_EVENTS 500
+#define MOTION_INTERVAL 1000 /* usecs, a 1 kHz mouse */
+
+struct recording {
+	int fd;
+	uint64_t time;
+	uint32_t events;
+};
+
+static void
+record(struct recording *r, uint16_t type, uint16_t code, int32_t value)
+{
+	struct input_record rec;
+
+	memset(&rec, 0, sizeof rec);
+	rec.time = r->time;
+	rec.type = type;
+	rec.code = code;
+	rec.value = value;
+	assert(write(r->fd, &rec, sizeof rec) == sizeof rec);
+}
+
+static void
+record_frame(struct recording *r, uint16_t type, uint16_t code,
+	     int32_t value)
+{
+	record(r, type, code, value);
+	record(r, EV_SYN, SYN_REPORT, 0);
+	r->time += MOTION_INTERVAL;
+	r->events++;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+	const uint64_t *la = a, *lb = b;
+
+	return *la < *lb ? -1 : *la > *lb;
+}
+
+TEST(input_latency)
+{
+	struct client *client;
+	struct input_record_header header;
+	struct recording r;
+	char path[] = "/tmp/weston-input-latency-XXXXXX";
+	uint64_t *latencies;
+	uint32_t count;
+	int i, n;
+
+	client = client_create(100, 100, 100, 100);
+	assert(client);
+
+	wl_test_move_pointer(client->test->wl_test, 150, 150);
+	wl_test_activate_surface(client->test->wl_test,
+				 client->surface->wl_surface);
+	client_roundtrip(client);
+	assert(client->input->pointer->focus == client->surface);
+	assert(client->input->keyboard->focus == client->surface);
+
+	/* Wiggle the pointer inside the surface, then click and type. */
+	r.fd = mkstemp(path);
+	assert(r.fd >= 0);
+	r.time = 1000000;
+	r.events = 0;
+	header.magic = INPUT_RECORD_MAGIC;
+	header.version = INPUT_RECORD_VERSION;
+	assert(write(r.fd, &header, sizeof header) == sizeof header);
+	for (i = 0; i < MOTION_EVENTS; i++)
+		record_frame(&r, EV_REL, REL_X, i & 1 ? -1 : 1);
+	record_frame(&r, EV_KEY, BTN_LEFT, 1);
+	record_frame(&r, EV_KEY, BTN_LEFT, 0);
+	record_frame(&r, EV_KEY, KEY_A, 1);
+	record_frame(&r, EV_KEY, KEY_A, 0);
+	close(r.fd);
+
+	count = replay_input(client, path);
+	unlink(path);
+
+	assert(count == r.events);
+	assert(client->input->keyboard->key == KEY_A);
+	assert(client->input->keyboard->state ==
+	       WL_KEYBOARD_KEY_STATE_RELEASED);
+
+	latencies = client->test->latencies.data;
+	n = client->test->latencies.size / sizeof *latencies;
+	assert(n == (int) count);
+
+	/* The percentiles are only printed with WESTON_TEST_BENCHMARK
+	 * set. */
+	if (!getenv("WESTON_TEST_BENCHMARK"))
+		return;
+
+	qsort(latencies, n, sizeof *latencies, compare_latency);
+	fprintf(stderr, "input latency over %d events: "
+		"p50 %llu us, p90 %llu us, p99 %llu us, max %llu us\n", n,
+		(unsigned long long) latencies[n * 50 / 100],
+		(unsigned long long) latencies[n * 90 / 100],
+		(unsigned long long) latencies[n * 99 / 100],
+		(unsigned long long) latencies[n - 1]);
+}
@@ -0,0 +1,569 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pixman.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/pixel-blit.h"
+
+#define PAD 5
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+static const int sizes[][2] = {
+	{ 1, 1 }, { 3, 5 }, { 4, 4 }, { 8, 8 }, { 17, 9 },
+	{ 31, 64 }, { 64, 48 }, { 133, 71 },
+};
+
+static const enum pixel_rotation rotations[] = {
+	PIXEL_ROTATE_0, PIXEL_ROTATE_90, PIXEL_ROTATE_180, PIXEL_ROTATE_270,
+};
+
+static uint32_t *
+make_source(int width, int height, int stride)
+{
+	uint32_t *src;
+	int x, y;
+
+	src = malloc(stride * height * 4);
+	assert(src);
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < stride; x++)
+			src[y * stride + x] = (y << 16) | x;
+
+	return src;
+}
+
+static void
+rotated_size(enum pixel_rotation rotation, int width, int height,
+	     int *dst_width, int *dst_height)
+{
+	if (rotation == PIXEL_ROTATE_90 || rotation == PIXEL_ROTATE_270) {
+		*dst_width = height;
+		*dst_height = width;
+	} else {
+		*dst_width = width;
+		*dst_height = height;
+	}
+}
+
+static uint32_t
+expected_pixel(enum pixel_rotation rotation, int width, int height,
+	       int dx, int dy)
+{
+	int sx, sy;
+
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		sx = dx;
+		sy = dy;
+		break;
+	case PIXEL_ROTATE_90:
+		sx = dy;
+		sy = height - 1 - dx;
+		break;
+	case PIXEL_ROTATE_180:
+		sx = width - 1 - dx;
+		sy = height - 1 - dy;
+		break;
+	case PIXEL_ROTATE_270:
+		sx = width - 1 - dy;
+		sy = dx;
+		break;
+	}
+
+	return (sy << 16) | sx;
+}
+
+static void
+check_rotation(enum pixel_blit_impl impl, enum pixel_rotation rotation,
+	       int width, int height)
+{
+	int dst_width, dst_height, dst_stride, src_stride;
+	uint32_t *src, *dst;
+	int x, y;
+
+	rotated_size(rotation, width, height, &dst_width, &dst_height);
+	src_stride = width + PAD;
+	dst_stride = dst_width + PAD;
+
+	src = make_source(width, height, src_stride);
+	dst = malloc(dst_stride * dst_height * 4);
+	assert(dst);
+	memset(dst, 0xaa, dst_stride * dst_height * 4);
+
+	assert(pixel_blit_rotate32_impl(impl, rotation,
+					dst, dst_stride * 4,
+					src, src_stride * 4,
+					width, height) == 0);
+
+	for (y = 0; y < dst_height; y++) {
+		for (x = 0; x < dst_width; x++)
+			assert(dst[y * dst_stride + x] ==
+			       expected_pixel(rotation, width, height, x, y));
+		/* The stride padding must not be touched. */
+		for (; x < dst_stride; x++)
+			assert(dst[y * dst_stride + x] == 0xaaaaaaaa);
+	}
+
+	free(src);
+	free(dst);
+}
+
+TEST(rotate32_all_impls)
+{
+	enum pixel_blit_impl impl;
+	unsigned int r, s;
+
+	for (impl = 0; impl < PIXEL_BLIT_IMPL_COUNT; impl++) {
+		if (!pixel_blit_impl_supported(impl))
+			continue;
+
+		for (r = 0; r < ARRAY_LENGTH(rotations); r++)
+			for (s = 0; s < ARRAY_LENGTH(sizes); s++)
+				check_rotation(impl, rotations[r],
+					       sizes[s][0], sizes[s][1]);
+	}
+}
+
+/* The transform the pixman renderer falls back to when it cannot use
+ * the rotation kernels: maps hardware buffer pixels to the upright
+ * shadow image of the given size. */
+static void
+shadow_transform(pixman_transform_t *transform,
+		 enum pixel_rotation rotation, int width, int height)
+{
+	pixman_fixed_t w = pixman_int_to_fixed(width);
+	pixman_fixed_t h = pixman_int_to_fixed(height);
+
+	pixman_transform_init_identity(transform);
+
+	switch (rotation) {
+	default:
+	case PIXEL_ROTATE_0:
+		break;
+	case PIXEL_ROTATE_90:
+		pixman_transform_rotate(transform, NULL, 0, -pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, 0, h);
+		break;
+	case PIXEL_ROTATE_180:
+		pixman_transform_rotate(transform, NULL, -pixman_fixed_1, 0);
+		pixman_transform_translate(transform, NULL, w, h);
+		break;
+	case PIXEL_ROTATE_270:
+		pixman_transform_rotate(transform, NULL, 0, pixman_fixed_1);
+		pixman_transform_translate(transform, NULL, w, 0);
+		break;
+	}
+}
+
+static void
+pixman_rotate(enum pixel_rotation rotation,
+	      pixman_image_t *dst, pixman_image_t *src)
+{
+	pixman_transform_t transform;
+
+	shadow_transform(&transform, rotation,
+			 pixman_image_get_width(src),
+			 pixman_image_get_height(src));
+	pixman_image_set_transform(src, &transform);
+	pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, dst,
+				 0, 0, 0, 0, 0, 0,
+				 pixman_image_get_width(dst),
+				 pixman_image_get_height(dst));
+	pixman_image_set_transform(src, NULL);
+}
+
+TEST(rotate32_matches_pixman)
+{
+	const int width = 67, height = 45;
+	int dst_width, dst_height;
+	pixman_image_t *src_image, *ref_image;
+	uint32_t *src, *ref, *dst;
+	unsigned int r;
+
+	src = make_source(width, height, width);
+	src_image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height,
+					     src, width * 4);
+
+	for (r = 0; r < ARRAY_LENGTH(rotations); r++) {
+		rotated_size(rotations[r], width, height,
+			     &dst_width, &dst_height);
+		ref = calloc(dst_width * dst_height, 4);
+		dst = calloc(dst_width * dst_height, 4);
+		assert(ref && dst);
+
+		ref_image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						     dst_width, dst_height,
+						     ref, dst_width * 4);
+		pixman_rotate(rotations[r], ref_image, src_image);
+		pixman_image_unref(ref_image);
+
+		pixel_blit_rotate32(rotations[r], dst, dst_width * 4,
+				    src, width * 4, width, height);
+
+		assert(memcmp(ref, dst, dst_width * dst_height * 4) == 0);
+
+		free(ref);
+		free(dst);
+	}
+
+	pixman_image_unref(src_image);
+	free(src);
+}
+
+/* The benchmarks only print timings and are skipped unless
+ * WESTON_TEST_BENCHMARK is set, to keep the test run quiet and short. */
+static int
+benchmark_enabled(void)
+{
+	return getenv("WESTON_TEST_BENCHMARK") != NULL;
+}
+
+static double
+now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+TEST(rotate32_benchmark)
+{
+	const int width = 1920, height = 1080, iterations = 20;
+	pixman_image_t *src_image, *dst_image;
+	enum pixel_blit_impl impl;
+	uint32_t *src, *dst;
+	unsigned int r;
+	double t;
+	int i;
+
+	if (!benchmark_enabled())
+		return;
+
+	src = make_source(width, height, width);
+	dst = malloc(width * height * 4);
+	assert(dst);
+	src_image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height,
+					     src, width * 4);
+
+	for (r = 1; r < ARRAY_LENGTH(rotations); r++) {
+		int dst_width, dst_height;
+
+		rotated_size(rotations[r], width, height,
+			     &dst_width, &dst_height);
+		dst_image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						     dst_width, dst_height,
+						     dst, dst_width * 4);
+
+		t = now();
+		for (i = 0; i < iterations; i++)
+			pixman_rotate(rotations[r], dst_image, src_image);
+		printf("%3d degrees, %-6s %8.3f ms/frame\n", 90 * r, "pixman",
+		       1e3 * (now() - t) / iterations);
+		pixman_image_unref(dst_image);
+
+		for (impl = 0; impl < PIXEL_BLIT_IMPL_COUNT; impl++) {
+			if (!pixel_blit_impl_supported(impl))
+				continue;
+
+			t = now();
+			for (i = 0; i < iterations; i++)
+				pixel_blit_rotate32_impl(impl, rotations[r],
+							 dst, dst_width * 4,
+							 src, width * 4,
+							 width, height);
+			printf("%3d degrees, %-6s %8.3f ms/frame\n", 90 * r,
+			       pixel_blit_impl_name(impl),
+			       1e3 * (now() - t) / iterations);
+		}
+	}
+
+	pixman_image_unref(src_image);
+	free(src);
+	free(dst);
+}
+
+static const enum pixel_format16 formats16[] = {
+	PIXEL_FORMAT_R5G6B5, PIXEL_FORMAT_X1R5G5B5,
+};
+
+static uint32_t *
+make_random_source(int width, int height)
+{
+	uint32_t *src;
+	int i;
+
+	src = malloc(width * height * 4);
+	assert(src);
+
+	srandom(width * height);
+	for (i = 0; i < width * height; i++)
+		src[i] = random();
+
+	return src;
+}
+
+TEST(dither16_impls_match_c)
+{
+	const int width = 61, height = 13;
+	enum pixel_blit_impl impl;
+	uint16_t ref[width * height], dst[width * height];
+	uint32_t *src;
+	unsigned int f;
+	int x, y;
+
+	src = make_random_source(width, height);
+
+	for (impl = 0; impl < PIXEL_BLIT_IMPL_COUNT; impl++) {
+		for (f = 0; f < ARRAY_LENGTH(formats16); f++) {
+			for (y = 0; y < 4; y++) {
+				for (x = 0; x < 4; x++) {
+					pixel_blit_dither16_impl(
+						PIXEL_BLIT_IMPL_C, formats16[f],
+						ref, width * 2, src, width * 4,
+						x, y, width, height);
+					if (pixel_blit_dither16_impl(
+						impl, formats16[f],
+						dst, width * 2, src, width * 4,
+						x, y, width, height) < 0)
+						continue;
+
+					assert(memcmp(ref, dst, sizeof ref) == 0);
+				}
+			}
+		}
+	}
+
+	free(src);
+}
+
+/* Colours that are exactly representable must not be disturbed by the
+ * dither offsets. */
+TEST(dither16_exact_colors)
+{
+	uint32_t src[16];
+	uint16_t dst[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		src[i] = 0xff000000 | (i * 2) << 19 | (i * 4) << 10 | (i * 2) << 3;
+
+	pixel_blit_dither16(PIXEL_FORMAT_R5G6B5, dst, sizeof dst,
+			    src, sizeof src, 1, 2, 16, 1);
+
+	for (i = 0; i < 16; i++)
+		assert(dst[i] == ((i * 2) << 11 | (i * 4) << 5 | (i * 2)));
+}
+
+TEST(dither16_benchmark)
+{
+	const int width = 1920, height = 1080, iterations = 20;
+	pixman_image_t *src_image, *dst_image;
+	enum pixel_blit_impl impl;
+	uint32_t *src;
+	uint16_t *dst;
+	double t;
+	int i;
+
+	if (!benchmark_enabled())
+		return;
+
+	src = make_random_source(width, height);
+	dst = malloc(width * height * 2);
+	assert(dst);
+	src_image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height,
+					     src, width * 4);
+	dst_image = pixman_image_create_bits(PIXMAN_r5g6b5, width, height,
+					     (uint32_t *) dst, width * 2);
+
+	/* Compositing a frame through the 32 bpp shadow writes it there,
+	 * reads it back and writes the converted copy; compositing it
+	 * natively only writes the 16 bpp frame buffer. */
+	printf("per frame traffic: shadow %.1f MiB, native %.1f MiB\n",
+	       width * height * (4 + 4 + 2) / (1024.0 * 1024.0),
+	       width * height * 2 / (1024.0 * 1024.0));
+
+	t = now();
+	for (i = 0; i < iterations; i++)
+		pixman_image_composite32(PIXMAN_OP_SRC, src_image, NULL,
+					 dst_image, 0, 0, 0, 0, 0, 0,
+					 width, height);
+	printf("r5g6b5, %-6s %8.3f ms/frame\n", "pixman",
+	       1e3 * (now() - t) / iterations);
+
+	for (impl = 0; impl < PIXEL_BLIT_IMPL_COUNT; impl++) {
+		t = now();
+		for (i = 0; i < iterations; i++)
+			if (pixel_blit_dither16_impl(impl, PIXEL_FORMAT_R5G6B5,
+						     dst, width * 2,
+						     src, width * 4,
+						     0, 0, width, height) < 0)
+				break;
+		if (i < iterations)
+			continue;
+
+		printf("r5g6b5, %-6s %8.3f ms/frame\n",
+		       pixel_blit_impl_name(impl),
+		       1e3 * (now() - t) / iterations);
+	}
+
+	pixman_image_unref(src_image);
+	pixman_image_unref(dst_image);
+	free(src);
+	free(dst);
+}
+
+/* Applies a run-length encoded delta stream to count pixels of frame,
+ * as wcap-decode does, and returns the number of words consumed. */
+static int
+apply_delta_rle(uint32_t *frame, const uint32_t *in, int count)
+{
+	const uint32_t *p = in;
+	uint32_t v;
+	int i = 0, j, k, l;
+
+	while (i < count) {
+		v = *p++;
+		l = v >> 24;
+		j = l < 0xe0 ? l + 1 : 1 << (l - 0xe0 + 7);
+		assert(i + j <= count);
+
+		for (k = 0; k < j; k++, i++)
+			frame[i] = (((frame[i] & 0xff00ff) + (v & 0xff00ff)) &
+				    0xff00ff) |
+				   (((frame[i] & 0x00ff00) + (v & 0x00ff00)) &
+				    0x00ff00);
+	}
+
+	return p - in;
+}
+
+static int
+encode_frame(enum pixel_blit_impl impl, uint32_t *out, uint32_t *frame,
+	     const uint32_t *src, int width, int height)
+{
+	struct pixel_rle_state state = { out, 0, 0 };
+	int y;
+
+	for (y = 0; y < height; y++)
+		if (pixel_blit_delta_rle_impl(impl, &state, frame + y * width,
+					      src + y * width, width) < 0)
+			return -1;
+	pixel_blit_delta_rle_finish(&state);
+
+	return state.out - out;
+}
+
+TEST(delta_rle_impls_match_c)
+{
+	const int width = 77, height = 19;
+	enum pixel_blit_impl impl;
+	uint32_t *src, ref_frame[width * height], frame[width * height];
+	uint32_t ref[width * height], out[width * height];
+	uint32_t decoded[width * height];
+	int i, n, ref_n;
+
+	src = make_random_source(width, height);
+
+	/* Long runs of unchanged and of uniformly changed pixels, which
+	 * take the vector fast paths, broken up by random pixels. */
+	for (i = 0; i < width * height; i++)
+		if (i % 97 > 3)
+			src[i] = i < width * height / 2 ? 0 : 0x00102030;
+
+	for (impl = 0; impl < PIXEL_BLIT_IMPL_COUNT; impl++) {
+		for (i = 0; i < width * height; i++)
+			ref_frame[i] = frame[i] = decoded[i] = i * 0x010101;
+
+		ref_n = encode_frame(PIXEL_BLIT_IMPL_C, ref, ref_frame,
+				     src, width, height);
+		n = encode_frame(impl, out, frame, src, width, height);
+		if (n < 0)
+			continue;
+
+		assert(n == ref_n);
+		assert(memcmp(ref, out, n * 4) == 0);
+		assert(memcmp(frame, src, sizeof frame) == 0);
+
+		assert(apply_delta_rle(decoded, out, width * height) == n);
+		for (i = 0; i < width * height; i++)
+			assert((decoded[i] & 0xffffff) == (src[i] & 0xffffff));
+	}
+
+	free(src);
+}
+
+TEST(delta_rle_benchmark)
+{
+	const int width = 3840, height = 2160, iterations = 10;
+	enum pixel_blit_impl impl;
+	uint32_t *src, *frame, *out;
+	double t;
+	int i, n = 0;
+
+	if (!benchmark_enabled())
+		return;
+
+	src = make_random_source(width, height);
+	frame = malloc(width * height * 4);
+	out = malloc(width * height * 4);
+	assert(frame && out);
+
+	/* A mostly static desktop: a tenth of the pixels change. */
+	for (i = 0; i < width * height; i++)
+		if ((i / width) % 10)
+			src[i] = 0xff336699;
+
+	for (impl = 0; impl < PIXEL_BLIT_IMPL_COUNT; impl++) {
+		t = now();
+		for (i = 0; i < iterations; i++) {
+			memset(frame, 0, width * height * 4);
+			n = encode_frame(impl, out, frame, src, width, height);
+			if (n < 0)
+				break;
+		}
+		if (i < iterations)
+			continue;
+
+		printf("3840x2160 delta+rle, %-6s %8.3f ms/frame, %d words\n",
+		       pixel_blit_impl_name(impl),
+		       1e3 * (now() - t) / iterations, n);
+	}
+
+	free(src);
+	free(frame);
+	free(out);
+}
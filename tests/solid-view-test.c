@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../src/compositor.h"
+#include "../src/pixman-renderer.h"
+
+#define BACKGROUND	0x00ff00
+#define FOREGROUND	0xff0000
+
+static struct weston_view *
+create_solid_view(struct weston_compositor *compositor,
+		  float red, float green, float blue,
+		  int x, int y, int width, int height)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	weston_surface_set_color(surface, red, green, blue, 1.0);
+	surface->width = width;
+	surface->height = height;
+	pixman_region32_fini(&surface->opaque);
+	pixman_region32_init_rect(&surface->opaque, 0, 0, width, height);
+
+	view = weston_view_create(surface);
+	assert(view);
+	view->plane = &compositor->primary_plane;
+	weston_view_set_position(view, x, y);
+
+	return view;
+}
+
+static void
+destroy_solid_view(struct weston_view *view)
+{
+	struct weston_surface *surface = view->surface;
+
+	weston_view_destroy(view);
+	weston_surface_destroy(surface);
+}
+
+static uint32_t
+get_pixel(pixman_image_t *image, int x, int y)
+{
+	uint32_t *data = pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image) / 4;
+
+	return data[y * stride + x] & 0xffffff;
+}
+
+/* Solid colour views are filled rather than composited.  A rotated
+ * one must still only cover its own shape, not its bounding box. */
+static void
+solid_view_rotated(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+	struct weston_view *background, *rotated, *moved, *view, *next;
+	struct weston_transform rotation;
+	struct wl_list views;
+	pixman_region32_t damage;
+	pixman_image_t *buffer;
+	int width, height;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	width = output->current_mode->width;
+	height = output->current_mode->height;
+
+	compositor->renderer->destroy(compositor);
+	assert(pixman_renderer_init(compositor) == 0);
+	assert(pixman_renderer_output_create(output) == 0);
+	buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+					  width, height, NULL, 0);
+	assert(buffer);
+	pixman_renderer_output_set_buffer(output, buffer);
+
+	background = create_solid_view(compositor, 0.0, 1.0, 0.0,
+				       output->x, output->y, width, height);
+	weston_view_update_transform(background);
+
+	/* A 100x100 square turned by 45 degrees about its centre. */
+	rotated = create_solid_view(compositor, 1.0, 0.0, 0.0,
+				    output->x + 300, output->y + 200, 100, 100);
+	weston_matrix_init(&rotation.matrix);
+	weston_matrix_translate(&rotation.matrix, -50, -50, 0);
+	weston_matrix_rotate_xy(&rotation.matrix, 0.70710678, 0.70710678);
+	weston_matrix_translate(&rotation.matrix, 50, 50, 0);
+	wl_list_insert(&rotated->geometry.transformation_list,
+		       &rotation.link);
+	weston_view_geometry_dirty(rotated);
+	weston_view_update_transform(rotated);
+
+	moved = create_solid_view(compositor, 1.0, 0.0, 0.0,
+				  output->x + 600, output->y + 200, 100, 100);
+	weston_view_update_transform(moved);
+
+	wl_list_init(&views);
+	wl_list_insert_list(&views, &compositor->view_list);
+	wl_list_init(&compositor->view_list);
+	wl_list_insert(&compositor->view_list, &background->link);
+	wl_list_insert(&compositor->view_list, &moved->link);
+	wl_list_insert(&compositor->view_list, &rotated->link);
+
+	pixman_region32_init_rect(&damage, output->x, output->y,
+				  width, height);
+	compositor->renderer->repaint_output(output, &damage);
+	pixman_region32_fini(&damage);
+
+	/* The rotated square covers its centre but not the corners of
+	 * its bounding box, which spans about 279..421 x 179..321. */
+	assert(get_pixel(buffer, 350, 250) == FOREGROUND);
+	assert(get_pixel(buffer, 282, 182) == BACKGROUND);
+	assert(get_pixel(buffer, 418, 182) == BACKGROUND);
+	assert(get_pixel(buffer, 282, 318) == BACKGROUND);
+	assert(get_pixel(buffer, 418, 318) == BACKGROUND);
+
+	/* A plain translated square is filled corner to corner. */
+	assert(get_pixel(buffer, 600, 200) == FOREGROUND);
+	assert(get_pixel(buffer, 699, 299) == FOREGROUND);
+	assert(get_pixel(buffer, 599, 200) == BACKGROUND);
+	assert(get_pixel(buffer, 700, 299) == BACKGROUND);
+
+	wl_list_for_each_safe(view, next, &compositor->view_list, link) {
+		wl_list_remove(&view->link);
+		wl_list_init(&view->link);
+	}
+	wl_list_insert_list(&compositor->view_list, &views);
+
+	wl_list_remove(&rotation.link);
+	destroy_solid_view(rotated);
+	destroy_solid_view(moved);
+	destroy_solid_view(background);
+
+	pixman_image_unref(buffer);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, solid_view_rotated, compositor);
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2014 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "weston-test-client-helper.h"
+
+#define TOUCH_POINTS 10
+#define PACED_FRAMES 120	/* one second at 120 Hz */
+#define STRESS_FRAMES 2000
+#define FRAME_INTERVAL 8333	/* usecs */
+
+static double
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+send_touch_points(struct client *client, int frame, uint32_t type)
+{
+	int i;
+
+	/* Ten fingers side by side, moving down and back up. */
+	for (i = 0; i < TOUCH_POINTS; i++)
+		wl_test_send_touch(client->test->wl_test, i,
+				   wl_fixed_from_int(110 + 15 * i),
+				   wl_fixed_from_int(120 + frame % 100),
+				   type);
+	wl_test_send_touch_frame(client->test->wl_test);
+}
+
+TEST(touch_frames_10_points)
+{
+	struct client *client;
+	struct touch *touch;
+	double start, elapsed;
+	int frame;
+
+	client = client_create(100, 100, 200, 200);
+	assert(client);
+	client_roundtrip(client);
+
+	touch = client->input->touch;
+	assert(touch);
+
+	send_touch_points(client, 0, WL_TOUCH_DOWN);
+	client_roundtrip(client);
+	assert(touch->focus == client->surface);
+	assert(touch->down_count == TOUCH_POINTS);
+	assert(touch->frame_count == 1);
+
+	/* Every frame of motion arrives whole, with a single frame event. */
+	for (frame = 1; frame <= PACED_FRAMES; frame++) {
+		send_touch_points(client, frame, WL_TOUCH_MOTION);
+		client_roundtrip(client);
+		assert(touch->last_frame_motions == TOUCH_POINTS);
+		assert(touch->frame_motions == 0);
+		usleep(FRAME_INTERVAL);
+	}
+	assert(touch->motion_count == PACED_FRAMES * TOUCH_POINTS);
+	assert(touch->frame_count == 1 + PACED_FRAMES);
+
+	/* Then as fast as the compositor takes them. */
+	start = now_us();
+	for (frame = 1; frame <= STRESS_FRAMES; frame++) {
+		send_touch_points(client, frame, WL_TOUCH_MOTION);
+		if (frame % 100 == 0)
+			client_roundtrip(client);
+	}
+	client_roundtrip(client);
+	elapsed = now_us() - start;
+
+	assert(touch->motion_count ==
+	       (PACED_FRAMES + STRESS_FRAMES) * TOUCH_POINTS);
+	assert(touch->frame_count == 1 + PACED_FRAMES + STRESS_FRAMES);
+	assert(touch->last_frame_motions == TOUCH_POINTS);
+
+	/* Timings are only printed with WESTON_TEST_BENCHMARK set. */
+	if (getenv("WESTON_TEST_BENCHMARK"))
+		fprintf(stderr, "%d frames of %d touch points in %.1f ms, "
+			"%.1f us per frame\n", STRESS_FRAMES, TOUCH_POINTS,
+			elapsed / 1000, elapsed / STRESS_FRAMES);
+
+	send_touch_points(client, 0, WL_TOUCH_UP);
+	client_roundtrip(client);
+	assert(touch->up_count == TOUCH_POINTS);
+	assert(touch->frame_count == 2 + PACED_FRAMES + STRESS_FRAMES);
+}
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/mman.h>
 
 #include "../shared/os-compatibility.h"
@@ -122,6 +123,45 @@ get_n_egl_buffers(struct client *client)
 	return client->test->n_egl_buffers;
 }
 
+uint32_t
+replay_input(struct client *client, const char *path)
+{
+	client->test->replay_done = 0;
+	wl_test_replay_input(client->test->wl_test, path);
+
+	while (!client->test->replay_done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	return client->test->replay_count;
+}
+
+static uint64_t
+monotonic_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Called on entry to the input handlers, so the latency of a replayed
+ * event is taken before any of the logging below. */
+static void
+input_delivered(struct input *input)
+{
+	struct test *test = input->client->test;
+	uint64_t *latency;
+
+	if (test == NULL || test->injected_usec == 0)
+		return;
+
+	latency = wl_array_add(&test->latencies, sizeof *latency);
+	assert(latency);
+	*latency = monotonic_usec() - test->injected_usec;
+	test->injected_usec = 0;
+}
+
 static void
 pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
 		     uint32_t serial, struct wl_surface *wl_surface,
@@ -155,6 +195,8 @@ pointer_handle_motion(void *data, struct wl_pointer *wl_pointer,
 {
 	struct pointer *pointer = data;
 
+	input_delivered(pointer->input);
+
 	pointer->x = wl_fixed_to_int(x);
 	pointer->y = wl_fixed_to_int(y);
 
@@ -169,6 +211,8 @@ pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
 {
 	struct pointer *pointer = data;
 
+	input_delivered(pointer->input);
+
 	pointer->button = button;
 	pointer->state = state;
 
@@ -180,6 +224,10 @@ static void
 pointer_handle_axis(void *data, struct wl_pointer *wl_pointer,
 		    uint32_t time, uint32_t axis, wl_fixed_t value)
 {
+	struct pointer *pointer = data;
+
+	input_delivered(pointer->input);
+
 	fprintf(stderr, "test-client: got pointer axis %u %f\n",
 		axis, wl_fixed_to_double(value));
 }
@@ -233,6 +281,8 @@ keyboard_handle_key(void *data, struct wl_keyboard *wl_keyboard,
 {
 	struct keyboard *keyboard = data;
 
+	input_delivered(keyboard->input);
+
 	keyboard->key = key;
 	keyboard->state = state;
 
@@ -264,6 +314,66 @@ static const struct wl_keyboard_listener keyboard_listener = {
 	keyboard_handle_modifiers,
 };
 
+static void
+touch_handle_down(void *data, struct wl_touch *wl_touch,
+		  uint32_t serial, uint32_t time, struct wl_surface *wl_surface,
+		  int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+	struct touch *touch = data;
+
+	touch->focus = wl_surface_get_user_data(wl_surface);
+	touch->down_count++;
+	touch->x = wl_fixed_to_int(x);
+	touch->y = wl_fixed_to_int(y);
+}
+
+static void
+touch_handle_up(void *data, struct wl_touch *wl_touch,
+		uint32_t serial, uint32_t time, int32_t id)
+{
+	struct touch *touch = data;
+
+	touch->up_count++;
+}
+
+static void
+touch_handle_motion(void *data, struct wl_touch *wl_touch,
+		    uint32_t time, int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+	struct touch *touch = data;
+
+	touch->motion_count++;
+	touch->frame_motions++;
+	touch->x = wl_fixed_to_int(x);
+	touch->y = wl_fixed_to_int(y);
+}
+
+static void
+touch_handle_frame(void *data, struct wl_touch *wl_touch)
+{
+	struct touch *touch = data;
+
+	touch->frame_count++;
+	touch->last_frame_motions = touch->frame_motions;
+	touch->frame_motions = 0;
+}
+
+static void
+touch_handle_cancel(void *data, struct wl_touch *wl_touch)
+{
+	struct touch *touch = data;
+
+	touch->cancel_count++;
+}
+
+static const struct wl_touch_listener touch_listener = {
+	touch_handle_down,
+	touch_handle_up,
+	touch_handle_motion,
+	touch_handle_frame,
+	touch_handle_cancel,
+};
+
 static void
 surface_enter(void *data,
 	      struct wl_surface *wl_surface, struct wl_output *output)
@@ -359,9 +469,29 @@ test_handle_n_egl_buffers(void *data, struct wl_test *wl_test, uint32_t n)
 	test->n_egl_buffers = n;
 }
 
+static void
+test_handle_input_injected(void *data, struct wl_test *wl_test,
+			   uint32_t tv_sec, uint32_t tv_usec)
+{
+	struct test *test = data;
+
+	test->injected_usec = (uint64_t) tv_sec * 1000000 + tv_usec;
+}
+
+static void
+test_handle_replay_done(void *data, struct wl_test *wl_test, uint32_t count)
+{
+	struct test *test = data;
+
+	test->replay_done = 1;
+	test->replay_count = count;
+}
+
 static const struct wl_test_listener test_listener = {
 	test_handle_pointer_position,
 	test_handle_n_egl_buffers,
+	test_handle_input_injected,
+	test_handle_replay_done,
 };
 
 static void
@@ -371,9 +501,11 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 	struct input *input = data;
 	struct pointer *pointer;
 	struct keyboard *keyboard;
+	struct touch *touch;
 
 	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !input->pointer) {
 		pointer = xzalloc(sizeof *pointer);
+		pointer->input = input;
 		pointer->wl_pointer = wl_seat_get_pointer(seat);
 		wl_pointer_set_user_data(pointer->wl_pointer, pointer);
 		wl_pointer_add_listener(pointer->wl_pointer, &pointer_listener,
@@ -387,6 +519,7 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 
 	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !input->keyboard) {
 		keyboard = xzalloc(sizeof *keyboard);
+		keyboard->input = input;
 		keyboard->wl_keyboard = wl_seat_get_keyboard(seat);
 		wl_keyboard_set_user_data(keyboard->wl_keyboard, keyboard);
 		wl_keyboard_add_listener(keyboard->wl_keyboard, &keyboard_listener,
@@ -397,6 +530,20 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 		free(input->keyboard);
 		input->keyboard = NULL;
 	}
+
+	if ((caps & WL_SEAT_CAPABILITY_TOUCH) && !input->touch) {
+		touch = xzalloc(sizeof *touch);
+		touch->input = input;
+		touch->wl_touch = wl_seat_get_touch(seat);
+		wl_touch_set_user_data(touch->wl_touch, touch);
+		wl_touch_add_listener(touch->wl_touch, &touch_listener,
+				      touch);
+		input->touch = touch;
+	} else if (!(caps & WL_SEAT_CAPABILITY_TOUCH) && input->touch) {
+		wl_touch_destroy(input->touch->wl_touch);
+		free(input->touch);
+		input->touch = NULL;
+	}
 }
 
 static const struct wl_seat_listener seat_listener = {
@@ -464,6 +611,7 @@ handle_global(void *data, struct wl_registry *registry,
 					 &wl_compositor_interface, 1);
 	} else if (strcmp(interface, "wl_seat") == 0) {
 		input = xzalloc(sizeof *input);
+		input->client = client;
 		input->wl_seat =
 			wl_registry_bind(registry, id,
 					 &wl_seat_interface, 1);
@@ -484,6 +632,7 @@ handle_global(void *data, struct wl_registry *registry,
 		client->output = output;
 	} else if (strcmp(interface, "wl_test") == 0) {
 		test = xzalloc(sizeof *test);
+		wl_array_init(&test->latencies);
 		test->wl_test =
 			wl_registry_bind(registry, id,
 					 &wl_test_interface, 1);
@@ -54,15 +54,25 @@ struct test {
 	int pointer_x;
 	int pointer_y;
 	uint32_t n_egl_buffers;
+
+	/* Time of the last input_injected not yet delivered, and the
+	 * delays to delivery seen so far, as uint64_t usecs. */
+	uint64_t injected_usec;
+	struct wl_array latencies;
+	int replay_done;
+	uint32_t replay_count;
 };
 
 struct input {
+	struct client *client;
 	struct wl_seat *wl_seat;
 	struct pointer *pointer;
 	struct keyboard *keyboard;
+	struct touch *touch;
 };
 
 struct pointer {
+	struct input *input;
 	struct wl_pointer *wl_pointer;
 	struct surface *focus;
 	int x;
@@ -72,6 +82,7 @@ struct pointer {
 };
 
 struct keyboard {
+	struct input *input;
 	struct wl_keyboard *wl_keyboard;
 	struct surface *focus;
 	uint32_t key;
@@ -82,6 +93,22 @@ struct keyboard {
 	uint32_t group;
 };
 
+struct touch {
+	struct input *input;
+	struct wl_touch *wl_touch;
+	struct surface *focus;
+	int down_count;
+	int up_count;
+	int motion_count;
+	int frame_count;
+	int cancel_count;
+	/* Motions received since the last frame, and in the last frame. */
+	int frame_motions;
+	int last_frame_motions;
+	int x;
+	int y;
+};
+
 struct output {
 	struct wl_output *wl_output;
 	int x;
@@ -126,6 +153,9 @@ frame_callback_wait(struct client *client, int *done);
 int
 get_n_egl_buffers(struct client *client);
 
+uint32_t
+replay_input(struct client *client, const char *path);
+
 void
 skip(const char *fmt, ...);
 
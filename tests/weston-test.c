@@ -27,7 +27,12 @@
 #include <assert.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <linux/input.h>
 #include "../src/compositor.h"
+#include "../src/input-record.h"
 #include "wayland-test-server-protocol.h"
 
 #ifdef ENABLE_EGL
@@ -48,6 +53,19 @@ struct weston_test_surface {
 	struct weston_test *test;
 };
 
+struct input_replay {
+	struct weston_test *test;
+	struct wl_resource *resource;
+	struct wl_listener resource_destroy_listener;
+	struct wl_event_source *timer;
+
+	struct input_record *records;
+	uint32_t count, next;
+	uint64_t start;		/* CLOCK_MONOTONIC at the first record, usecs */
+	uint32_t injected;
+	int32_t dx, dy;
+};
+
 static void
 test_client_sigchld(struct weston_process *process, int status)
 {
@@ -194,6 +212,228 @@ send_key(struct wl_client *client, struct wl_resource *resource,
 	notify_key(seat, 100, key, state, STATE_UPDATE_AUTOMATIC);
 }
 
+static uint64_t
+monotonic_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+input_replay_destroy(struct input_replay *replay)
+{
+	wl_list_remove(&replay->resource_destroy_listener.link);
+	wl_event_source_remove(replay->timer);
+	free(replay->records);
+	free(replay);
+}
+
+static void
+input_replay_resource_destroyed(struct wl_listener *listener, void *data)
+{
+	struct input_replay *replay =
+		container_of(listener, struct input_replay,
+			     resource_destroy_listener);
+
+	input_replay_destroy(replay);
+}
+
+/* Sends input_injected with the time the event goes into the seat, so
+ * the client can tell how long it took to reach it. */
+static uint32_t
+input_replay_inject(struct input_replay *replay)
+{
+	uint64_t now = monotonic_usec();
+
+	wl_test_send_input_injected(replay->resource,
+				    now / 1000000, now % 1000000);
+	replay->injected++;
+
+	return now / 1000;
+}
+
+/* Only relative pointer and key events are replayed, the test seat has no
+ * touch or absolute pointer device to pass the others to. */
+static void
+input_replay_event(struct input_replay *replay, struct input_record *r)
+{
+	struct weston_seat *seat = get_seat(replay->test);
+	uint32_t time;
+
+	switch (r->type) {
+	case EV_REL:
+		switch (r->code) {
+		case REL_X:
+			replay->dx += r->value;
+			break;
+		case REL_Y:
+			replay->dy += r->value;
+			break;
+		case REL_WHEEL:
+			time = input_replay_inject(replay);
+			notify_axis(seat, time, WL_POINTER_AXIS_VERTICAL_SCROLL,
+				    -r->value * wl_fixed_from_int(10));
+			break;
+		case REL_HWHEEL:
+			time = input_replay_inject(replay);
+			notify_axis(seat, time,
+				    WL_POINTER_AXIS_HORIZONTAL_SCROLL,
+				    r->value * wl_fixed_from_int(10));
+			break;
+		}
+		break;
+	case EV_KEY:
+		/* Key repeat is the client's business. */
+		if (r->value == 2)
+			break;
+		time = input_replay_inject(replay);
+		if (r->code >= BTN_LEFT && r->code <= BTN_TASK)
+			notify_button(seat, time, r->code,
+				      r->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+				      WL_POINTER_BUTTON_STATE_RELEASED);
+		else
+			notify_key(seat, time, r->code,
+				   r->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
+				   WL_KEYBOARD_KEY_STATE_RELEASED,
+				   STATE_UPDATE_AUTOMATIC);
+		break;
+	case EV_SYN:
+		if (r->code != SYN_REPORT ||
+		    (replay->dx == 0 && replay->dy == 0))
+			break;
+		time = input_replay_inject(replay);
+		notify_motion(seat, time, wl_fixed_from_int(replay->dx),
+			      wl_fixed_from_int(replay->dy));
+		replay->dx = replay->dy = 0;
+		break;
+	}
+}
+
+static int
+input_replay_timer(void *data)
+{
+	struct input_replay *replay = data;
+	struct input_record *first = &replay->records[0];
+	uint64_t now, due;
+
+	now = monotonic_usec();
+	while (replay->next < replay->count) {
+		due = replay->start +
+			(replay->records[replay->next].time - first->time);
+		if (due > now) {
+			wl_event_source_timer_update(replay->timer,
+						     (due - now + 999) / 1000);
+			return 1;
+		}
+
+		input_replay_event(replay, &replay->records[replay->next++]);
+	}
+
+	wl_test_send_replay_done(replay->resource, replay->injected);
+	input_replay_destroy(replay);
+
+	return 1;
+}
+
+static int
+input_replay_load(struct input_replay *replay, const char *path)
+{
+	struct input_record_header header;
+	struct stat st;
+	size_t size;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 ||
+	    read(fd, &header, sizeof header) != sizeof header ||
+	    header.magic != INPUT_RECORD_MAGIC ||
+	    header.version != INPUT_RECORD_VERSION)
+		goto out;
+
+	replay->count = (st.st_size - sizeof header) / sizeof *replay->records;
+	if (replay->count == 0)
+		goto out;
+
+	size = replay->count * sizeof *replay->records;
+	replay->records = malloc(size);
+	if (replay->records == NULL ||
+	    read(fd, replay->records, size) != (ssize_t) size)
+		goto out;
+
+	ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+static void
+replay_input(struct wl_client *client, struct wl_resource *resource,
+	     const char *path)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct wl_event_loop *loop;
+	struct input_replay *replay;
+
+	replay = zalloc(sizeof *replay);
+	if (replay == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	if (input_replay_load(replay, path) < 0) {
+		weston_log("failed to load input recording %s\n", path);
+		free(replay->records);
+		free(replay);
+		wl_test_send_replay_done(resource, 0);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(test->compositor->wl_display);
+	replay->timer = wl_event_loop_add_timer(loop, input_replay_timer,
+						replay);
+	if (replay->timer == NULL) {
+		free(replay->records);
+		free(replay);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	replay->test = test;
+	replay->resource = resource;
+	replay->resource_destroy_listener.notify =
+		input_replay_resource_destroyed;
+	wl_resource_add_destroy_listener(resource,
+					 &replay->resource_destroy_listener);
+
+	replay->start = monotonic_usec();
+	wl_event_source_timer_update(replay->timer, 1);
+}
+
+static void
+send_touch(struct wl_client *client, struct wl_resource *resource,
+	   int32_t touch_id, wl_fixed_t x, wl_fixed_t y, uint32_t touch_type)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct weston_seat *seat = get_seat(test);
+
+	notify_touch(seat, 100, touch_id, x, y, touch_type);
+}
+
+static void
+send_touch_frame(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct weston_seat *seat = get_seat(test);
+
+	notify_touch_frame(seat);
+}
+
 #ifdef ENABLE_EGL
 static int
 is_egl_buffer(struct wl_resource *resource)
@@ -242,6 +482,9 @@ static const struct wl_test_interface test_implementation = {
 	activate_surface,
 	send_key,
 	get_n_buffers,
+	replay_input,
+	send_touch,
+	send_touch_frame,
 };
 
 static void
@@ -298,6 +541,9 @@ module_init(struct weston_compositor *ec,
 	test->compositor = ec;
 	weston_layer_init(&test->layer, &ec->cursor_layer.link);
 
+	/* For send_touch, the headless seat has no touch device. */
+	weston_seat_init_touch(get_seat(test));
+
 	if (wl_global_create(ec->wl_display, &wl_test_interface, 1,
 			     test, bind_test) == NULL)
 		return -1;
@@ -33,17 +33,18 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
 static void
-write_png(struct wcap_decoder *decoder, const char *filename)
+write_png(struct wcap_decoder *decoder, uint32_t *frame, const char *filename)
 {
 	cairo_surface_t *surface;
 
-	surface = cairo_image_surface_create_for_data((unsigned char *) decoder->frame,
+	surface = cairo_image_surface_create_for_data((unsigned char *) frame,
 						      CAIRO_FORMAT_ARGB32,
 						      decoder->width,
 						      decoder->height,
@@ -96,7 +97,8 @@ int clamp_uv(int u)
 }
 
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, uint32_t *frame,
+		unsigned char *out)
 {
 	unsigned char *y1, *y2, *u, *v;
 	uint32_t *p1, *p2, *end;
@@ -110,7 +112,7 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
 		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
+		p1 = frame + decoder->width * i;
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
@@ -135,7 +137,8 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, uint32_t *frame,
+		  unsigned char *out)
 {
 
 	unsigned char *yp, *up, *vp;
@@ -150,7 +153,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
+		rp = frame + decoder->width * i;
 		end = rp + decoder->width;	
 		while (rp < end) {
 			u = 0;
@@ -166,43 +169,241 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
+/* Decoding is inherently serial, since every frame is a delta against
+ * the previous one, but converting and writing out the decoded frames is
+ * not.  The main thread decodes and copies each frame to be output into
+ * a job slot, a pool of worker threads writes pngs or converts to YUV,
+ * and the main thread writes the YUV frames to stdout in order as their
+ * slots come up for reuse. */
+
+enum job_state {
+	JOB_FREE,
+	JOB_QUEUED,
+	JOB_DONE
+};
+
+struct job {
+	enum job_state state;
+	uint32_t *frame;
+	unsigned char *yuv;
+	int index;
+	int png;
+	int repeat;	/* times to write the YUV frame again */
+};
+
+struct pipeline {
+	struct wcap_decoder *decoder;
+	int yuv4mpeg2, raw;
+	size_t yuv_size;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct job *jobs, *last;
+	int njobs;
+	int queued, next, quit;
+
+	pthread_t *threads;
+	int nthreads;
+};
+
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+pipeline_process(struct pipeline *pipeline, struct job *job)
 {
-	static unsigned char *out;
-	int size;
+	struct wcap_decoder *decoder = pipeline->decoder;
+	char filename[200];
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
+	if (job->png) {
+		snprintf(filename, sizeof filename,
+			 "wcap-frame-%d.png", job->index);
+		write_png(decoder, job->frame, filename);
+		fprintf(stderr, "wrote %s\n", filename);
 	}
-	if (out == NULL)
-		out = malloc(size);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
+	if (pipeline->yuv4mpeg2 == 444)
+		convert_to_yuv444(decoder, job->frame, job->yuv);
+	else if (pipeline->yuv4mpeg2)
+		convert_to_yv12(decoder, job->frame, job->yuv);
+}
+
+static void *
+pipeline_worker(void *data)
+{
+	struct pipeline *pipeline = data;
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (1) {
+		while (pipeline->next == pipeline->queued && !pipeline->quit)
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+		if (pipeline->next == pipeline->queued)
+			break;
+
+		job = &pipeline->jobs[pipeline->next % pipeline->njobs];
+		pipeline->next++;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		pipeline_process(pipeline, job);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&pipeline->cond);
 	}
+	pthread_mutex_unlock(&pipeline->mutex);
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	return NULL;
+}
+
+/* Wait for the job to finish and write out its YUV frame, if any. */
+static void
+pipeline_retire(struct pipeline *pipeline, struct job *job)
+{
+	int i;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (job->state == JOB_QUEUED)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	if (job->state == JOB_DONE && pipeline->yuv4mpeg2) {
+		for (i = 0; i <= job->repeat; i++) {
+			if (!pipeline->raw)
+				printf("FRAME\n");
+			fwrite(job->yuv, 1, pipeline->yuv_size, stdout);
+		}
+	}
+
+	job->state = JOB_FREE;
+}
+
+static void
+pipeline_queue(struct pipeline *pipeline, int index, int png, int changed)
+{
+	struct wcap_decoder *decoder = pipeline->decoder;
+	struct job *job;
+
+	/* The newest job is written out last, so an unchanged frame can be
+	 * repeated without converting it again. */
+	if (!changed && !png && pipeline->last && !pipeline->last->png) {
+		pipeline->last->repeat++;
+		return;
+	}
+
+	job = &pipeline->jobs[pipeline->queued % pipeline->njobs];
+	pipeline_retire(pipeline, job);
+
+	memcpy(job->frame, decoder->frame,
+	       decoder->width * decoder->height * 4);
+	job->index = index;
+	job->png = png;
+	job->repeat = 0;
+	pipeline->last = job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	job->state = JOB_QUEUED;
+	pipeline->queued++;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static int
+pipeline_init(struct pipeline *pipeline, struct wcap_decoder *decoder,
+	      int yuv4mpeg2, int raw, int nthreads)
+{
+	int i;
+
+	memset(pipeline, 0, sizeof *pipeline);
+	pipeline->decoder = decoder;
+	pipeline->yuv4mpeg2 = yuv4mpeg2;
+	pipeline->raw = raw;
+	if (yuv4mpeg2 == 444)
+		pipeline->yuv_size = decoder->width * decoder->height * 3;
+	else
+		pipeline->yuv_size = decoder->width * decoder->height * 3 / 2;
+
+	/* A couple of spare slots let decoding run ahead of the workers
+	 * without holding on to too many full size frames. */
+	pipeline->njobs = nthreads + 2;
+	pipeline->jobs = calloc(pipeline->njobs, sizeof *pipeline->jobs);
+	pipeline->threads = calloc(nthreads, sizeof *pipeline->threads);
+	if (pipeline->jobs == NULL || pipeline->threads == NULL)
+		return -1;
+
+	for (i = 0; i < pipeline->njobs; i++) {
+		pipeline->jobs[i].frame =
+			malloc(decoder->width * decoder->height * 4);
+		if (pipeline->jobs[i].frame == NULL)
+			return -1;
+		if (yuv4mpeg2) {
+			pipeline->jobs[i].yuv = malloc(pipeline->yuv_size);
+			if (pipeline->jobs[i].yuv == NULL)
+				return -1;
+		}
+	}
+
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pipeline->threads[i], NULL,
+				   pipeline_worker, pipeline) != 0)
+			break;
+		pipeline->nthreads++;
+	}
+
+	return pipeline->nthreads > 0 ? 0 : -1;
+}
+
+static void
+pipeline_finish(struct pipeline *pipeline)
+{
+	int i;
+
+	for (i = pipeline->queued - pipeline->njobs; i < pipeline->queued; i++)
+		if (i >= 0)
+			pipeline_retire(pipeline,
+					&pipeline->jobs[i % pipeline->njobs]);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->quit = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	for (i = 0; i < pipeline->nthreads; i++)
+		pthread_join(pipeline->threads[i], NULL);
+
+	fflush(stdout);
+
+	for (i = 0; i < pipeline->njobs; i++) {
+		free(pipeline->jobs[i].frame);
+		free(pipeline->jobs[i].yuv);
+	}
+	free(pipeline->jobs);
+	free(pipeline->threads);
+	pthread_mutex_destroy(&pipeline->mutex);
+	pthread_cond_destroy(&pipeline->cond);
 }
 
 static void
 usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
-		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--time=<ms>]\n"
+		"\t[--all] [--rate=<num:denom>] [--raw] [--jobs=<n>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
+		"\t--time=<ms>\t\twrite out the frame shown <ms> after the\n"
+		"\t\t\t\tfirst frame as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--raw\t\t\twrite bare planar yuv frames without the\n"
+		"\t\t\t\tyuv4mpeg2 headers, implies --yuv4mpeg2\n"
+		"\t\t\t\tif no format is given\n"
+		"\t--jobs=<n>\t\tconvert and write frames on <n> threads,\n"
+		"\t\t\t\tdefaults to the number of cpus\n\n");
 
 	exit(exit_code);
 }
@@ -211,7 +412,9 @@ int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
+	int num = 30, denom = 1, output_time = -1;
+	int raw = 0, jobs = 0, changed;
+	struct pipeline pipeline;
 	char filename[200];
 	char *mode;
 	uint32_t msecs, frame_time;
@@ -225,8 +428,14 @@ int main(int argc, char *argv[])
 			usage(EXIT_SUCCESS);
 		} else if (strcmp(argv[i], "--all") == 0) {
 			all = 1;
+		} else if (strcmp(argv[i], "--raw") == 0) {
+			raw = 1;
+		} else if (sscanf(argv[i], "--jobs=%d", &jobs) == 1) {
+			;
 		} else if (sscanf(argv[i], "--frame=%d", &output_frame) == 1) {
 			;
+		} else if (sscanf(argv[i], "--time=%d", &output_time) == 1) {
+			;
 		} else if (sscanf(argv[i], "--rate=%d", &num) == 1) {
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
@@ -249,6 +458,12 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
+	if (raw && !yuv4mpeg2)
+		yuv4mpeg2 = 420;
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
 
 	decoder = wcap_decoder_create(argv[1]);
 	if (decoder == NULL) {
@@ -256,6 +471,24 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (output_time >= 0) {
+		if (!wcap_decoder_seek(decoder,
+				       decoder->first_msecs + output_time)) {
+			fprintf(stderr, "no frame at %dms\n", output_time);
+			wcap_decoder_destroy(decoder);
+			exit(EXIT_FAILURE);
+		}
+
+		snprintf(filename, sizeof filename,
+			 "wcap-time-%d.png", output_time);
+		write_png(decoder, decoder->frame, filename);
+		fprintf(stderr, "wrote %s (frame %d)\n",
+			filename, decoder->count - 1);
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
+	}
+
 	if (yuv4mpeg2 && isatty(1)) {
 		fprintf(stderr, "Not dumping yuv4mpeg2 data to terminal.  Pipe output to a file or a process.\n");
 		fprintf(stderr, "For example, to encode to webm, use something like\n\n");
@@ -265,7 +498,13 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	if (yuv4mpeg2) {
+	if ((yuv4mpeg2 || all || output_frame >= 0) &&
+	    pipeline_init(&pipeline, decoder, yuv4mpeg2, raw, jobs) < 0) {
+		fprintf(stderr, "failed to set up output threads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (yuv4mpeg2 && !raw) {
 		if (yuv4mpeg2 == 444) {
 			mode = "C444";
 		} else {
@@ -280,21 +519,23 @@ int main(int argc, char *argv[])
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
 	frame_time = 1000 * denom / num;
+	changed = 1;
 	while (has_frame) {
-		if (all || i == output_frame) {
-			snprintf(filename, sizeof filename,
-				 "wcap-frame-%d.png", i);
-			write_png(decoder, filename);
-			fprintf(stderr, "wrote %s\n", filename);
-		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
+		if (yuv4mpeg2 || all || i == output_frame)
+			pipeline_queue(&pipeline, i,
+				       all || i == output_frame, changed);
 		i++;
 		msecs += frame_time;
-		while (decoder->msecs < msecs && has_frame)
+		changed = 0;
+		while (decoder->msecs < msecs && has_frame) {
 			has_frame = wcap_decoder_get_frame(decoder);
+			changed |= has_frame;
+		}
 	}
 
+	if (yuv4mpeg2 || all || output_frame >= 0)
+		pipeline_finish(&pipeline);
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
 
@@ -35,21 +35,42 @@
 
 #include <cairo.h>
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
 #include "wcap-decode.h"
 
-static void
+#define ALIGN4(n) (((n) + 3) & ~3)
+
+/* Returns the data following the rectangle, or NULL if the rectangle
+ * lies outside the frame or its data runs past end. */
+static uint32_t *
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      struct wcap_rectangle *rect, uint32_t *p,
+			      uint32_t *end)
 {
-	uint32_t v, *p = decoder->p, *d;
-	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
+	uint32_t v, *d;
+	int width, height;
+	int x, i, j, k, l, count;
 	unsigned char r, g, b, dr, dg, db;
 
+	if (rect->x1 < 0 || rect->x1 >= rect->x2 ||
+	    rect->x2 > decoder->width ||
+	    rect->y1 < 0 || rect->y1 >= rect->y2 ||
+	    rect->y2 > decoder->height)
+		return NULL;
+
+	width = rect->x2 - rect->x1;
+	height = rect->y2 - rect->y1;
+	count = width * height;
+
 	d = decoder->frame + (rect->y2 - 1) * decoder->width;
 	x = rect->x1;
 	i = 0;
 	while (i < count) {
+		if (p >= end)
+			return NULL;
 		v = *p++;
 		l = v >> 24;
 		if (l < 0xe0) {
@@ -57,6 +78,8 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 		} else {
 			j = 1 << (l - 0xe0 + 7);
 		}
+		if (j > count - i)
+			return NULL;
 
 		dr = (v >> 16);
 		dg = (v >>  8);
@@ -75,44 +98,296 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 		i += j;
 	}
 
-	if (i != count)
-		printf("rle encoding longer than expected (%d expected %d)\n",
-		       i, count);
+	return p;
+}
 
-	decoder->p = p;
+static size_t
+wcap_frame_v2_length(struct wcap_frame_header_v2 *header)
+{
+	return sizeof *header +
+		header->nrects * sizeof (struct wcap_rectangle) +
+		ALIGN4(header->size);
 }
 
-int
-wcap_decoder_get_frame(struct wcap_decoder *decoder)
+static int
+wcap_decoder_get_frame_v1(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
-
-	if (decoder->p == decoder->end)
-		return 0;
+	uint32_t i, *p, *end;
+	size_t left;
 
 	header = decoder->p;
+	left = (char *) decoder->end - (char *) header;
+	if (left < sizeof *header)
+		goto corrupt;
+	left -= sizeof *header;
+	if (header->nrects > left / sizeof *rects)
+		goto corrupt;
+	left -= header->nrects * sizeof *rects;
+
+	rects = (void *) (header + 1);
+	p = (uint32_t *) (rects + header->nrects);
+	end = p + left / 4;
+	for (i = 0; i < header->nrects; i++) {
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p, end);
+		if (p == NULL)
+			goto corrupt;
+	}
+
 	decoder->msecs = header->msecs;
 	decoder->count++;
+	decoder->p = p;
+
+	return 1;
+
+corrupt:
+	fprintf(stderr, "frame %u is truncated or corrupt\n", decoder->count);
+	return 0;
+}
+
+static int
+wcap_decoder_get_frame_v2(struct wcap_decoder *decoder)
+{
+	struct wcap_rectangle *rects;
+	struct wcap_frame_header_v2 *header;
+	uint32_t i, *p, *end, frame_size;
+	size_t left;
+	char *payload;
+
+	frame_size = decoder->width * decoder->height * 4;
+	header = decoder->p;
+	left = (char *) decoder->end - (char *) header;
+	if (left < sizeof *header)
+		goto corrupt;
+	left -= sizeof *header;
+
+	/* Bound the rectangles before pointing past them. */
+	if (header->nrects > left / sizeof *rects)
+		goto corrupt;
+	left -= header->nrects * sizeof *rects;
+	if (header->size > left || header->raw_size > frame_size)
+		goto corrupt;
 
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+	payload = (char *) (rects + header->nrects);
+
+	if (header->flags & WCAP_FRAME_LZ4) {
+#ifdef HAVE_LZ4
+		if (LZ4_decompress_safe(payload, (char *) decoder->payload,
+					header->size, header->raw_size) !=
+		    (int) header->raw_size) {
+			fprintf(stderr, "frame %u failed to decompress\n",
+				decoder->count);
+			return 0;
+		}
+		p = decoder->payload;
+		end = p + header->raw_size / 4;
+#else
+		fprintf(stderr, "frame %u is lz4 compressed, but wcap-decode "
+			"was built without lz4 support\n", decoder->count);
+		return 0;
+#endif
+	} else {
+		p = (uint32_t *) payload;
+		end = p + header->size / 4;
+	}
+
+	if (header->flags & WCAP_FRAME_KEYFRAME)
+		memset(decoder->frame, 0, frame_size);
+
+	for (i = 0; i < header->nrects; i++) {
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p, end);
+		if (p == NULL)
+			goto corrupt;
+	}
+
+	decoder->msecs = header->msecs;
+	decoder->count++;
+	decoder->p = (char *) header + wcap_frame_v2_length(header);
+
+	return 1;
+
+corrupt:
+	fprintf(stderr, "frame %u is truncated or corrupt\n", decoder->count);
+	return 0;
+}
+
+int
+wcap_decoder_get_frame(struct wcap_decoder *decoder)
+{
+	if (decoder->p >= decoder->end)
+		return 0;
+
+	if (decoder->version == 1)
+		return wcap_decoder_get_frame_v1(decoder);
+	else
+		return wcap_decoder_get_frame_v2(decoder);
+}
+
+static void
+wcap_decoder_rewind(struct wcap_decoder *decoder, void *p, uint32_t count)
+{
+	memset(decoder->frame, 0, decoder->width * decoder->height * 4);
+	decoder->p = p;
+	decoder->count = count;
+}
+
+/* Decode the last frame at or before msecs, or the first frame if msecs
+ * is earlier than that.  With an index, decoding starts at the closest
+ * keyframe, or continues from the current frame when that is closer. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	struct wcap_header *file_header = decoder->map;
+	struct wcap_frame_header *header;
+	uint32_t lo, hi, mid, key, target;
+
+	if (decoder->index == NULL) {
+		if (decoder->count > 0 && decoder->msecs > msecs)
+			wcap_decoder_rewind(decoder, file_header + 1, 0);
+
+		while (decoder->p < decoder->end) {
+			header = decoder->p;
+			if (decoder->count > 0 && header->msecs > msecs)
+				break;
+			if (!wcap_decoder_get_frame(decoder))
+				return 0;
+		}
+
+		return decoder->count > 0;
+	}
+
+	if (decoder->index_count == 0)
+		return 0;
+
+	lo = 0;
+	hi = decoder->index_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (decoder->index[mid].msecs <= msecs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	target = lo > 0 ? lo - 1 : 0;
+
+	key = target;
+	while (key > 0 && !(decoder->index[key].flags & WCAP_FRAME_KEYFRAME))
+		key--;
+
+	if (decoder->count <= key || decoder->count > target + 1)
+		wcap_decoder_rewind(decoder,
+				    (char *) decoder->map +
+				    decoder->index[key].offset, key);
+
+	while (decoder->count <= target)
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
 
 	return 1;
 }
 
+/* The frames end with the last one in the index.  The recorder pads
+ * after it with fewer than eight bytes to align the index, so anything
+ * else means the trailer can not be trusted. */
+static char *
+wcap_decoder_index_frames_end(struct wcap_decoder *decoder,
+			      struct wcap_index_trailer *trailer)
+{
+	struct wcap_index_entry *index;
+	struct wcap_frame_header_v2 *header;
+	uint64_t offset;
+	size_t length;
+
+	index = (void *) ((char *) decoder->map + trailer->offset);
+	if (trailer->count == 0)
+		return (char *) index;
+
+	offset = index[trailer->count - 1].offset;
+	if (offset < sizeof (struct wcap_header) ||
+	    offset > trailer->offset ||
+	    trailer->offset - offset < sizeof *header)
+		return NULL;
+
+	header = (void *) ((char *) decoder->map + offset);
+	length = wcap_frame_v2_length(header);
+	if (length > trailer->offset - offset ||
+	    trailer->offset - offset - length >= 8)
+		return NULL;
+
+	return (char *) header + length;
+}
+
+/* Use the index at the end of the file if the recorder got to write
+ * one, otherwise walk the frame headers to build one. */
+static int
+wcap_decoder_load_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer *trailer;
+	struct wcap_frame_header_v2 *header;
+	struct wcap_index_entry *index;
+	size_t first = sizeof (struct wcap_header);
+	uint32_t alloc = 0;
+	char *p;
+
+	if (decoder->size >= first + sizeof *trailer &&
+	    decoder->size % 8 == 0) {
+		trailer = (void *) ((char *) decoder->map +
+				    decoder->size - sizeof *trailer);
+		if (trailer->magic == WCAP_INDEX_MAGIC &&
+		    trailer->offset >= first &&
+		    trailer->offset % 8 == 0 &&
+		    trailer->offset + (uint64_t) trailer->count *
+		    sizeof *index + sizeof *trailer == decoder->size &&
+		    (p = wcap_decoder_index_frames_end(decoder, trailer))) {
+			decoder->index = (void *) ((char *) decoder->map +
+						   trailer->offset);
+			decoder->index_count = trailer->count;
+			decoder->end = p;
+			return 0;
+		}
+	}
+
+	decoder->own_index = 1;
+	p = (char *) decoder->map + first;
+	while ((char *) decoder->end - p >= (long) sizeof *header) {
+		header = (void *) p;
+		if ((size_t) ((char *) decoder->end - p) <
+		    wcap_frame_v2_length(header))
+			break;
+
+		if (decoder->index_count == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			index = realloc(decoder->index, alloc * sizeof *index);
+			if (index == NULL)
+				return -1;
+			decoder->index = index;
+		}
+
+		index = &decoder->index[decoder->index_count++];
+		index->msecs = header->msecs;
+		index->flags = header->flags;
+		index->offset = p - (char *) decoder->map;
+		p += wcap_frame_v2_length(header);
+	}
+
+	/* Drop a frame the recorder did not get to finish writing. */
+	decoder->end = p;
+
+	return 0;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
+	struct wcap_frame_header *first;
 	int frame_size;
 	struct stat buf;
 
-	decoder = malloc(sizeof *decoder);
+	decoder = calloc(1, sizeof *decoder);
 	if (decoder == NULL)
 		return NULL;
 
@@ -124,15 +399,36 @@ wcap_decoder_create(const char *filename)
 
 	fstat(decoder->fd, &buf);
 	decoder->size = buf.st_size;
+	if (decoder->size < sizeof *header) {
+		fprintf(stderr, "file too short for a wcap header\n");
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
+
 	decoder->map = mmap(NULL, decoder->size,
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
 	if (decoder->map == MAP_FAILED) {
 		fprintf(stderr, "mmap failed\n");
+		close(decoder->fd);
 		free(decoder);
 		return NULL;
 	}
 		
 	header = decoder->map;
+	switch (header->magic) {
+	case WCAP_HEADER_MAGIC:
+		decoder->version = 1;
+		break;
+	case WCAP_HEADER_MAGIC_V2:
+		decoder->version = 2;
+		break;
+	default:
+		fprintf(stderr, "not a wcap file, or wrong endianness\n");
+		wcap_decoder_destroy(decoder);
+		return NULL;
+	}
+
 	decoder->format = header->format;
 	decoder->count = 0;
 	decoder->width = header->width;
@@ -141,12 +437,24 @@ wcap_decoder_create(const char *filename)
 	decoder->end = decoder->map + decoder->size;
 
 	frame_size = header->width * header->height * 4;
-	decoder->frame = malloc(frame_size);
+	decoder->frame = calloc(1, frame_size);
 	if (decoder->frame == NULL) {
-		free(decoder);
+		wcap_decoder_destroy(decoder);
 		return NULL;
 	}
-	memset(decoder->frame, 0, frame_size);
+
+	if (decoder->version == 2) {
+		decoder->payload = malloc(frame_size);
+		if (decoder->payload == NULL ||
+		    wcap_decoder_load_index(decoder) < 0) {
+			wcap_decoder_destroy(decoder);
+			return NULL;
+		}
+	}
+
+	first = decoder->p;
+	if ((char *) decoder->end - (char *) first >= (long) sizeof *first)
+		decoder->first_msecs = first->msecs;
 
 	return decoder;
 }
@@ -156,6 +464,9 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	if (decoder->own_index)
+		free(decoder->index);
+	free(decoder->payload);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -24,6 +24,8 @@
 #define _WCAP_DECODE_
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57434958
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -41,10 +43,33 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+#define WCAP_FRAME_LZ4		(1 << 1)
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;		/* payload bytes in the file, before padding */
+	uint32_t raw_size;	/* payload bytes once decompressed */
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+struct wcap_index_entry {
+	uint32_t msecs;
+	uint32_t flags;
+	uint64_t offset;	/* of the frame header, from start of file */
+};
+
+struct wcap_index_trailer {
+	uint64_t offset;	/* of the first index entry */
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -54,9 +79,17 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	int version;
+	uint32_t first_msecs;
+	uint32_t *payload;
+	struct wcap_index_entry *index;
+	uint32_t index_count;
+	int own_index;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -24,11 +24,55 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 #include "xwayland.h"
 
+/* Largest INCR chunk, and largest selection sent in one property.  Every
+ * chunk costs a round trip through the requestor, so they are as large
+ * as the X server takes in one request, up to this. */
+#define SELECTION_CHUNK_SIZE_MAX	(1024 * 1024)
+#define SELECTION_CHUNK_SIZE_MIN	(64 * 1024)
+
+static uint64_t
+selection_time_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+weston_wm_transfer_start(struct weston_wm *wm, int fd)
+{
+	/* Let the pipe hold a whole chunk, so the other end can fill it
+	 * while we wait on the X server.  Only a hint, the pipe may not
+	 * be ours to grow. */
+	fcntl(fd, F_SETPIPE_SZ, wm->selection_chunk_size);
+
+	wm->selection_transfer.start = selection_time_usec();
+	wm->selection_transfer.bytes = 0;
+}
+
+static void
+weston_wm_transfer_done(struct weston_wm *wm, const char *direction)
+{
+	uint64_t usec;
+
+	usec = selection_time_usec() - wm->selection_transfer.start;
+	if (usec == 0)
+		usec = 1;
+
+	weston_log("selection transfer %s: %zu bytes in %.1f ms, %.1f MB/s\n",
+		   direction, wm->selection_transfer.bytes, usec / 1000.0,
+		   (double) wm->selection_transfer.bytes / usec);
+}
+
 static int
 writable_callback(int fd, uint32_t mask, void *data)
 {
@@ -41,6 +85,8 @@ writable_callback(int fd, uint32_t mask, void *data)
 		wm->property_start;
 
 	len = write(fd, property + wm->property_start, remainder);
+	if (len == -1 && errno == EAGAIN)
+		return 1;
 	if (len == -1) {
 		free(wm->property_reply);
 		wm->property_reply = NULL;
@@ -51,10 +97,7 @@ writable_callback(int fd, uint32_t mask, void *data)
 		return 1;
 	}
 
-	weston_log("wrote %d (chunk size %d) of %d bytes\n",
-		wm->property_start + len,
-		len, xcb_get_property_value_length(wm->property_reply));
-
+	wm->selection_transfer.bytes += len;
 	wm->property_start += len;
 	if (len == remainder) {
 		free(wm->property_reply);
@@ -67,7 +110,7 @@ writable_callback(int fd, uint32_t mask, void *data)
 					    wm->selection_window,
 					    wm->atom.wl_selection);
 		} else {
-			weston_log("transfer complete\n");
+			weston_wm_transfer_done(wm, "X to wayland");
 			close(fd);
 		}
 	}
@@ -111,7 +154,7 @@ weston_wm_get_incr_chunk(struct weston_wm *wm)
 	if (xcb_get_property_value_length(reply) > 0) {
 		weston_wm_write_property(wm, reply);
 	} else {
-		weston_log("transfer complete\n");
+		weston_wm_transfer_done(wm, "X to wayland");
 		close(wm->data_source_fd);
 		free(reply);
 	}
@@ -148,6 +191,7 @@ data_source_send(struct weston_data_source *base,
 
 		fcntl(fd, F_SETFL, O_WRONLY | O_NONBLOCK);
 		wm->data_source_fd = fd;
+		weston_wm_transfer_start(wm, fd);
 	}
 }
 
@@ -255,8 +299,6 @@ weston_wm_handle_selection_notify(struct weston_wm *wm,
 	}
 }
 
-static const size_t incr_chunk_size = 64 * 1024;
-
 static void
 weston_wm_send_selection_notify(struct weston_wm *wm, xcb_atom_t property)
 {
@@ -337,30 +379,35 @@ static int
 weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 {
 	struct weston_wm *wm = data;
-	int len, current, available;
-	void *p;
+	size_t chunk_size = wm->selection_chunk_size;
+	size_t current;
+	ssize_t len = -1;
+	char *p;
 
 	current = wm->source_data.size;
-	if (wm->source_data.size < incr_chunk_size)
-		p = wl_array_add(&wm->source_data, incr_chunk_size);
-	else
-		p = (char *) wm->source_data.data + wm->source_data.size;
-	available = wm->source_data.alloc - current;
+	if (wm->source_data.alloc - current < chunk_size) {
+		if (wl_array_add(&wm->source_data, chunk_size) == NULL)
+			goto err;
+		wm->source_data.size = current;
+	}
 
-	len = read(fd, p, available);
-	if (len == -1) {
-		weston_log("read error from data source: %m\n");
-		weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
-		wl_event_source_remove(wm->property_source);
-		close(fd);
-		wl_array_release(&wm->source_data);
+	/* Take everything the pipe has, up to a full chunk, rather than
+	 * waking up for every write the source makes. */
+	while (wm->source_data.size < chunk_size) {
+		p = (char *) wm->source_data.data + wm->source_data.size;
+		len = read(fd, p, chunk_size - wm->source_data.size);
+		if (len <= 0)
+			break;
+		wm->source_data.size += len;
+		wm->selection_transfer.bytes += len;
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		len = 1;
+	if (len == -1)
+		goto err;
 
-	wm->source_data.size = current + len;
-	if (wm->source_data.size >= incr_chunk_size) {
+	if (wm->source_data.size >= chunk_size) {
 		if (!wm->incr) {
 			weston_log("got %zu bytes, starting incr\n",
 				wm->source_data.size);
@@ -371,7 +418,7 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 					    wm->selection_request.property,
 					    wm->atom.incr,
 					    32, /* format */
-					    1, &incr_chunk_size);
+					    1, &wm->selection_chunk_size);
 			wm->selection_property_set = 1;
 			wm->flush_property_on_delete = 1;
 			wl_event_source_remove(wm->property_source);
@@ -389,7 +436,7 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 			weston_wm_flush_source_data(wm);
 		}
 	} else if (len == 0 && !wm->incr) {
-		weston_log("non-incr transfer complete\n");
+		weston_wm_transfer_done(wm, "wayland to X");
 		/* Non-incr transfer all done. */
 		weston_wm_flush_source_data(wm);
 		weston_wm_send_selection_notify(wm, wm->selection_request.property);
@@ -413,13 +460,22 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 		}
 		xcb_flush(wm->conn);
 		wl_event_source_remove(wm->property_source);
-		close(wm->data_source_fd);
-		wm->data_source_fd = -1;
 		close(fd);
-	} else {
-		weston_log("nothing happened, buffered the bytes\n");
+		wm->data_source_fd = -1;
 	}
 
+	return 1;
+
+err:
+	weston_log("read error from data source: %m\n");
+	weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
+	wl_event_source_remove(wm->property_source);
+	close(fd);
+	wl_array_release(&wm->source_data);
+	wl_array_init(&wm->source_data);
+	wm->data_source_fd = -1;
+	wm->selection_request.requestor = XCB_NONE;
+
 	return 1;
 }
 
@@ -439,6 +495,7 @@ weston_wm_send_data(struct weston_wm *wm, xcb_atom_t target, const char *mime_ty
 	wl_array_init(&wm->source_data);
 	wm->selection_target = target;
 	wm->data_source_fd = p[0];
+	weston_wm_transfer_start(wm, p[0]);
 	wm->property_source = wl_event_loop_add_fd(wm->server->loop,
 						   wm->data_source_fd,
 						   WL_EVENT_READABLE,
@@ -479,6 +536,7 @@ weston_wm_send_incr_chunk(struct weston_wm *wm)
 			wm->flush_property_on_delete = 1;
 			wl_array_release(&wm->source_data);
 		} else {
+			weston_wm_transfer_done(wm, "wayland to X");
 			wm->selection_request.requestor = XCB_NONE;
 		}
 	}
@@ -676,9 +734,20 @@ weston_wm_selection_init(struct weston_wm *wm)
 {
 	struct weston_seat *seat;
 	uint32_t values[1], mask;
+	uint64_t max_request;
 
 	wm->selection_request.requestor = XCB_NONE;
 
+	/* The maximum request length is in 4 byte units and includes the
+	 * ChangeProperty header. */
+	max_request =
+		(uint64_t) xcb_get_maximum_request_length(wm->conn) * 4 - 64;
+	if (max_request > SELECTION_CHUNK_SIZE_MAX)
+		max_request = SELECTION_CHUNK_SIZE_MAX;
+	if (max_request < SELECTION_CHUNK_SIZE_MIN)
+		max_request = SELECTION_CHUNK_SIZE_MIN;
+	wm->selection_chunk_size = max_request;
+
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE;
 	wm->selection_window = xcb_generate_id(wm->conn);
 	xcb_create_window(wm->conn,
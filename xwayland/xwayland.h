@@ -85,6 +85,11 @@ struct weston_wm {
 	int selection_property_set;
 	int flush_property_on_delete;
 	struct wl_listener selection_listener;
+	uint32_t selection_chunk_size;
+	struct {
+		uint64_t start;		/* usecs */
+		size_t bytes;
+	} selection_transfer;
 
 	xcb_window_t dnd_window;
 	xcb_window_t dnd_owner;